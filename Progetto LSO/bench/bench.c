@@ -0,0 +1,121 @@
+// Microbenchmark delle funzioni sul percorso di ogni mossa: check_win,
+// row_col e composizione dei messaggi (msg_t).
+//
+// Include direttamente server.c, così misura esattamente il codice del
+// server; il main del server viene rinominato e i log delle regole
+// disattivati (come nel simulatore), altrimenti si misurerebbe printf.
+//
+// Compilazione: gcc -O2 bench.c -o bench -lpthread
+// Uso: ./bench [iterazioni]
+
+#define RULES_LOG(...)
+#define main server_main
+#include "../server/server.c"
+#undef main
+
+#define BOARDS 19683 // 3^9 griglie possibili
+
+volatile uint64_t bench_sink; // Impedisce al compilatore di eliminare i cicli
+
+// Nanosecondi trascorsi da start
+double bench_elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+void bench_report(const char *name, double ns, long ops) {
+    printf("%-28s %10.2f ns/op  %12.0f op/s\n", name, ns / ops, ops / (ns / 1e9));
+}
+
+// check_win su tutte le griglie possibili
+void bench_check_win(char (*boards)[GRID_SIZE], long iterations) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t sum = 0;
+    for (long it = 0; it < iterations; ++it) {
+        for (int b = 0; b < BOARDS; ++b) {
+            sum += check_win(boards[b]);
+        }
+    }
+    bench_sink = sum;
+    bench_report("check_win", bench_elapsed_ns(&start), iterations * BOARDS);
+}
+
+// row_col su tutte le coppie riga/colonna
+void bench_row_col(long iterations) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t sum = 0;
+    for (long it = 0; it < iterations * BOARDS; ++it) {
+        sum += row_col(it % TABLE_SIZE, (it / TABLE_SIZE) % TABLE_SIZE);
+    }
+    bench_sink = sum;
+    bench_report("row_col", bench_elapsed_ns(&start), iterations * BOARDS);
+}
+
+// Messaggio di una mossa: flag e griglia
+void bench_msg_board(char (*boards)[GRID_SIZE], long iterations) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t sum = 0;
+    msg_t msg;
+    for (long it = 0; it < iterations; ++it) {
+        for (int b = 0; b < BOARDS; ++b) {
+            msg_init(&msg);
+            msg_put_board(&msg, YOUR_MOVE_FLAG, boards[b]);
+            sum += msg.len + (uint8_t)msg.data[4];
+        }
+    }
+    bench_sink = sum;
+    bench_report("msg_put_board", bench_elapsed_ns(&start), iterations * BOARDS);
+}
+
+// Riga di classifica: interi e nome, come in tournament_publish_standings
+void bench_msg_standings(long iterations) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t sum = 0;
+    msg_t msg;
+    const char *name = "giocatore_di_prova";
+    int name_len = strlen(name);
+    long rows = iterations * BOARDS / TOURNAMENT_STANDINGS_TOP;
+    for (long r = 0; r < rows; ++r) {
+        msg_init(&msg);
+        msg_put_flag(&msg, TOURNAMENT_STANDINGS);
+        for (int i = 0; i < TOURNAMENT_STANDINGS_TOP; ++i) {
+            msg_put_int(&msg, i + 1);
+            msg_put_int(&msg, (int)r + i);
+            msg_put_int(&msg, i);
+            msg_put_len(&msg, name_len);
+            msg_put(&msg, name, name_len);
+        }
+        sum += msg.len;
+    }
+    bench_sink = sum;
+    bench_report("msg standings (riga)", bench_elapsed_ns(&start), rows * TOURNAMENT_STANDINGS_TOP);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 200;
+    if (iterations <= 0) {
+        iterations = 200;
+    }
+
+    // Tutte le 3^9 griglie (anche quelle non raggiungibili in partita)
+    static char boards[BOARDS][GRID_SIZE];
+    for (int b = 0; b < BOARDS; ++b) {
+        int code = b;
+        for (int i = 0; i < GRID_SIZE; ++i) {
+            boards[b][i] = " XO"[code % 3];
+            code /= 3;
+        }
+    }
+
+    printf("Microbenchmark (%ld passate su %d griglie)\n", iterations, BOARDS);
+    bench_check_win(boards, iterations);
+    bench_row_col(iterations);
+    bench_msg_board(boards, iterations);
+    bench_msg_standings(iterations);
+    return 0;
+}
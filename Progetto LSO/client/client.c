@@ -2,15 +2,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <unistd.h>
 #include <termios.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <time.h>
 
 // Costanti di configurazione
 #define TABLE_SIZE 3 // Dimensione griglia tris (3x3)
 #define GRID_SIZE 9  // Totale celle (TABLE_SIZE * TABLE_SIZE)
+#define LEADERBOARD_ROWS 10 // Righe di classifica richieste al server
+#define RECONNECT_ATTEMPTS 30 // Tentativi di ricollegamento dopo la perdita del server (uno al secondo)
+#define LOBBY_MAX_ROOMS 64 // Stanze mostrate al massimo nell'elenco
+#define READER_SIZE 8192 // Buffer dei messaggi ricevuti (il server invia al massimo 4096 byte per messaggio)
+#define INPUT_SIZE 256 // Buffer delle righe lette da tastiera
+#define SCREEN_ROWS 48 // Righe dello schermo gestite dal client
+#define SCREEN_COLS 100 // Colonne dello schermo gestite dal client
+#define STANDINGS_ROWS 16 // Righe di classifica del torneo mostrate
+#define UDP_HEADER 17 // Tipo (1 byte), token (8), seq (4), ack (4)
+#define UDP_PAYLOAD_MAX 128 // Messaggio più lungo inviato su UDP
+#define UDP_HELLO_TRIES 10 // UDP_HELLO senza risposta prima di restare su TCP
+#define UDP_RTO_INITIAL_MS 200 // Timeout di ritrasmissione prima di misurare il RTT
+#define UDP_RTO_MIN_MS 20
+#define UDP_RTO_MAX_MS 2000
 
 // Flag di comunicazione tra server e client
 #define WAIT_FLAG 0
@@ -26,27 +44,49 @@
 #define JOIN_REQUEST 13
 #define JOIN_ACCEPTED 14
 #define JOIN_REJECTED 15
+#define TOURNAMENT_JOIN 20
+#define TOURNAMENT_REGISTERED 21
+#define TOURNAMENT_ROUND 22
+#define TOURNAMENT_BYE 23
+#define TOURNAMENT_STANDINGS 24
+#define TOURNAMENT_END 25
+#define RESUME_REQUEST 26
+#define RESUME_REJECTED 27
+#define LEADERBOARD_REQUEST 28
+#define LEADERBOARD 29
+#define LOBBY_SUBSCRIBE 30
+#define LOBBY_SNAPSHOT 31
+#define LOBBY_UPDATE 32
+#define SERVER_BUSY 33
+#define UDP_REQUEST 34
+#define UDP_TOKEN 35
+#define TOURNAMENT_CANCELLED 36
+#define JOIN_EXPIRED 37
 #define NO_FLAG 0
 
-/* Stampa la griglia di gioco */
-void print_grid(char *grid)
-{
-    printf("\n");
-    for (int i = 0; i < TABLE_SIZE; i++)
-    {
-        printf(" ");
-        for (int j = 0; j < TABLE_SIZE; j++)
-        {
-            printf(" %c ", grid[i * TABLE_SIZE + j]);
-            if (j < TABLE_SIZE - 1)
-                printf("|");
-        }
-        printf("\n");
-        if (i < TABLE_SIZE - 1)
-            printf("-------------\n");
-    }
-    printf("\n");
-}
+// Tipi di datagramma del trasporto UDP
+#define UDP_HELLO 1
+#define UDP_DATA 2
+#define UDP_ACK 3
+#define UDP_RESYNC 4
+
+// Operazioni negli aggiornamenti della lobby
+#define LOBBY_ADD 0
+#define LOBBY_REMOVE 1
+
+// Righe fisse della schermata di gioco
+#define ROW_TITLE 1
+#define ROW_PLAYERS 2
+#define ROW_GRID 4    // Prima riga della griglia (le righe di celle sono alternate ai separatori)
+#define ROW_STATUS 10 // Stato o richiesta all'utente (il cursore resta alla fine)
+#define ROW_NOTICE 11 // Errori di input e avvisi
+#define ROW_EXTRA 13  // Informazioni sul torneo
+
+// Input atteso dall'utente durante una sessione
+#define INPUT_NONE 0
+#define INPUT_MOVE 1       // Mossa (1-9)
+#define INPUT_JOIN_REPLY 2 // Risposta a una richiesta di unirsi alla stanza (y/n)
+#define INPUT_ROOM 3       // ID di una stanza aperta (0 per tornare al menu)
 
 /* Pulisce lo schermo */
 void clear_screen()
@@ -62,7 +102,10 @@ void show_menu()
     printf("1. Partita casuale\n");
     printf("2. Crea stanza privata\n");
     printf("3. Unisciti a stanza privata\n");
-    printf("4. Esci\n\n");
+    printf("4. Partecipa a un torneo\n");
+    printf("5. Classifica e statistiche\n");
+    printf("6. Stanze aperte\n");
+    printf("7. Esci\n\n");
 }
 
 /* Ottiene la scelta del menu */
@@ -72,11 +115,11 @@ int get_menu_choice()
     int choice;
     while (1)
     {
-        printf("Seleziona un'opzione (1-4): ");
+        printf("Seleziona un'opzione (1-7): ");
         fgets(input, sizeof(input), stdin);
-        if (sscanf(input, "%d", &choice) != 1 || choice < 1 || choice > 4)
+        if (sscanf(input, "%d", &choice) != 1 || choice < 1 || choice > 7)
         {
-            printf("Scelta non valida. Inserisci un numero tra 1 e 4.\n");
+            printf("Scelta non valida. Inserisci un numero tra 1 e 7.\n");
             continue;
         }
         return choice;
@@ -89,30 +132,6 @@ int position_to_index(int pos)
     return pos - 1;
 }
 
-/* Valida la mossa dell'utente */
-int get_valid_move(char *grid)
-{
-    int position;
-    char input[10];
-    while (1)
-    {
-        printf("Inserisci la tua mossa (1-9): ");
-        fgets(input, sizeof(input), stdin);
-        if (sscanf(input, "%d", &position) != 1 || position < 1 || position > 9)
-        {
-            printf("Input non valido. Inserisci un numero tra 1 e 9.\n");
-            continue;
-        }
-        int index = position_to_index(position);
-        if (grid[index] != ' ')
-        {
-            printf("Cella già occupata. Scegli un'altra posizione.\n");
-            continue;
-        }
-        return index;
-    }
-}
-
 // caaaaapisce che tasto viene cliccato
 void wait_for_keypress()
 {
@@ -125,151 +144,1157 @@ void wait_for_keypress()
     tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
 }
 
-/* Gestisce la partita */
-void handle_game(int client_socket, char *player_name, char *opponent_name,
-                 char *player_symbol, char *opponent_symbol, char *grid)
+/* ======================= SCHERMO ======================= */
+/* Il client ricorda cosa c'è sullo schermo e a ogni aggiornamento riscrive
+   solo i caratteri cambiati: una mossa dell'avversario costa lo spostamento
+   del cursore e una cella, invece di pulire e ridisegnare tutto. Su una
+   connessione SSH lenta il traffico verso il terminale resta minimo. */
+
+typedef struct screen_t
 {
-    int game_id = 0; // Variabile per memorizzare l'ID partita
-    while (1)
+    char lines[SCREEN_ROWS + 1][SCREEN_COLS + 1]; // Contenuto di ogni riga (dalla 1)
+    int valid[SCREEN_ROWS + 1]; // 0 se il contenuto della riga non è noto
+    int used;                   // Ultima riga scritta
+} screen_t;
+
+screen_t screen;
+
+/* Pulisce lo schermo e dimentica il contenuto precedente */
+void screen_reset()
+{
+    clear_screen();
+    memset(&screen, 0, sizeof(screen));
+    for (int row = 1; row <= SCREEN_ROWS; row++)
+        screen.valid[row] = 1;
+}
+
+/* Colonna del terminale del byte indicato (i caratteri UTF-8 occupano più byte) */
+int screen_column(const char *text, size_t offset)
+{
+    int column = 1;
+    for (size_t i = 0; i < offset; i++)
+        if ((text[i] & 0xC0) != 0x80)
+            column++;
+    return column;
+}
+
+/* Imposta il contenuto di una riga scrivendo solo la parte cambiata */
+void screen_line(int row, const char *fmt, ...)
+{
+    if (row < 1 || row > SCREEN_ROWS)
+        return;
+    char text[SCREEN_COLS + 1];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    char *old = screen.lines[row];
+    if (text[0] && row > screen.used)
+        screen.used = row;
+    if (!screen.valid[row])
     {
-        int flag;
-        if (recv(client_socket, &flag, sizeof(int), 0) <= 0)
+        printf("\033[%d;1H%s\033[K", row, text);
+    }
+    else if (strcmp(old, text) != 0)
+    {
+        // Parte comune all'inizio e alla fine della riga
+        size_t n_new = strlen(text), n_old = strlen(old), first = 0;
+        while (first < n_new && first < n_old && text[first] == old[first])
+            first++;
+        while (first > 0 && (text[first] & 0xC0) == 0x80)
+            first--;
+        size_t end_new = n_new, end_old = n_old;
+        if (n_new == n_old)
+            while (end_new > first && text[end_new - 1] == old[end_old - 1])
+                end_new--, end_old--;
+        while (end_new < n_new && (text[end_new] & 0xC0) == 0x80)
+            end_new++;
+
+        printf("\033[%d;%dH%.*s", row, screen_column(text, first), (int)(end_new - first), text + first);
+        if (n_new < n_old)
+            printf("\033[K");
+    }
+    strcpy(old, text);
+    screen.valid[row] = 1;
+}
+
+/* Svuota le righe da row in poi */
+void screen_clear_from(int row)
+{
+    for (int r = row; r <= screen.used; r++)
+        screen_line(r, "");
+}
+
+/* Dopo un invio la riga contiene anche il testo digitato: va riscritta */
+void screen_invalidate(int row)
+{
+    if (row >= 1 && row <= SCREEN_ROWS)
+        screen.valid[row] = 0;
+}
+
+/* Porta il cursore alla fine della riga (dove l'utente scrive) e invia tutto al terminale */
+void screen_prompt(int row)
+{
+    printf("\033[%d;%dH", row, screen_column(screen.lines[row], strlen(screen.lines[row])));
+    fflush(stdout);
+}
+
+/* Porta il cursore sotto l'ultima riga usata, per tornare alla stampa normale */
+void screen_end()
+{
+    printf("\033[%d;1H\n", screen.used + 1);
+    fflush(stdout);
+}
+
+/* ======================= MESSAGGI DAL SERVER ======================= */
+/* I byte ricevuti si accumulano in un buffer e un messaggio viene gestito
+   solo quando è arrivato per intero, anche se il kernel lo consegna a pezzi. */
+
+// Lettura sequenziale di un messaggio (error = 1 se i byte non bastano)
+typedef struct cursor_t
+{
+    const char *p;
+    size_t left;
+    int error;
+} cursor_t;
+
+void cursor_get(cursor_t *c, void *dst, size_t n)
+{
+    if (c->error || n > c->left)
+    {
+        c->error = 1;
+        if (dst)
+            memset(dst, 0, n);
+        return;
+    }
+    if (dst)
+        memcpy(dst, c->p, n);
+    c->p += n;
+    c->left -= n;
+}
+
+/* Flag (nell'ordine dell'host, come nel resto del protocollo) */
+int cursor_flag(cursor_t *c)
+{
+    int flag;
+    cursor_get(c, &flag, sizeof(int));
+    return flag;
+}
+
+/* Intero in network byte order */
+int cursor_int(cursor_t *c)
+{
+    int value;
+    cursor_get(c, &value, sizeof(int));
+    return ntohl(value);
+}
+
+/* Lunghezza codificata con htons su un int */
+int cursor_len(cursor_t *c)
+{
+    int value;
+    cursor_get(c, &value, sizeof(int));
+    return ntohs(value);
+}
+
+/* Stringa di len byte (troncata se non entra in dst) */
+void cursor_string(cursor_t *c, char *dst, size_t size, int len)
+{
+    if (len < 0)
+    {
+        c->error = 1;
+        len = 0;
+    }
+    size_t keep = (size_t)len < size ? (size_t)len : size - 1;
+    cursor_get(c, dst, keep);
+    cursor_get(c, NULL, len - keep);
+    dst[c->error ? 0 : keep] = '\0';
+}
+
+/* Salta una stringa di len byte */
+void cursor_skip(cursor_t *c, int len)
+{
+    if (len < 0)
+        c->error = 1;
+    else
+        cursor_get(c, NULL, len);
+}
+
+/* Lunghezza del messaggio all'inizio dei dati: 0 se non è ancora arrivato
+   per intero, -1 se il flag è sconosciuto */
+int message_length(const char *data, size_t len)
+{
+    cursor_t c = {data, len, 0};
+    int flag = cursor_flag(&c), count;
+    switch (flag)
+    {
+    case WAIT_FLAG:
+    case JOIN_ACCEPTED:
+    case JOIN_REJECTED:
+    case JOIN_EXPIRED:
+    case RESUME_REJECTED:
+    case SERVER_BUSY:
+        break;
+    case UDP_TOKEN:
+        cursor_get(&c, NULL, 2 * sizeof(int));
+        break;
+    case START_FLAG:
+        cursor_int(&c);
+        cursor_skip(&c, cursor_len(&c));
+        cursor_get(&c, NULL, 1);
+        cursor_int(&c);
+        break;
+    case OPPONENT_MOVE_FLAG:
+    case YOUR_MOVE_FLAG:
+    case WIN_FLAG:
+    case LOSE_FLAG:
+    case DRAW_FLAG:
+        cursor_get(&c, NULL, GRID_SIZE);
+        break;
+    case PRIVATE_CREATED:
+        cursor_get(&c, NULL, 2 * sizeof(int));
+        break;
+    case JOIN_REQUEST:
+        cursor_skip(&c, cursor_len(&c));
+        break;
+    case TOURNAMENT_REGISTERED:
+    case TOURNAMENT_ROUND:
+    case TOURNAMENT_END:
+        cursor_get(&c, NULL, 2 * sizeof(int));
+        break;
+    case TOURNAMENT_CANCELLED:
+        cursor_int(&c);
+        break;
+    case TOURNAMENT_BYE:
+        cursor_get(&c, NULL, 3 * sizeof(int));
+        break;
+    case TOURNAMENT_STANDINGS:
+        cursor_get(&c, NULL, 4 * sizeof(int));
+        count = cursor_int(&c);
+        for (int i = 0; i < count && !c.error; i++)
         {
-            fprintf(stderr, "Connessione con il server persa.\n");
-            break;
+            cursor_get(&c, NULL, 3 * sizeof(int));
+            cursor_skip(&c, cursor_len(&c));
         }
-
-        switch (flag)
+        break;
+    case LEADERBOARD:
+        cursor_get(&c, NULL, 7 * sizeof(int));
+        count = cursor_int(&c);
+        for (int i = 0; i < count && !c.error; i++)
         {
-        case WAIT_FLAG:
-            clear_screen();
-            printf("In attesa che un altro giocatore si connetta...\n");
-            break;
+            cursor_get(&c, NULL, 4 * sizeof(int));
+            cursor_skip(&c, cursor_len(&c));
+        }
+        break;
+    case LOBBY_SNAPSHOT:
+        count = cursor_int(&c);
+        for (int i = 0; i < count && !c.error; i++)
+        {
+            cursor_int(&c);
+            cursor_skip(&c, cursor_len(&c));
+        }
+        break;
+    case LOBBY_UPDATE:
+        count = cursor_int(&c);
+        for (int i = 0; i < count && !c.error; i++)
+        {
+            int op = cursor_int(&c);
+            cursor_int(&c);
+            if (op == LOBBY_ADD)
+                cursor_skip(&c, cursor_len(&c));
+        }
+        break;
+    default:
+        return c.error ? 0 : -1;
+    }
+    return c.error ? 0 : (int)(len - c.left);
+}
+
+// Buffer dei byte ricevuti dal server
+typedef struct reader_t
+{
+    int socket;
+    char data[READER_SIZE];
+    size_t start; // Inizio del primo messaggio non ancora gestito
+    size_t end;   // Fine dei byte ricevuti
+} reader_t;
+
+void reader_init(reader_t *r, int socket)
+{
+    r->socket = socket;
+    r->start = r->end = 0;
+}
+
+/* Riceve i byte disponibili (0 = connessione chiusa, -1 = errore) */
+int reader_fill(reader_t *r)
+{
+    if (r->start > 0)
+    {
+        memmove(r->data, r->data + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->end == sizeof(r->data))
+        return -1; // Messaggio più grande del buffer
+    ssize_t n = recv(r->socket, r->data + r->end, sizeof(r->data) - r->end, 0);
+    if (n < 0 && errno == EINTR)
+        return 1;
+    if (n > 0)
+        r->end += n;
+    return (int)n;
+}
+
+/* Prossimo messaggio completo (1 = trovato, 0 = incompleto, -1 = non valido) */
+int reader_next(reader_t *r, cursor_t *message)
+{
+    int len = message_length(r->data + r->start, r->end - r->start);
+    if (len <= 0)
+        return len;
+    message->p = r->data + r->start;
+    message->left = len;
+    message->error = 0;
+    r->start += len;
+    return 1;
+}
+
+// Righe digitate dall'utente e non ancora gestite
+char input_data[INPUT_SIZE];
+size_t input_len = 0;
+
+/* Legge i caratteri disponibili da tastiera (0 = fine input, -1 = errore) */
+int input_fill()
+{
+    if (input_len == sizeof(input_data))
+        input_len = 0; // Riga troppo lunga: viene scartata
+    ssize_t n = read(STDIN_FILENO, input_data + input_len, sizeof(input_data) - input_len);
+    if (n < 0 && errno == EINTR)
+        return 1;
+    if (n > 0)
+        input_len += n;
+    return (int)n;
+}
+
+/* Prossima riga completa digitata dall'utente (1 = trovata, 0 = nessuna) */
+int input_line(char *line, size_t size)
+{
+    char *newline = memchr(input_data, '\n', input_len);
+    if (!newline)
+        return 0;
+    size_t line_len = newline - input_data;
+    size_t keep = line_len < size ? line_len : size - 1;
+    memcpy(line, input_data, keep);
+    line[keep] = '\0';
+    input_len -= line_len + 1;
+    memmove(input_data, newline + 1, input_len);
+    return 1;
+}
+
+/* ======================= TRASPORTO UDP ======================= */
+/* Con TRIS_UDP=1 le partite casuali e private passano su UDP: su una rete
+   con perdite un segmento TCP perso ferma anche i messaggi successivi.
+   Il client chiede UDP premettendo UDP_REQUEST al flag iniziale, riceve il
+   token su TCP e lo invia in un UDP_HELLO. Ogni messaggio del server è un
+   datagramma numerato che il client conferma; le mosse sono numerate allo
+   stesso modo e ritrasmesse finché il server non le conferma. Un messaggio
+   che arriva su TCP durante la partita significa che il server è tornato a
+   TCP: da lì in poi il client usa solo TCP. */
+
+/* Stato del canale UDP di una sessione */
+typedef struct udp_channel_t
+{
+    int socket;           // -1 se UDP non è in uso
+    char token[8];        // Token della sessione (come ricevuto)
+    int heard;            // 1 dopo il primo datagramma del server
+    int active;           // 1 dopo il primo messaggio ricevuto su UDP
+    int hello_tries;      // UDP_HELLO inviati senza risposta
+    uint32_t expected;    // Prossimo messaggio atteso dal server
+    uint32_t next_seq;    // Numero della prossima mossa
+    int pending;          // 1 se una mossa attende conferma
+    int move;             // Mossa in attesa di conferma
+    uint32_t move_seq;
+    int retransmitted;    // 1 se la mossa è stata ritrasmessa (niente misura del RTT)
+    long long sent_at;    // Ultimo invio (HELLO o mossa) in ms
+    int srtt, rto;        // Stima del RTT e timeout di ritrasmissione in ms
+    reader_t reader;      // Messaggi ricevuti in ordine
+} udp_channel_t;
+
+/* Istante corrente in millisecondi */
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void udp_put32(char *p, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+uint32_t udp_get32(const char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+void udp_reset(udp_channel_t *u)
+{
+    if (u->socket >= 0)
+        close(u->socket);
+    memset(u, 0, sizeof(*u));
+    u->socket = -1;
+    reader_init(&u->reader, -1);
+}
+
+/* Invia un datagramma con ack = prossimo messaggio atteso */
+void udp_send(udp_channel_t *u, int type, uint32_t seq, const void *data, size_t len)
+{
+    char datagram[UDP_HEADER + sizeof(int)];
+    datagram[0] = (char)type;
+    memcpy(datagram + 1, u->token, sizeof(u->token));
+    udp_put32(datagram + 9, seq);
+    udp_put32(datagram + 13, u->expected);
+    if (len > 0)
+        memcpy(datagram + UDP_HEADER, data, len);
+    send(u->socket, datagram, UDP_HEADER + len, 0);
+}
+
+/* Apre il canale UDP con il token ricevuto dal server */
+void udp_open(udp_channel_t *u, struct sockaddr_in *server, cursor_t *c)
+{
+    udp_reset(u);
+    cursor_get(c, u->token, sizeof(u->token));
+    u->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (u->socket < 0 || connect(u->socket, (struct sockaddr *)server, sizeof(*server)) < 0)
+    {
+        udp_reset(u); // Si resta su TCP: il server ci tornerà da solo
+        return;
+    }
+    u->expected = u->next_seq = 1;
+    u->rto = UDP_RTO_INITIAL_MS;
+    udp_send(u, UDP_HELLO, 0, NULL, 0);
+    u->hello_tries = 1;
+    u->sent_at = now_ms();
+}
 
-        case START_FLAG:
+/* Invia una mossa su UDP */
+void udp_send_move(udp_channel_t *u, int net_move)
+{
+    u->move = net_move;
+    u->move_seq = u->next_seq++;
+    u->pending = 1;
+    u->retransmitted = 0;
+    u->sent_at = now_ms();
+    udp_send(u, UDP_DATA, u->move_seq, &u->move, sizeof(int));
+}
+
+/* Aggiunge un messaggio ricevuto a quelli da gestire */
+void udp_deliver(udp_channel_t *u, const char *data, size_t len)
+{
+    reader_t *r = &u->reader;
+    memmove(r->data, r->data + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+    if (len <= sizeof(r->data) - r->end)
+    {
+        memcpy(r->data + r->end, data, len);
+        r->end += len;
+    }
+    u->active = 1;
+}
+
+/* Legge i datagrammi disponibili e conferma quelli del server */
+void udp_receive(udp_channel_t *u)
+{
+    char datagram[UDP_HEADER + UDP_PAYLOAD_MAX];
+    ssize_t n;
+    while ((n = recv(u->socket, datagram, sizeof(datagram), MSG_DONTWAIT)) >= UDP_HEADER)
+    {
+        if (memcmp(datagram + 1, u->token, sizeof(u->token)) != 0)
+            continue;
+        int type = datagram[0];
+        uint32_t seq = udp_get32(datagram + 9);
+        uint32_t ack = udp_get32(datagram + 13);
+        u->heard = 1;
+
+        if (u->pending && (int32_t)(ack - u->move_seq) > 0)
         {
-            clear_screen();
-            // 1. Ricevi prima l'ID partita dal server
-            int net_game_id;
-            if (recv(client_socket, (char *)&net_game_id, sizeof(int), 0) <= 0)
+            if (!u->retransmitted)
             {
-                fprintf(stderr, "Errore ricezione ID partita\n");
-                return;
+                int rtt = (int)(now_ms() - u->sent_at);
+                u->srtt = u->srtt ? (7 * u->srtt + rtt) / 8 : rtt;
             }
+            u->pending = 0;
+            u->rto = u->srtt ? 2 * u->srtt + UDP_RTO_MIN_MS : UDP_RTO_INITIAL_MS;
+            if (u->rto > UDP_RTO_MAX_MS)
+                u->rto = UDP_RTO_MAX_MS;
+        }
+        if (type == UDP_DATA && seq == u->expected)
+        {
+            udp_deliver(u, datagram + UDP_HEADER, n - UDP_HEADER);
+            u->expected = seq + 1;
+        }
+        // UDP_RESYNC contiene lo stato completo e sostituisce i messaggi persi,
+        // preceduto dal numero dell'ultimo datagramma con lo stato: se era già
+        // arrivato lo stato è noto e non va gestito di nuovo
+        else if (type == UDP_RESYNC && n >= UDP_HEADER + 4 && (int32_t)(seq - u->expected) >= 0)
+        {
+            if ((int32_t)(u->expected - udp_get32(datagram + UDP_HEADER)) <= 0)
+                udp_deliver(u, datagram + UDP_HEADER + 4, n - UDP_HEADER - 4);
+            u->expected = seq + 1;
+        }
+        if (type == UDP_DATA || type == UDP_RESYNC)
+            udp_send(u, UDP_ACK, 0, NULL, 0);
+    }
+}
 
-            // 2. Poi ricevi i dati dell'avversario
-            int opponent_name_len;
-            if (recv(client_socket, &opponent_name_len, sizeof(int), 0) <= 0)
-            {
-                fprintf(stderr, "Errore ricezione lunghezza nome avversario.\n");
-                return;
-            }
-            opponent_name_len = ntohs(opponent_name_len);
-            if (recv(client_socket, opponent_name, opponent_name_len, 0) <= 0)
-            {
-                fprintf(stderr, "Errore ricezione nome avversario.\n");
-                return;
-            }
-            opponent_name[opponent_name_len] = '\0';
+/* Ritrasmette HELLO o mossa scaduti; restituisce i ms alla prossima
+   scadenza (-1 se nessuna) */
+int udp_timers(udp_channel_t *u)
+{
+    if (u->socket < 0 || (u->heard && !u->pending))
+        return -1;
+    long long now = now_ms();
+    if (now - u->sent_at >= u->rto)
+    {
+        if (!u->heard && u->hello_tries == UDP_HELLO_TRIES)
+        {
+            udp_reset(u); // UDP bloccato: il server passerà a TCP
+            return -1;
+        }
+        if (u->heard)
+        {
+            udp_send(u, UDP_DATA, u->move_seq, &u->move, sizeof(int));
+            u->retransmitted = 1;
+        }
+        else
+        {
+            udp_send(u, UDP_HELLO, 0, NULL, 0);
+            u->hello_tries++;
+        }
+        u->sent_at = now;
+        u->rto = 2 * u->rto > UDP_RTO_MAX_MS ? UDP_RTO_MAX_MS : 2 * u->rto;
+    }
+    return (int)(u->sent_at + u->rto - now);
+}
 
-            if (recv(client_socket, player_symbol, sizeof(char), 0) <= 0)
-            {
-                fprintf(stderr, "Errore ricezione simbolo giocatore.\n");
-                return;
-            }
-            *opponent_symbol = (*player_symbol == 'X') ? 'O' : 'X';
+/* Un messaggio di gioco arrivato su TCP: il server ha smesso di usare UDP */
+void udp_check_fallback(udp_channel_t *u, const cursor_t *message)
+{
+    int flag;
+    memcpy(&flag, message->p, sizeof(int));
+    if (u->active && flag >= START_FLAG && flag <= DRAW_FLAG)
+        udp_reset(u);
+}
 
-            printf("=== PARTITA INIZIATA ===\n");
-            printf("Stai giocando contro: %s\n", opponent_name);
-            printf("Il tuo simbolo: %c\n", *player_symbol);
-            memset(grid, ' ', GRID_SIZE);
-            break;
+/* ======================= SESSIONE ======================= */
+/* Una connessione al server è gestita da un unico ciclo poll su tastiera e
+   socket: i messaggi del server vengono elaborati anche mentre il client
+   attende una mossa o una risposta, e lo schermo viene aggiornato da
+   render_session a partire dallo stato della sessione. */
+
+/* Stanza nell'elenco della lobby */
+typedef struct lobby_room_t
+{
+    int id;
+    char name[50];
+} lobby_room_t;
+
+// Stato di una connessione al server
+typedef struct session_t
+{
+    reader_t reader;
+    struct sockaddr_in *server;
+    char *player_name;
+    int tournament; // 1 se le partite fanno parte di un torneo
+    int lobby;      // 1 se mostra l'elenco delle stanze aperte
+    int done;       // 1 quando la sessione è conclusa
+    int result;     // Stanza scelta nella lobby (0 = nessuna, -1 = errore)
+    int input;      // Input atteso dall'utente (INPUT_*)
+    int prompt_row; // Riga in cui l'utente scrive
+    int game_id;    // Partita da riprendere dopo un riavvio del server (-1 se nessuna)
+    int room_id;    // Stanza creata da riprendere (0 se nessuna)
+    int game_token; // Codici di ripresa ricevuti dal server
+    int room_token;
+    udp_channel_t udp; // Canale UDP della partita
+
+    char title[SCREEN_COLS];
+    char status[SCREEN_COLS];
+    char notice[SCREEN_COLS];
+    int playing; // 1 se la griglia è da mostrare
+    char grid[GRID_SIZE];
+    char opponent_name[50];
+    char player_symbol, opponent_symbol;
+
+    char tournament_line[SCREEN_COLS]; // Turno in corso o posizione finale
+    char event_line[SCREEN_COLS];      // Riposo o ultimo evento del torneo
+    char standings[STANDINGS_ROWS + 2][SCREEN_COLS];
+    int n_standings;
+
+    lobby_room_t rooms[LOBBY_MAX_ROOMS];
+    int n_rooms;
+} session_t;
+
+/* Scrive un punteggio espresso in mezzi punti */
+void format_score(char *dst, size_t size, int score2)
+{
+    snprintf(dst, size, "%d%s", score2 / 2, score2 % 2 ? ".5" : "");
+}
+
+/* Aggiorna lo schermo con lo stato della sessione */
+void render_session(session_t *s)
+{
+    s->prompt_row = ROW_STATUS;
+    if (s->lobby)
+    {
+        screen_line(1, "=== STANZE APERTE ===");
+        screen_line(2, "");
+        int row = 3;
+        if (s->n_rooms == 0)
+            screen_line(row++, "Nessuna stanza aperta al momento.");
+        for (int i = 0; i < s->n_rooms; i++)
+            screen_line(row++, "  %4d  creata da %s", s->rooms[i].id, s->rooms[i].name);
+        screen_line(row++, "");
+        s->prompt_row = row;
+        screen_line(row++, "Inserisci l'ID della stanza in cui entrare (0 per tornare al menu): ");
+        screen_clear_from(row);
+        screen_prompt(s->prompt_row);
+        return;
+    }
+
+    screen_line(ROW_TITLE, "%s", s->title);
+    if (s->playing)
+    {
+        screen_line(ROW_PLAYERS, "Tu: %c (%s) vs Avversario: %c (%s)",
+                    s->player_symbol, s->player_name, s->opponent_symbol, s->opponent_name);
+        for (int i = 0; i < TABLE_SIZE; i++)
+        {
+            const char *cell = s->grid + i * TABLE_SIZE;
+            screen_line(ROW_GRID + 2 * i, "  %c | %c | %c ", cell[0], cell[1], cell[2]);
+            if (i < TABLE_SIZE - 1)
+                screen_line(ROW_GRID + 2 * i + 1, "-------------");
         }
+    }
+    else
+    {
+        for (int row = ROW_PLAYERS; row < ROW_STATUS; row++)
+            screen_line(row, "");
+    }
+    screen_line(ROW_STATUS, "%s", s->status);
+    screen_line(ROW_NOTICE, "%s", s->notice);
 
-        case YOUR_MOVE_FLAG:
+    int row = ROW_EXTRA;
+    if (s->tournament)
+    {
+        screen_line(row++, "%s", s->tournament_line);
+        screen_line(row++, "%s", s->event_line);
+        for (int i = 0; i < s->n_standings; i++)
+            screen_line(row++, "%s", s->standings[i]);
+    }
+    screen_clear_from(row);
+    screen_prompt(s->input != INPUT_NONE ? s->prompt_row : (screen.used > ROW_STATUS ? screen.used : ROW_STATUS));
+}
+
+/* Imposta una riga di testo della sessione */
+void session_text(char *dst, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(dst, SCREEN_COLS, fmt, args);
+    va_end(args);
+}
+
+/* Messaggi della partita (anche quelle del torneo) */
+void session_game_message(session_t *s, int flag, cursor_t *c)
+{
+    switch (flag)
+    {
+    case WAIT_FLAG:
+        session_text(s->title, "In attesa che un altro giocatore si connetta...");
+        break;
+
+    case START_FLAG:
+    {
+        int game_id = cursor_int(c);
+        cursor_string(c, s->opponent_name, sizeof(s->opponent_name), cursor_len(c));
+        cursor_get(c, &s->player_symbol, 1);
+        int token = cursor_int(c);
+        s->opponent_symbol = (s->player_symbol == 'X') ? 'O' : 'X';
+        if (!s->tournament)
         {
-            if (recv(client_socket, grid, GRID_SIZE, 0) <= 0)
-            {
-                fprintf(stderr, "Errore ricezione griglia.\n");
-                return;
-            }
+            s->game_id = game_id;
+            s->game_token = token;
+        }
+        s->playing = 1;
+        memset(s->grid, ' ', GRID_SIZE);
+        session_text(s->title, "=== PARTITA INIZIATA ===");
+        s->status[0] = s->notice[0] = '\0';
+        s->input = INPUT_NONE;
+        break;
+    }
 
-            clear_screen();
-            printf("=== TUO TURNO ===\n");
-            printf("Tu: %c (%s) vs Avversario: %c (%s)\n",
-                   *player_symbol, player_name, *opponent_symbol, opponent_name);
-            print_grid(grid);
+    case YOUR_MOVE_FLAG:
+        cursor_get(c, s->grid, GRID_SIZE);
+        s->playing = 1;
+        session_text(s->title, "=== TUO TURNO ===");
+        session_text(s->status, "Inserisci la tua mossa (1-9): ");
+        s->input = INPUT_MOVE;
+        break;
 
-            int move = get_valid_move(grid);
-            int net_move = htons(move);
-            send(client_socket, &net_move, sizeof(int), 0);
-            break;
+    case OPPONENT_MOVE_FLAG:
+        cursor_get(c, s->grid, GRID_SIZE);
+        s->playing = 1;
+        session_text(s->title, "=== TURNO AVVERSARIO ===");
+        session_text(s->status, "In attesa della mossa dell'avversario...");
+        s->notice[0] = '\0';
+        s->input = INPUT_NONE;
+        break;
+
+    case WIN_FLAG:
+    case LOSE_FLAG:
+    case DRAW_FLAG:
+        cursor_get(c, s->grid, GRID_SIZE);
+        s->playing = 1;
+        session_text(s->title, "%s", (flag == WIN_FLAG) ? "=== VITTORIA! ===" : (flag == LOSE_FLAG) ? "=== SCONFITTA ==="
+                                                                                               : "=== PAREGGIO ===");
+        s->notice[0] = '\0';
+        s->input = INPUT_NONE;
+        s->game_id = -1;
+        if (s->tournament)
+            session_text(s->status, "In attesa del prossimo turno del torneo...");
+        else
+        {
+            s->status[0] = '\0';
+            s->done = 1;
+        }
+        break;
+    }
+}
+
+/* Messaggi del torneo */
+void session_tournament_message(session_t *s, int flag, cursor_t *c)
+{
+    switch (flag)
+    {
+    case TOURNAMENT_REGISTERED:
+    {
+        int tournament_id = cursor_int(c), registered = cursor_int(c);
+        session_text(s->title, "Iscritto al torneo %d (%d iscritti).", tournament_id, registered);
+        session_text(s->status, "In attesa dell'inizio del torneo...");
+        break;
+    }
+
+    case TOURNAMENT_ROUND:
+    {
+        int round = cursor_int(c), rounds = cursor_int(c);
+        session_text(s->tournament_line, "=== TURNO %d/%d ===", round, rounds);
+        s->event_line[0] = '\0';
+        break;
+    }
+
+    case TOURNAMENT_BYE:
+    {
+        int round = cursor_int(c), rounds = cursor_int(c), points2 = cursor_int(c);
+        char points[16];
+        format_score(points, sizeof(points), points2);
+        session_text(s->tournament_line, "=== TURNO %d/%d ===", round, rounds);
+        session_text(s->event_line, "Turno %d/%d: riposo (%s punti assegnati).", round, rounds, points);
+        break;
+    }
+
+    case TOURNAMENT_STANDINGS:
+    {
+        int round = cursor_int(c), rounds = cursor_int(c);
+        int my_rank = cursor_int(c), my_score2 = cursor_int(c), count = cursor_int(c);
+        char score[16], buchholz[16];
+        s->n_standings = 0;
+        session_text(s->standings[s->n_standings++], "=== CLASSIFICA DOPO IL TURNO %d/%d ===", round, rounds);
+        for (int i = 0; i < count && !c->error; i++)
+        {
+            int rank = cursor_int(c), score2 = cursor_int(c), buchholz2 = cursor_int(c);
+            char name[50];
+            cursor_string(c, name, sizeof(name), cursor_len(c));
+            if (s->n_standings > STANDINGS_ROWS)
+                continue;
+            format_score(score, sizeof(score), score2);
+            format_score(buchholz, sizeof(buchholz), buchholz2);
+            session_text(s->standings[s->n_standings++], "%3d. %-20s %s punti (Buchholz %s)",
+                         rank, name, score, buchholz);
         }
+        format_score(score, sizeof(score), my_score2);
+        session_text(s->standings[s->n_standings++], "Sei %d° con %s punti.", my_rank, score);
+        break;
+    }
+
+    case TOURNAMENT_END:
+    {
+        int rank = cursor_int(c), players = cursor_int(c);
+        session_text(s->title, "=== TORNEO CONCLUSO ===");
+        session_text(s->status, "Posizione finale: %d su %d", rank, players);
+        s->input = INPUT_NONE;
+        s->done = 1;
+        break;
+    }
 
-        case OPPONENT_MOVE_FLAG:
+    case TOURNAMENT_CANCELLED:
+    {
+        int tournament_id = cursor_int(c);
+        session_text(s->title, "=== TORNEO %d ANNULLATO ===", tournament_id);
+        session_text(s->status, "Iscritti insufficienti, riprova più tardi.");
+        s->input = INPUT_NONE;
+        s->done = 1;
+        break;
+    }
+    }
+}
+
+/* Statistiche del giocatore e classifica generale */
+void session_leaderboard(session_t *s, cursor_t *c)
+{
+    int found = cursor_int(c), rating = cursor_int(c), wins = cursor_int(c), losses = cursor_int(c);
+    int draws = cursor_int(c), streak = cursor_int(c), best_streak = cursor_int(c), count = cursor_int(c);
+
+    int row = 1;
+    screen_line(row++, "=== LE TUE STATISTICHE ===");
+    if (found)
+    {
+        screen_line(row++, "Rating: %d", rating);
+        screen_line(row++, "Vittorie: %d  Sconfitte: %d  Pareggi: %d", wins, losses, draws);
+        if (streak > 0)
+            screen_line(row++, "Serie attuale: %d vittorie", streak);
+        else if (streak < 0)
+            screen_line(row++, "Serie attuale: %d sconfitte", -streak);
+        screen_line(row++, "Serie di vittorie più lunga: %d", best_streak);
+    }
+    else
+    {
+        screen_line(row++, "Nessuna partita giocata (rating iniziale %d).", rating);
+    }
+
+    screen_line(row++, "");
+    screen_line(row++, "=== CLASSIFICA ===");
+    for (int i = 0; i < count && !c->error; i++)
+    {
+        char name[50];
+        rating = cursor_int(c);
+        wins = cursor_int(c);
+        losses = cursor_int(c);
+        draws = cursor_int(c);
+        cursor_string(c, name, sizeof(name), cursor_len(c));
+        screen_line(row++, "%3d. %-20s %4d  (%dV %dS %dP)", i + 1, name, rating, wins, losses, draws);
+    }
+    if (count == 0)
+        screen_line(row++, "Nessuna partita ancora giocata.");
+    screen_clear_from(row);
+    s->done = 1;
+}
+
+/* Applica un messaggio della lobby all'elenco: lo stato completo lo
+   sostituisce, un aggiornamento aggiunge e toglie solo le stanze cambiate */
+void session_lobby(session_t *s, int flag, cursor_t *c)
+{
+    int count = cursor_int(c);
+    if (flag == LOBBY_SNAPSHOT)
+        s->n_rooms = 0;
+    for (int i = 0; i < count && !c->error; i++)
+    {
+        lobby_room_t room;
+        int op = flag == LOBBY_SNAPSHOT ? LOBBY_ADD : cursor_int(c);
+        room.id = cursor_int(c);
+        if (op == LOBBY_ADD)
         {
-            if (recv(client_socket, grid, GRID_SIZE, 0) <= 0)
+            cursor_string(c, room.name, sizeof(room.name), cursor_len(c));
+            if (s->n_rooms < LOBBY_MAX_ROOMS)
+                s->rooms[s->n_rooms++] = room;
+            continue;
+        }
+        for (int r = 0; r < s->n_rooms; r++)
+        {
+            if (s->rooms[r].id == room.id)
             {
-                fprintf(stderr, "Errore ricezione griglia.\n");
-                return;
+                memmove(&s->rooms[r], &s->rooms[r + 1], (s->n_rooms - r - 1) * sizeof(lobby_room_t));
+                s->n_rooms--;
+                break;
             }
+        }
+    }
+    s->lobby = 1;
+    s->input = INPUT_ROOM;
+}
 
-            clear_screen();
-            printf("=== TURNO AVVERSARIO ===\n");
-            printf("Tu: %c (%s) vs Avversario: %c (%s)\n",
-                   *player_symbol, player_name, *opponent_symbol, opponent_name);
-            print_grid(grid);
-            printf("In attesa della mossa dell'avversario...\n");
-            break;
+/* Gestisce un messaggio completo del server */
+void session_message(session_t *s, cursor_t *c)
+{
+    int flag = cursor_flag(c);
+    switch (flag)
+    {
+    case PRIVATE_CREATED:
+    {
+        int room_id = cursor_int(c);
+        if (s->room_id)
+            session_text(s->notice, "Stanza %d di nuovo disponibile.", room_id);
+        s->room_id = room_id;
+        s->room_token = cursor_int(c);
+        session_text(s->title, "Stanza privata creata. ID: %d", room_id);
+        session_text(s->status, "Aspettando richieste...");
+        break;
+    }
+
+    case JOIN_REQUEST:
+    {
+        char joiner_name[50];
+        cursor_string(c, joiner_name, sizeof(joiner_name), cursor_len(c));
+        strcpy(s->opponent_name, joiner_name);
+        session_text(s->status, "%s vuole unirsi. Accetti? (y/n): ", joiner_name);
+        s->input = INPUT_JOIN_REPLY;
+        break;
+    }
+
+    case JOIN_ACCEPTED:
+        session_text(s->title, "Richiesta accettata! Avvio partita...");
+        break;
+
+    case JOIN_REJECTED:
+        session_text(s->title, "Richiesta rifiutata o stanza non trovata.");
+        s->done = 1;
+        break;
+
+    case JOIN_EXPIRED:
+        session_text(s->notice, "Richiesta di %s scaduta senza risposta.", s->opponent_name);
+        session_text(s->status, "Aspettando richieste...");
+        s->input = INPUT_NONE;
+        break;
+
+    case RESUME_REJECTED:
+        session_text(s->notice, s->room_id && s->game_id < 0 ? "La stanza non è più disponibile."
+                                                            : "La partita non è più disponibile.");
+        s->input = INPUT_NONE;
+        s->done = 1;
+        break;
+
+    case SERVER_BUSY:
+        session_text(s->notice, "Server sovraccarico, riprova più tardi.");
+        s->input = INPUT_NONE;
+        s->done = 1;
+        break;
+
+    case UDP_TOKEN:
+        udp_open(&s->udp, s->server, c);
+        return;
+
+    case LEADERBOARD:
+        session_leaderboard(s, c);
+        return;
+
+    case LOBBY_SNAPSHOT:
+    case LOBBY_UPDATE:
+        session_lobby(s, flag, c);
+        break;
+
+    case TOURNAMENT_REGISTERED:
+    case TOURNAMENT_ROUND:
+    case TOURNAMENT_BYE:
+    case TOURNAMENT_STANDINGS:
+    case TOURNAMENT_END:
+    case TOURNAMENT_CANCELLED:
+        session_tournament_message(s, flag, c);
+        break;
+
+    default:
+        session_game_message(s, flag, c);
+        break;
+    }
+    render_session(s);
+}
+
+/* Gestisce una riga digitata dall'utente */
+void session_input(session_t *s, const char *line)
+{
+    screen_invalidate(s->prompt_row);
+
+    if (s->input == INPUT_MOVE)
+    {
+        int position;
+        if (sscanf(line, "%d", &position) != 1 || position < 1 || position > 9)
+            session_text(s->notice, "Input non valido. Inserisci un numero tra 1 e 9.");
+        else if (s->grid[position_to_index(position)] != ' ')
+            session_text(s->notice, "Cella già occupata. Scegli un'altra posizione.");
+        else
+        {
+            int net_move = htons(position_to_index(position));
+            if (s->udp.active)
+                udp_send_move(&s->udp, net_move);
+            else
+                send(s->reader.socket, &net_move, sizeof(int), 0);
+            s->notice[0] = '\0';
+            session_text(s->status, "Mossa inviata.");
+            s->input = INPUT_NONE;
+        }
+    }
+    else if (s->input == INPUT_JOIN_REPLY)
+    {
+        int reply = (line[0] == 'y' || line[0] == 'Y') ? JOIN_ACCEPTED : JOIN_REJECTED;
+        send(s->reader.socket, &reply, sizeof(int), 0);
+        session_text(s->status, reply == JOIN_ACCEPTED ? "Avvio partita..." : "Aspettando richieste...");
+        s->input = INPUT_NONE;
+    }
+    else if (s->input == INPUT_ROOM)
+    {
+        int room_id;
+        if (sscanf(line, "%d", &room_id) == 1 && room_id >= 0)
+        {
+            s->result = room_id;
+            s->done = 1;
+            return;
+        }
+    }
+    render_session(s);
+}
+
+/* Si ricollega al server dopo un riavvio e chiede di riprendere la partita
+   o la stanza con l'ID e il codice di ripresa dati (restituisce il nuovo
+   socket, -1 se fallisce) */
+int reconnect(struct sockaddr_in *server, int id, int token, char *player_name)
+{
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS; attempt++)
+    {
+        int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(client_socket, (struct sockaddr *)server, sizeof(*server)) < 0)
+        {
+            close(client_socket);
+            sleep(1);
+            continue;
+        }
+
+        int flag = RESUME_REQUEST;
+        int net_id = htonl(id);
+        int net_token = htonl(token);
+        int name_len = strlen(player_name);
+        int net_name_len = htons(name_len);
+        send(client_socket, &flag, sizeof(int), 0);
+        send(client_socket, &net_id, sizeof(int), 0);
+        send(client_socket, &net_token, sizeof(int), 0);
+        send(client_socket, &net_name_len, sizeof(int), 0);
+        send(client_socket, player_name, name_len, 0);
+        return client_socket;
+    }
+    return -1;
+}
+
+/* Connessione persa: riprende la partita o la stanza, se ce n'è una (0 = ripresa) */
+int session_resume(session_t *s)
+{
+    int id = s->game_id >= 0 ? s->game_id : s->room_id;
+    int token = s->game_id >= 0 ? s->game_token : s->room_token;
+    if (s->tournament || s->lobby || id <= 0)
+        return -1;
+
+    session_text(s->notice, "Connessione persa, tentativo di ricollegamento...");
+    s->input = INPUT_NONE;
+    render_session(s);
+    int new_socket = reconnect(s->server, id, token, s->player_name);
+    if (new_socket < 0)
+    {
+        session_text(s->notice, "Impossibile ricollegarsi al server.");
+        return -1;
+    }
+    close(s->reader.socket);
+    reader_init(&s->reader, new_socket);
+    udp_reset(&s->udp); // La partita ripresa prosegue su TCP
+    session_text(s->notice, "Ricollegato al server.");
+    render_session(s);
+    return 0;
+}
+
+/* Gestisce una connessione al server finché la sessione non si conclude.
+   Restituisce la stanza scelta nella lobby (0 se nessuna, -1 se la
+   connessione è caduta); il socket finale resta in *client_socket. */
+int run_session(int *client_socket, struct sockaddr_in *server, char *player_name, int tournament)
+{
+    static session_t s;
+    memset(&s, 0, sizeof(s));
+    reader_init(&s.reader, *client_socket);
+    s.server = server;
+    s.player_name = player_name;
+    s.tournament = tournament;
+    s.game_id = -1;
+    s.udp.socket = -1;
+    screen_reset();
+    render_session(&s);
+
+    while (!s.done)
+    {
+        int timeout = udp_timers(&s.udp);
+        struct pollfd fds[3] = {{s.reader.socket, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}, {s.udp.socket, POLLIN, 0}};
+        if (poll(fds, 3, timeout) < 0)
+            continue;
+
+        if (fds[2].revents)
+        {
+            cursor_t message;
+            udp_receive(&s.udp);
+            while (!s.done && reader_next(&s.udp.reader, &message) > 0)
+                session_message(&s, &message);
         }
 
-        case WIN_FLAG:
-        case LOSE_FLAG:
-        case DRAW_FLAG:
+        if (fds[0].revents)
         {
-            if (recv(client_socket, grid, GRID_SIZE, 0) <= 0)
+            int n = reader_fill(&s.reader);
+            cursor_t message;
+            int found = 0;
+            while (!s.done && (found = reader_next(&s.reader, &message)) > 0)
             {
-                fprintf(stderr, "Errore ricezione griglia.\n");
-                return;
+                udp_check_fallback(&s.udp, &message);
+                session_message(&s, &message);
+            }
+            if (!s.done && (n <= 0 || found < 0))
+            {
+                if (session_resume(&s) == 0)
+                    continue;
+                if (!s.notice[0])
+                    session_text(s.notice, "Connessione con il server persa.");
+                s.result = -1;
+                s.done = 1;
+                render_session(&s);
             }
-            clear_screen();
-            const char *msg = (flag == WIN_FLAG) ? "=== VITTORIA! ===" : (flag == LOSE_FLAG) ? "=== SCONFITTA ==="
-                                                                                             : "=== PAREGGIO ===";
-            printf("%s\n", msg);
-
-            print_grid(grid);
-            printf("Premi un tasto per uscire...\n");
-            wait_for_keypress();
-            return;
         }
 
-        default:
-            fprintf(stderr, "Flag sconosciuto ricevuto dal server: %d\n", flag);
-            return;
+        if (!s.done && fds[1].revents)
+        {
+            char line[INPUT_SIZE];
+            int n = input_fill();
+            while (!s.done && input_line(line, sizeof(line)))
+                session_input(&s, line);
+            if (n <= 0)
+                s.done = 1;
         }
     }
+    screen_end();
+    udp_reset(&s.udp);
+    *client_socket = s.reader.socket;
+    return s.result;
 }
 
-
 /* Funzione principale del client */
 int main(int argc, char *argv[])
 {
-    setbuf(stdout, NULL);
     int client_socket;
     struct sockaddr_in server;
     //char server_ip[16] = "172.18.0.2"; //Per docker
     char server_ip[16] = "127.0.0.1"; //Per eseguire in locale
     int server_port = 8080;
     char player_name[50];
-    char opponent_name[50];
-    char player_symbol, opponent_symbol;
-    char grid[GRID_SIZE];
 
     // Configurazione iniziale
     if (argc > 1)
         strncpy(server_ip, argv[1], sizeof(server_ip) - 1);
     if (argc > 2)
         server_port = atoi(argv[2]);
+    const char *udp = getenv("TRIS_UDP");
+    int use_udp = udp && atoi(udp) > 0;
 
 
 
@@ -283,17 +1308,22 @@ int main(int argc, char *argv[])
     fgets(player_name, sizeof(player_name), stdin);
     player_name[strcspn(player_name, "\n")] = '\0';
 
+    int lobby_room = 0; // Stanza scelta dall'elenco delle stanze aperte
     while (1)
     {
-        show_menu();
-        int choice = get_menu_choice();
+        int choice = 3;
+        if (!lobby_room)
+        {
+            show_menu();
+            choice = get_menu_choice();
+        }
 
         client_socket = socket(AF_INET, SOCK_STREAM, 0);
         server.sin_family = AF_INET;
         server.sin_port = htons(server_port);
         server.sin_addr.s_addr = inet_addr(server_ip);
 
-        
+
 
         if (connect(client_socket, (struct sockaddr *)&server, sizeof(server)) < 0)
         {
@@ -314,18 +1344,37 @@ int main(int argc, char *argv[])
             flag = JOIN_PRIVATE;
             break;
         case 4:
+            flag = TOURNAMENT_JOIN;
+            break;
+        case 5:
+            flag = LEADERBOARD_REQUEST;
+            break;
+        case 6:
+            flag = LOBBY_SUBSCRIBE;
+            break;
+        case 7:
             printf("Arrivederci!\n");
             return 0;
         }
 
+        // Le partite casuali e private possono usare UDP (vedi TRASPORTO UDP)
+        if (use_udp && choice <= 3)
+        {
+            int request = UDP_REQUEST;
+            send(client_socket, &request, sizeof(int), 0);
+        }
         send(client_socket, &flag, sizeof(int), 0);
 
         if (choice == 3)
         {
-            int room_id;
-            printf("Inserisci ID stanza privata: ");
-            scanf("%d", &room_id);
-            getchar();
+            int room_id = lobby_room;
+            if (!room_id)
+            {
+                printf("Inserisci ID stanza privata: ");
+                scanf("%d", &room_id);
+                getchar();
+            }
+            lobby_room = 0;
             int net_room_id = htonl(room_id);
             send(client_socket, &net_room_id, sizeof(int), 0);
         }
@@ -335,59 +1384,24 @@ int main(int argc, char *argv[])
         send(client_socket, &net_name_len, sizeof(int), 0);
         send(client_socket, player_name, name_len, 0);
 
-        if (choice == 2)
-        {
-            int resp_flag, net_room_id;
-            recv(client_socket, &resp_flag, sizeof(int), 0);
-            recv(client_socket, &net_room_id, sizeof(int), 0);
-            int room_id = ntohl(net_room_id);
-            printf("Stanza privata creata. ID: %d\nAspettando richieste...\n", room_id);
-
-            while (1)
-            {
-                recv(client_socket, &resp_flag, sizeof(int), 0);
-                if (resp_flag == JOIN_REQUEST)
-                {
-                    int len;
-                    recv(client_socket, &len, sizeof(int), 0);
-                    len = ntohs(len);
-                    char joiner_name[50];
-                    recv(client_socket, joiner_name, len, 0);
-                    joiner_name[len] = '\0';
-                    printf("%s vuole unirsi. Accetti? (y/n): ", joiner_name);
-                    char ch = getchar();
-                    getchar();
-                    int reply = (ch == 'y' || ch == 'Y') ? JOIN_ACCEPTED : JOIN_REJECTED;
-                    send(client_socket, &reply, sizeof(int), 0);
-                    if (reply == JOIN_ACCEPTED)
-                    {
-                        handle_game(client_socket, player_name, joiner_name, &player_symbol, &opponent_symbol, grid);
-                        break;
-                    }
-                }
-            }
-        }
-        else if (choice == 3)
+        if (choice == 5)
         {
-            int response;
-            recv(client_socket, &response, sizeof(int), 0);
-            if (response == JOIN_ACCEPTED)
-            {
-                printf("Richiesta accettata! Avvio partita...\n");
-                handle_game(client_socket, player_name, opponent_name, &player_symbol, &opponent_symbol, grid);
-            }
-            else
-            {
-                printf("Richiesta rifiutata o stanza non trovata.\n");
-            }
+            int rows = htonl(LEADERBOARD_ROWS);
+            send(client_socket, &rows, sizeof(int), 0);
         }
-        else
+
+        int room_id = run_session(&client_socket, &server, player_name, choice == 4);
+        close(client_socket);
+
+        // Con una stanza scelta nella lobby si torna subito in cima per unirsi
+        if (choice == 6 && room_id >= 0)
         {
-            handle_game(client_socket, player_name, opponent_name, &player_symbol, &opponent_symbol, grid);
+            lobby_room = room_id;
+            continue;
         }
 
-        close(client_socket);
-        printf("\nPremi un tasto per continuare...");
+        printf("Premi un tasto per continuare...");
+        fflush(stdout);
         wait_for_keypress();
     }
 }
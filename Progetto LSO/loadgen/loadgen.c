@@ -0,0 +1,473 @@
+// Generatore di carico senza interfaccia per il server del tris.
+//
+// Avvia un numero pari di giocatori simulati, ciascuno su un proprio
+// thread: ogni giocatore si connette in modalità partita casuale, gioca
+// mosse casuali fino alla fine della partita e ricomincia. Il server abbina
+// le connessioni in ordine di arrivo, quindi il totale delle connessioni
+// (due per partita) è prenotato da un contatore comune: con quote per
+// giocatore l'ultimo rimasto resterebbe in attesa di un avversario.
+// Alla fine stampa le partite al secondo, usate dal Makefile per misurare
+// i guadagni di PGO e LTO.
+//
+// Con -u i giocatori chiedono il trasporto UDP (vedi TRASPORTO UDP in
+// server.c): con TRIS_UDP_LOSS impostato sul server misura il costo delle
+// ritrasmissioni.
+//
+// Con -d i giocatori attendono i millisecondi indicati prima di ogni mossa,
+// così le partite restano in corso abbastanza a lungo da attraversare un
+// aggiornamento a caldo (vedi scripts/upgrade_test.sh).
+//
+// Compilazione: gcc -O2 loadgen.c -o loadgen -lpthread
+// Uso: ./loadgen [-h host] [-p porta] [-g partite] [-c giocatori] [-d ms] [-u]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define GRID_SIZE 9           // Celle della griglia
+#define MAX_PLAYERS 1024      // Giocatori simulati al massimo
+#define CONNECT_RETRIES 50    // Tentativi di connessione (uno ogni 100 ms)
+
+// Flag del protocollo (vedi server.c)
+#define NO_FLAG 0
+#define WAIT_FLAG 0
+#define START_FLAG 1
+#define OPPONENT_MOVE_FLAG 2
+#define YOUR_MOVE_FLAG 3
+#define WIN_FLAG 4
+#define LOSE_FLAG 5
+#define DRAW_FLAG 6
+#define UDP_REQUEST 34
+#define UDP_TOKEN 35
+
+// Trasporto UDP
+#define UDP_HEADER 17         // Tipo (1 byte), token (8), seq (4), ack (4)
+#define UDP_HELLO 1
+#define UDP_DATA 2
+#define UDP_ACK 3
+#define UDP_RESYNC 4
+#define UDP_HELLO_TRIES 10    // UDP_HELLO senza risposta prima di restare su TCP
+#define UDP_RTO_MS 200        // Timeout di ritrasmissione delle mosse
+#define UDP_RTO_MAX_MS 2000
+
+// Parametri del carico
+typedef struct loadgen_config_t {
+    struct sockaddr_in server;  // Indirizzo del server
+    int connections;            // Connessioni totali (due per partita)
+    int players;                // Giocatori simulati (pari)
+    int udp;                    // 1 se le partite usano UDP
+    int move_delay_ms;          // Attesa prima di ogni mossa
+} loadgen_config_t;
+
+loadgen_config_t config;
+int reserved = 0;         // Connessioni già prenotate
+int finished_games = 0;   // Partite concluse (contate da entrambi i giocatori)
+int failed_games = 0;     // Partite interrotte da un errore
+int retransmissions = 0;  // Mosse ritrasmesse su UDP
+
+// Riceve esattamente len byte (0 = ok, -1 = errore)
+int recv_all(int socket, void *buf, size_t len) {
+    return recv(socket, buf, len, MSG_WAITALL) == (ssize_t)len ? 0 : -1;
+}
+
+// Connette un giocatore al server, riprovando finché il server non è pronto.
+// Con il server in locale ogni giocatore usa un proprio indirizzo sorgente
+// 127.x.y.z: decine di migliaia di connessioni brevi dallo stesso indirizzo
+// riusano quadruple ancora in TIME_WAIT e alcune SYN vengono ritrasmesse
+// dopo 1 s o più, lasciando in attesa anche l'avversario.
+int connect_player(int id) {
+    for (int attempt = 0; attempt < CONNECT_RETRIES; ++attempt) {
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        if ((ntohl(config.server.sin_addr.s_addr) >> 24) == 127) {
+            struct sockaddr_in local = {0};
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(0x7f010000 + id + 1);
+            int on = 1;
+            setsockopt(s, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+            bind(s, (struct sockaddr *)&local, sizeof(local));
+        }
+        if (connect(s, (struct sockaddr *)&config.server, sizeof(config.server)) == 0) {
+            return s;
+        }
+        close(s);
+        usleep(100000);
+    }
+    return -1;
+}
+
+// Attesa prima di una mossa (-d)
+void move_delay(void) {
+    if (config.move_delay_ms > 0) {
+        usleep(config.move_delay_ms * 1000);
+    }
+}
+
+// Gioca una partita con mosse casuali (0 = conclusa, -1 = errore)
+int play_game(int id, unsigned *seed) {
+    int s = connect_player(id);
+    if (s < 0) {
+        return -1;
+    }
+
+    char name[32];
+    int name_len = snprintf(name, sizeof(name), "load%d", id);
+    int flag = NO_FLAG;
+    int net_name_len = htons(name_len);
+    send(s, &flag, sizeof(int), 0);
+    send(s, &net_name_len, sizeof(int), 0);
+    send(s, name, name_len, 0);
+
+    char grid[GRID_SIZE];
+    int result = -1;
+    while (result < 0) {
+        if (recv_all(s, &flag, sizeof(int)) < 0) {
+            break;
+        }
+        if (flag == WAIT_FLAG) {
+            continue;
+        }
+        if (flag == START_FLAG) {
+            int game_id, opponent_len, token;
+            char opponent[64], symbol;
+            if (recv_all(s, &game_id, sizeof(int)) < 0 || recv_all(s, &opponent_len, sizeof(int)) < 0) {
+                break;
+            }
+            opponent_len = ntohs(opponent_len);
+            if (opponent_len < 0 || opponent_len > (int)sizeof(opponent) ||
+                recv_all(s, opponent, opponent_len) < 0 || recv_all(s, &symbol, 1) < 0 ||
+                recv_all(s, &token, sizeof(int)) < 0) {
+                break;
+            }
+            continue;
+        }
+        if (recv_all(s, grid, GRID_SIZE) < 0) {
+            break;
+        }
+        if (flag == YOUR_MOVE_FLAG) {
+            int free_cells[GRID_SIZE], n_free = 0;
+            for (int i = 0; i < GRID_SIZE; ++i) {
+                if (grid[i] == ' ') {
+                    free_cells[n_free++] = i;
+                }
+            }
+            int move = htons(free_cells[rand_r(seed) % n_free]);
+            move_delay();
+            send(s, &move, sizeof(int), 0);
+        } else if (flag == WIN_FLAG || flag == LOSE_FLAG || flag == DRAW_FLAG) {
+            result = 0;
+        } else if (flag != OPPONENT_MOVE_FLAG) {
+            break;
+        }
+    }
+    close(s);
+    return result;
+}
+
+// Lunghezza del messaggio all'inizio di data (0 = incompleto, -1 = non valido)
+int message_length(const char *data, size_t len) {
+    int flag, name_len;
+    if (len < sizeof(int)) {
+        return 0;
+    }
+    memcpy(&flag, data, sizeof(int));
+    if (flag == WAIT_FLAG) {
+        return sizeof(int);
+    }
+    if (flag == START_FLAG) {
+        if (len < 3 * sizeof(int)) {
+            return 0;
+        }
+        memcpy(&name_len, data + 2 * sizeof(int), sizeof(int));
+        name_len = ntohs(name_len);
+        if (name_len < 0 || name_len > 64) {
+            return -1;
+        }
+        return len < 4 * sizeof(int) + name_len + 1 ? 0 : (int)(4 * sizeof(int)) + name_len + 1;
+    }
+    if (flag >= OPPONENT_MOVE_FLAG && flag <= DRAW_FLAG) {
+        return len < sizeof(int) + GRID_SIZE ? 0 : (int)sizeof(int) + GRID_SIZE;
+    }
+    return -1;
+}
+
+// Partita su UDP: stato del canale
+typedef struct udp_game_t {
+    int tcp, udp;          // Connessione di controllo e socket UDP
+    int on_udp;            // 0 dopo il ritorno del server a TCP
+    char token[8];
+    int heard;             // 1 dopo il primo datagramma del server
+    int hello_tries;
+    uint32_t expected;     // Prossimo messaggio atteso dal server
+    uint32_t next_seq;
+    int pending;           // 1 se una mossa attende conferma
+    int move;
+    uint32_t move_seq;
+    long long sent_at;     // Ultimo invio (HELLO o mossa) in ms
+    int rto;               // Timeout di ritrasmissione in ms
+    char data[2][512];     // Messaggi non ancora gestiti (0 = da TCP, 1 = da UDP)
+    size_t len[2];
+} udp_game_t;
+
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Invia un datagramma con ack = prossimo messaggio atteso
+void udp_send(udp_game_t *g, int type, uint32_t seq, const void *data, size_t len) {
+    char datagram[UDP_HEADER + sizeof(int)];
+    uint32_t net_seq = htonl(seq), net_ack = htonl(g->expected);
+    datagram[0] = (char)type;
+    memcpy(datagram + 1, g->token, sizeof(g->token));
+    memcpy(datagram + 9, &net_seq, sizeof(net_seq));
+    memcpy(datagram + 13, &net_ack, sizeof(net_ack));
+    if (len > 0) {
+        memcpy(datagram + UDP_HEADER, data, len);
+    }
+    send(g->udp, datagram, UDP_HEADER + len, 0);
+}
+
+// Il server è tornato a TCP: da qui in poi si usa solo TCP
+void udp_game_fallback(udp_game_t *g) {
+    g->on_udp = 0;
+    close(g->udp);
+    g->udp = -1;
+    g->len[1] = 0;
+}
+
+// Gestisce i messaggi completi ricevuti da TCP (from = 0) o da UDP (from = 1)
+// (1 = partita finita, 0 = in corso, -1 = errore)
+int udp_game_messages(udp_game_t *g, int from, unsigned *seed) {
+    int result = 0, n;
+    size_t done = 0;
+    while (result == 0 && (n = message_length(g->data[from] + done, g->len[from] - done)) > 0) {
+        const char *msg = g->data[from] + done;
+        int flag;
+        memcpy(&flag, msg, sizeof(int));
+        done += n;
+        // Un messaggio di gioco su TCP: il server ha smesso di usare UDP
+        if (from == 0 && g->on_udp && flag != WAIT_FLAG) {
+            udp_game_fallback(g);
+        }
+        if (flag == YOUR_MOVE_FLAG) {
+            const char *grid = msg + sizeof(int);
+            int free_cells[GRID_SIZE], n_free = 0;
+            for (int i = 0; i < GRID_SIZE; ++i) {
+                if (grid[i] == ' ') {
+                    free_cells[n_free++] = i;
+                }
+            }
+            int move = htons(free_cells[rand_r(seed) % n_free]);
+            move_delay();
+            if (g->on_udp) {
+                g->move = move;
+                g->move_seq = g->next_seq++;
+                g->pending = 1;
+                g->sent_at = now_ms();
+                udp_send(g, UDP_DATA, g->move_seq, &g->move, sizeof(int));
+            } else {
+                send(g->tcp, &move, sizeof(int), 0);
+            }
+        } else if (flag == WIN_FLAG || flag == LOSE_FLAG || flag == DRAW_FLAG) {
+            result = 1;
+        }
+    }
+    memmove(g->data[from], g->data[from] + done, g->len[from] - done);
+    g->len[from] -= done;
+    return n < 0 ? -1 : result;
+}
+
+// Legge i datagrammi del server e li conferma
+int udp_game_receive(udp_game_t *g, unsigned *seed) {
+    char datagram[UDP_HEADER + 128];
+    ssize_t n;
+    while ((n = recv(g->udp, datagram, sizeof(datagram), MSG_DONTWAIT)) >= UDP_HEADER) {
+        if (memcmp(datagram + 1, g->token, sizeof(g->token)) != 0) {
+            continue;
+        }
+        uint32_t seq, ack;
+        memcpy(&seq, datagram + 9, sizeof(seq));
+        memcpy(&ack, datagram + 13, sizeof(ack));
+        seq = ntohl(seq);
+        ack = ntohl(ack);
+        g->heard = 1;
+        if (g->pending && (int32_t)(ack - g->move_seq) > 0) {
+            g->pending = 0;
+            g->rto = UDP_RTO_MS;
+        }
+        // UDP_RESYNC inizia con il numero dell'ultimo datagramma con lo stato:
+        // se è già arrivato lo stato non va gestito di nuovo
+        int type = datagram[0];
+        size_t skip = UDP_HEADER;
+        uint32_t covered = g->expected;
+        if (type == UDP_RESYNC && n >= UDP_HEADER + 4) {
+            memcpy(&covered, datagram + UDP_HEADER, sizeof(covered));
+            covered = ntohl(covered);
+            skip += 4;
+        }
+        if ((type == UDP_DATA && seq == g->expected) ||
+            (type == UDP_RESYNC && skip > UDP_HEADER && (int32_t)(seq - g->expected) >= 0)) {
+            if ((int32_t)(g->expected - covered) <= 0 && g->len[1] + n - skip <= sizeof(g->data[1])) {
+                memcpy(g->data[1] + g->len[1], datagram + skip, n - skip);
+                g->len[1] += n - skip;
+            }
+            g->expected = seq + 1;
+        }
+        if (type == UDP_DATA || type == UDP_RESYNC) {
+            udp_send(g, UDP_ACK, 0, NULL, 0);
+        }
+    }
+    return udp_game_messages(g, 1, seed);
+}
+
+// Gioca una partita su UDP con mosse casuali (0 = conclusa, -1 = errore)
+int play_game_udp(int id, unsigned *seed) {
+    udp_game_t g = {0};
+    g.tcp = connect_player(id);
+    if (g.tcp < 0) {
+        return -1;
+    }
+
+    char name[32];
+    int name_len = snprintf(name, sizeof(name), "load%d", id);
+    int flags[2] = {UDP_REQUEST, NO_FLAG};
+    int net_name_len = htons(name_len);
+    send(g.tcp, flags, sizeof(flags), 0);
+    send(g.tcp, &net_name_len, sizeof(int), 0);
+    send(g.tcp, name, name_len, 0);
+
+    // Il token arriva subito, prima di qualsiasi altro messaggio
+    int flag;
+    if (recv_all(g.tcp, &flag, sizeof(int)) < 0 || flag != UDP_TOKEN ||
+        recv_all(g.tcp, g.token, sizeof(g.token)) < 0) {
+        close(g.tcp);
+        return -1;
+    }
+    g.udp = socket(AF_INET, SOCK_DGRAM, 0);
+    connect(g.udp, (struct sockaddr *)&config.server, sizeof(config.server));
+    g.on_udp = 1;
+    g.expected = g.next_seq = 1;
+    g.rto = UDP_RTO_MS;
+    udp_send(&g, UDP_HELLO, 0, NULL, 0);
+    g.hello_tries = 1;
+    g.sent_at = now_ms();
+
+    int result = 0;
+    while (result == 0) {
+        int timeout = -1;
+        if (g.on_udp && (!g.heard || g.pending)) {
+            long long left = g.sent_at + g.rto - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        struct pollfd fds[2] = {{g.tcp, POLLIN, 0}, {g.udp, POLLIN, 0}};
+        if (poll(fds, 2, timeout) < 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            result = udp_game_receive(&g, seed);
+        }
+        if (result == 0 && fds[0].revents) {
+            ssize_t n = recv(g.tcp, g.data[0] + g.len[0], sizeof(g.data[0]) - g.len[0], 0);
+            if (n <= 0) {
+                result = -1;
+                break;
+            }
+            g.len[0] += n;
+            result = udp_game_messages(&g, 0, seed);
+        }
+        if (result == 0 && g.on_udp && (!g.heard || g.pending) && now_ms() - g.sent_at >= g.rto) {
+            if (!g.heard && g.hello_tries++ == UDP_HELLO_TRIES) {
+                udp_game_fallback(&g); // UDP bloccato: si attende il ritorno a TCP
+                continue;
+            }
+            if (g.heard) {
+                udp_send(&g, UDP_DATA, g.move_seq, &g.move, sizeof(int));
+                __atomic_add_fetch(&retransmissions, 1, __ATOMIC_RELAXED);
+            } else {
+                udp_send(&g, UDP_HELLO, 0, NULL, 0);
+            }
+            g.sent_at = now_ms();
+            g.rto = 2 * g.rto > UDP_RTO_MAX_MS ? UDP_RTO_MAX_MS : 2 * g.rto;
+        }
+    }
+    if (g.udp >= 0) {
+        close(g.udp);
+    }
+    close(g.tcp);
+    return result > 0 ? 0 : -1;
+}
+
+// Thread di un giocatore simulato
+void *player_main(void *arg) {
+    int id = (int)(intptr_t)arg;
+    unsigned seed = (unsigned)time(NULL) ^ (unsigned)(id * 2654435761u);
+    while (__atomic_fetch_add(&reserved, 1, __ATOMIC_RELAXED) < config.connections) {
+        if ((config.udp ? play_game_udp(id, &seed) : play_game(id, &seed)) == 0) {
+            __atomic_add_fetch(&finished_games, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&failed_games, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = "127.0.0.1";
+    int port = 8080;
+    int games = 2000;
+    config.players = 16;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:g:c:d:u")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'g': games = atoi(optarg); break;
+        case 'c': config.players = atoi(optarg); break;
+        case 'd': config.move_delay_ms = atoi(optarg); break;
+        case 'u': config.udp = 1; break;
+        default:
+            fprintf(stderr, "Uso: %s [-h host] [-p porta] [-g partite] [-c giocatori] [-d ms] [-u]\n", argv[0]);
+            return 1;
+        }
+    }
+    // Ogni connessione deve trovare un avversario: servono giocatori in numero pari
+    if (config.players < 2 || config.players > MAX_PLAYERS || config.players % 2 != 0 || games <= 0) {
+        fprintf(stderr, "Servono da 2 a %d giocatori (in numero pari) e almeno una partita\n", MAX_PLAYERS);
+        return 1;
+    }
+    config.connections = 2 * games;
+    config.server.sin_family = AF_INET;
+    config.server.sin_port = htons(port);
+    config.server.sin_addr.s_addr = inet_addr(host);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t threads[MAX_PLAYERS];
+    for (int i = 0; i < config.players; ++i) {
+        pthread_create(&threads[i], NULL, player_main, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < config.players; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    int played = finished_games / 2;
+    printf("Partite: %d (%d interrotte) in %.2f s con %d giocatori\n",
+           played, failed_games, seconds, config.players);
+    if (config.udp) {
+        printf("Mosse ritrasmesse su UDP: %d\n", retransmissions);
+    }
+    printf("games_per_sec=%.1f\n", played / seconds);
+    return failed_games > 0;
+}
@@ -0,0 +1,365 @@
+// Riproduce su un server locale il traffico catturato con TRIS_CAPTURE.
+//
+// Ogni connessione registrata viene riaperta e riceve gli stessi byte con
+// gli stessi intervalli, accelerati di un fattore a scelta (-s 1, -s 10) o
+// alla massima velocità (-s max). Le risposte del server vengono lette e
+// scartate: servono solo a non bloccarlo. Gli ID delle stanze private sono
+// casuali, quindi le richieste JOIN_PRIVATE vengono tradotte nell'ID che il
+// nuovo server ha assegnato alla stanza corrispondente.
+//
+// Il formato del file è descritto in server.c (CATTURA DEL TRAFFICO).
+//
+// Compilazione: gcc -O2 replay.c -o replay
+// Uso: ./replay [-h host] [-p porta] [-s velocità|max] cattura.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define CAPTURE_MAGIC "TRISCAP1"
+#define MAX_EVENTS 64
+#define ROOM_WAIT_MS 5000   // Attesa massima dell'ID di una stanza prima di una JOIN_PRIVATE
+#define DRAIN_MS 2000       // Attesa delle ultime risposte del server
+
+// Tipi di record (vedi server.c)
+#define CAPTURE_OPEN 1
+#define CAPTURE_DATA 2
+#define CAPTURE_CLOSE 3
+#define CAPTURE_ROOM 4
+
+// Flag del protocollo usati per tradurre gli ID delle stanze
+#define PRIVATE_CREATED 11
+#define JOIN_PRIVATE 12
+
+// Connessione riprodotta
+typedef struct conn_t {
+    int socket;         // -1 se chiusa o mai aperta
+    size_t sent;        // Byte inviati (posizione nel flusso registrato)
+    char head[8];       // Flag iniziale e ID della stanza inviati dal client
+    size_t received;    // Byte ricevuti dal server
+    char reply[8];      // Inizio della risposta (PRIVATE_CREATED e ID)
+    int captured_room;  // ID della stanza nella cattura (0 se nessuna)
+} conn_t;
+
+// Stanza creata: ID nella cattura e ID assegnato dal nuovo server
+typedef struct room_map_t {
+    int captured;
+    int replayed;
+} room_map_t;
+
+struct sockaddr_in server;
+int epoll_fd;
+conn_t *conns = NULL;
+int n_conns = 0;
+room_map_t *rooms = NULL;
+int n_rooms = 0;
+int open_conns = 0;
+
+// Statistiche
+long stat_conns = 0, stat_records = 0, stat_failed = 0;
+uint64_t stat_bytes = 0, stat_max_late = 0;
+
+uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Legge un intero codificato 7 bit per byte (-1 se il file è troncato)
+int read_varint(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Connessione con l'ID indicato (creata se necessario)
+conn_t *get_conn(uint64_t id) {
+    if (id >= (uint64_t)n_conns) {
+        int n = n_conns ? n_conns : 256;
+        while ((uint64_t)n <= id) {
+            n *= 2;
+        }
+        conns = realloc(conns, n * sizeof(conn_t));
+        for (int i = n_conns; i < n; ++i) {
+            memset(&conns[i], 0, sizeof(conn_t));
+            conns[i].socket = -1;
+        }
+        n_conns = n;
+    }
+    return &conns[id];
+}
+
+void close_conn(conn_t *c) {
+    if (c->socket >= 0) {
+        close(c->socket);
+        c->socket = -1;
+        open_conns--;
+    }
+}
+
+// Registra la corrispondenza tra gli ID della stanza se entrambi sono noti
+void map_room(conn_t *c) {
+    int flag;
+    memcpy(&flag, c->reply, sizeof(int));
+    if (!c->captured_room || c->received < sizeof(c->reply) || flag != PRIVATE_CREATED) {
+        return;
+    }
+    int net_id;
+    memcpy(&net_id, c->reply + sizeof(int), sizeof(int));
+    rooms = realloc(rooms, (n_rooms + 1) * sizeof(room_map_t));
+    rooms[n_rooms].captured = c->captured_room;
+    rooms[n_rooms].replayed = ntohl(net_id);
+    n_rooms++;
+    c->captured_room = 0;
+}
+
+// ID assegnato dal nuovo server alla stanza (0 se non ancora noto)
+int find_room(int captured) {
+    for (int i = n_rooms - 1; i >= 0; --i) {
+        if (rooms[i].captured == captured) {
+            return rooms[i].replayed;
+        }
+    }
+    return 0;
+}
+
+// Legge e scarta le risposte del server per al massimo timeout_ms
+void service_input(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < n; ++i) {
+        conn_t *c = &conns[events[i].data.u32];
+        char buf[4096];
+        ssize_t got = recv(c->socket, buf, sizeof(buf), MSG_DONTWAIT);
+        if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        }
+        if (got <= 0) {
+            close_conn(c);
+            continue;
+        }
+        if (c->received < sizeof(c->reply)) {
+            size_t n_head = sizeof(c->reply) - c->received;
+            memcpy(c->reply + c->received, buf, (size_t)got < n_head ? (size_t)got : n_head);
+        }
+        c->received += got;
+        map_room(c);
+    }
+}
+
+// Attende fino all'istante indicato servendo le risposte del server
+void wait_until(uint64_t target) {
+    uint64_t now;
+    while ((now = now_us()) < target) {
+        uint64_t left_ms = (target - now + 999) / 1000;
+        service_input(left_ms > 1000 ? 1000 : (int)left_ms);
+    }
+    service_input(0);
+}
+
+int send_all(int socket, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t sent = send(socket, p, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+void open_conn(conn_t *c, uint32_t id) {
+    memset(c, 0, sizeof(conn_t));
+    c->socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(c->socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        perror("connect");
+        close(c->socket);
+        c->socket = -1;
+        stat_failed++;
+        return;
+    }
+    int nodelay = 1;
+    setsockopt(c->socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u32 = id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->socket, &ev);
+    open_conns++;
+    stat_conns++;
+}
+
+// 1 se la connessione ha chiesto di unirsi a una stanza privata
+int is_join(const conn_t *c) {
+    int flag;
+    memcpy(&flag, c->head, sizeof(int));
+    return c->sent >= sizeof(int) && flag == JOIN_PRIVATE;
+}
+
+// Sostituisce l'ID della stanza nell'intestazione di una JOIN_PRIVATE
+void translate_room(conn_t *c) {
+    int net_id;
+    memcpy(&net_id, c->head + sizeof(int), sizeof(int));
+    int captured = ntohl(net_id), replayed = find_room(captured);
+    uint64_t deadline = now_us() + ROOM_WAIT_MS * 1000ULL;
+    while (!replayed && now_us() < deadline) {
+        service_input(10);
+        replayed = find_room(captured);
+    }
+    if (!replayed) {
+        fprintf(stderr, "Stanza %d non trovata nel replay, ID inviato invariato\n", captured);
+        replayed = captured;
+    }
+    net_id = htonl(replayed);
+    memcpy(c->head + sizeof(int), &net_id, sizeof(int));
+}
+
+// Invia i byte di un record. Il flag iniziale viene raccolto prima di
+// inviarlo; per una JOIN_PRIVATE anche l'ID della stanza, che parte
+// tradotto quando il nuovo server ha creato la stanza corrispondente.
+void send_data(conn_t *c, const uint8_t *data, size_t len) {
+    while (len > 0 && c->sent < sizeof(c->head) && (c->sent < sizeof(int) || is_join(c))) {
+        c->head[c->sent++] = *data++;
+        len--;
+        size_t ready = 0;
+        if (c->sent == sizeof(int) && !is_join(c)) {
+            ready = sizeof(int);
+        } else if (c->sent == sizeof(c->head)) {
+            translate_room(c);
+            ready = sizeof(c->head);
+        }
+        if (ready && send_all(c->socket, c->head, ready) < 0) {
+            close_conn(c);
+            return;
+        }
+    }
+    if (len > 0 && send_all(c->socket, data, len) < 0) {
+        close_conn(c);
+        return;
+    }
+    c->sent += len;
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = "127.0.0.1";
+    int port = 8080;
+    double speed = 1; // 0 = massima velocità
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': speed = strcmp(optarg, "max") == 0 ? 0 : atof(optarg); break;
+        default:
+            fprintf(stderr, "Uso: %s [-h host] [-p porta] [-s velocità|max] cattura.bin\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || speed < 0) {
+        fprintf(stderr, "Uso: %s [-h host] [-p porta] [-s velocità|max] cattura.bin\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (!file) {
+        perror("fopen");
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *capture = malloc(size > 0 ? size : 1);
+    if (size < (long)strlen(CAPTURE_MAGIC) || fread(capture, 1, size, file) != (size_t)size ||
+        memcmp(capture, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0) {
+        fprintf(stderr, "%s non è un file di cattura\n", argv[optind]);
+        return 1;
+    }
+    fclose(file);
+
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(host);
+    epoll_fd = epoll_create1(0);
+
+    const uint8_t *p = capture + strlen(CAPTURE_MAGIC), *end = capture + size;
+    uint64_t start = now_us(), elapsed = 0;
+    while (p < end) {
+        int type = *p++;
+        uint64_t delta, id, value = 0;
+        if (read_varint(&p, end, &delta) < 0 || read_varint(&p, end, &id) < 0 || id > INT32_MAX ||
+            ((type == CAPTURE_DATA || type == CAPTURE_ROOM) && read_varint(&p, end, &value) < 0) ||
+            (type == CAPTURE_DATA && value > (uint64_t)(end - p))) {
+            fprintf(stderr, "Cattura troncata dopo %ld record\n", stat_records);
+            break;
+        }
+        elapsed += delta;
+        if (speed > 0) {
+            uint64_t target = start + (uint64_t)(elapsed / speed);
+            wait_until(target);
+            uint64_t late = now_us() - target;
+            stat_max_late = late > stat_max_late ? late : stat_max_late;
+        }
+
+        conn_t *c = get_conn(id);
+        if (type == CAPTURE_OPEN) {
+            close_conn(c);
+            open_conn(c, (uint32_t)id);
+        } else if (type == CAPTURE_DATA) {
+            if (c->socket >= 0) {
+                send_data(c, p, value);
+                stat_bytes += value;
+            }
+            p += value;
+        } else if (type == CAPTURE_CLOSE) {
+            close_conn(c);
+        } else if (type == CAPTURE_ROOM) {
+            c->captured_room = (int)value;
+            map_room(c);
+        } else {
+            fprintf(stderr, "Record di tipo %d sconosciuto\n", type);
+            break;
+        }
+        stat_records++;
+    }
+
+    // Lascia al server il tempo di rispondere agli ultimi messaggi
+    uint64_t replay_end = now_us();
+    while (open_conns > 0 && now_us() - replay_end < DRAIN_MS * 1000ULL) {
+        service_input(100);
+    }
+    for (int i = 0; i < n_conns; ++i) {
+        close_conn(&conns[i]);
+    }
+
+    double seconds = (replay_end - start) / 1e6;
+    printf("Replay: %ld record, %ld connessioni (%ld fallite), %llu byte in %.2f s",
+           stat_records, stat_conns, stat_failed, (unsigned long long)stat_bytes, seconds);
+    if (speed > 0) {
+        printf(" (velocità %gx, ritardo massimo %.2f ms)\n", speed, stat_max_late / 1000.0);
+    } else {
+        printf(" (massima velocità)\n");
+    }
+    printf("Durata originale: %.2f s\n", elapsed / 1e6);
+    free(capture);
+    return stat_failed > 0;
+}
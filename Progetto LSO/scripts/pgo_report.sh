@@ -0,0 +1,32 @@
+#!/bin/sh
+# Confronta le partite/s di più build del server con lo stesso carico.
+# Ogni build gioca runs volte e si tiene il risultato migliore, per
+# ridurre il rumore; i guadagni sono relativi alla prima build.
+#
+# Uso: scripts/pgo_report.sh <loadgen> <partite> <giocatori> <runs> nome=server...
+
+loadgen=$1
+games=$2
+players=$3
+runs=$4
+shift 4
+
+dir=$(dirname "$0")
+baseline=""
+printf '\n%-10s %14s %10s\n' "build" "partite/s" "guadagno"
+for build in "$@"; do
+    name=${build%%=*}
+    server=${build#*=}
+    best=0
+    i=0
+    while [ $i -lt "$runs" ]; do
+        rate=$("$dir/workload.sh" "$server" "$loadgen" "$games" "$players" | sed -n 's/^games_per_sec=//p')
+        best=$(awk -v a="$best" -v b="${rate:-0}" 'BEGIN { print (b > a ? b : a) }')
+        i=$((i + 1))
+    done
+    if [ -z "$baseline" ]; then
+        baseline=$best
+    fi
+    gain=$(awk -v a="$best" -v b="$baseline" 'BEGIN { printf "%+.1f%%", (b > 0 ? (a / b - 1) * 100 : 0) }')
+    printf '%-10s %14.1f %10s\n' "$name" "$best" "$gain"
+done
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Prova dell'aggiornamento a caldo con partite UDP in corso: avvia il server
+# indicato su una porta dedicata, gli fa giocare partite lente su UDP con il
+# generatore di carico e a metà lo sostituisce con "server --takeover".
+# Riesce se tutte le partite si concludono e il nuovo processo ne ha
+# ripristinata almeno una. Archivio, statistiche, socket di aggiornamento e
+# log finiscono in una cartella temporanea.
+#
+# Uso: scripts/upgrade_test.sh <server> <loadgen> [partite] [giocatori]
+
+server=$1
+loadgen=$2
+games=${3:-64}
+players=${4:-16}
+port=${TRIS_PORT:-18081}
+
+if [ ! -x "$server" ] || [ ! -x "$loadgen" ]; then
+    echo "Uso: $0 <server> <loadgen> [partite] [giocatori]" >&2
+    exit 1
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export TRIS_PORT=$port TRIS_ARENA=$dir/arena.bin TRIS_STATS=$dir/stats.bin \
+       TRIS_UPGRADE_SOCKET=$dir/upgrade.sock
+
+"$server" > "$dir/old.log" &
+
+# Con 50 ms per mossa una partita dura circa mezzo secondo
+"$loadgen" -p "$port" -g "$games" -c "$players" -d 50 -u > "$dir/loadgen.log" &
+loadgen_pid=$!
+
+sleep 1
+"$server" --takeover > "$dir/new.log" &
+pid=$!
+
+wait "$loadgen_pid"
+status=$?
+
+kill -TERM "$pid" 2> /dev/null
+wait "$pid"
+
+cat "$dir/loadgen.log"
+grep "^\[UPGRADE\]" "$dir/new.log"
+if [ $status -ne 0 ]; then
+    echo "Partite interrotte durante l'aggiornamento" >&2
+    exit 1
+fi
+if ! grep -q "^\[UPGRADE\] Subentro completato" "$dir/new.log"; then
+    echo "Subentro non riuscito" >&2
+    exit 1
+fi
+if ! grep -q "stanze, [1-9][0-9]* partite" "$dir/new.log"; then
+    echo "Nessuna partita in corso al momento del subentro" >&2
+    exit 1
+fi
+echo "Aggiornamento a caldo riuscito"
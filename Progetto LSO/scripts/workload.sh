@@ -0,0 +1,36 @@
+#!/bin/sh
+# Carico di partite senza interfaccia: avvia il server indicato su una porta
+# dedicata, gli fa giocare le partite con il generatore di carico e lo arresta
+# con SIGTERM (così un server instrumentato per PGO scrive i profili).
+# Archivio, statistiche e socket di aggiornamento finiscono in una cartella
+# temporanea. Stampa la riga games_per_sec del generatore.
+#
+# Uso: scripts/workload.sh <server> <loadgen> [partite] [giocatori]
+
+server=$1
+loadgen=$2
+games=${3:-10000}
+players=${4:-32}
+port=${TRIS_PORT:-18080}
+
+if [ ! -x "$server" ] || [ ! -x "$loadgen" ]; then
+    echo "Uso: $0 <server> <loadgen> [partite] [giocatori]" >&2
+    exit 1
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+TRIS_PORT=$port TRIS_ARENA=$dir/arena.bin TRIS_STATS=$dir/stats.bin \
+TRIS_UPGRADE_SOCKET=$dir/upgrade.sock "$server" > /dev/null &
+pid=$!
+
+# Il generatore riprova la connessione finché il server non è in ascolto
+result=$("$loadgen" -p "$port" -g "$games" -c "$players")
+status=$?
+
+kill -TERM "$pid" 2> /dev/null
+wait "$pid"
+
+echo "$result" | tail -n 1
+exit $status
@@ -0,0 +1,81 @@
+// Regole del tris condivise tra il server e gli strumenti offline
+// (simulatore, benchmark): chi include questo file usa esattamente la
+// stessa semantica di check_win del server.
+#ifndef TRIS_RULES_H
+#define TRIS_RULES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TABLE_SIZE 3           // Dimensione della griglia di gioco (3x3)
+#define GRID_SIZE 9            // Totale celle (TABLE_SIZE * TABLE_SIZE)
+
+// Log delle regole: gli strumenti offline possono ridefinirlo vuoto
+#ifndef RULES_LOG
+#define RULES_LOG(...) printf(__VA_ARGS__)
+#endif
+
+// Stati del gioco
+enum {
+    GAME_NOT_OVER, // Partita in corso
+    PLAYER1_WIN,   // Vittoria giocatore 1 (X)
+    PLAYER2_WIN,   // Vittoria giocatore 2 (O)
+    GAME_DRAW      // Pareggio
+};
+
+// Converte coordinate riga/colonna in indice lineare
+static inline uint8_t row_col(size_t i, size_t j) {
+    return TABLE_SIZE * i + j;
+}
+
+// Controlla lo stato della partita (vittoria/pareggio)
+static inline uint8_t check_win(char *table) {
+    RULES_LOG("[GAME] Controllo stato partita\n");
+    
+    // Controlla diagonali
+    if (table[row_col(1, 1)] != ' ') {
+        if (table[row_col(0, 0)] == table[row_col(1, 1)] && 
+            table[row_col(1, 1)] == table[row_col(2, 2)]) {
+            RULES_LOG("[GAME] Vittoria diagonale 1\n");
+            return table[row_col(1, 1)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
+        }
+        if (table[row_col(2, 0)] == table[row_col(1, 1)] && 
+            table[row_col(1, 1)] == table[row_col(0, 2)]) {
+            RULES_LOG("[GAME] Vittoria diagonale 2\n");
+            return table[row_col(1, 1)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
+        }
+    }
+
+    // Controlla righe e colonne
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+        // Controlla colonne
+        if (table[row_col(0, i)] == table[row_col(1, i)] &&
+            table[row_col(1, i)] == table[row_col(2, i)] &&
+            table[row_col(0, i)] != ' ') {
+            RULES_LOG("[GAME] Vittoria colonna %zu\n", i);
+            return table[row_col(0, i)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
+        }
+
+        // Controlla righe
+        if (table[row_col(i, 0)] == table[row_col(i, 1)] &&
+            table[row_col(i, 1)] == table[row_col(i, 2)] &&
+            table[row_col(i, 0)] != ' ') {
+            RULES_LOG("[GAME] Vittoria riga %zu\n", i);
+            return table[row_col(i, 0)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
+        }
+    }
+
+    // Controlla se ci sono ancora mosse disponibili
+    for (size_t i = 0; i < TABLE_SIZE * TABLE_SIZE; ++i) {
+        if (table[i] == ' ') {
+            RULES_LOG("[GAME] Partita ancora in corso\n");
+            return GAME_NOT_OVER;
+        }
+    }
+
+    RULES_LOG("[GAME] Pareggio\n");
+    return GAME_DRAW;
+}
+
+#endif // TRIS_RULES_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // recvmmsg e sendmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,17 +7,32 @@
 #include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <sys/time.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <ucontext.h>
+
+#include "rules.h"
 
 // Costanti di configurazione
-#define CLIENTS_LIMIT 10       // Limite massimo di client in attesa
+#define CLIENTS_LIMIT 128      // Limite massimo di client in attesa
 #define RUNNING 1              // Flag per il loop di gioco
 #define NO_FLAG 0              // Nessun flag speciale
-#define TABLE_SIZE 3           // Dimensione della griglia di gioco (3x3)
-#define GRID_SIZE 9            // Totale celle (TABLE_SIZE * TABLE_SIZE)
 #define MAX_ROOMS 20           // Numero massimo di stanze private
+#define MAX_NAME_LEN 49        // Lunghezza massima del nome (il client riserva 50 byte)
+#define MSG_MAX 4096           // Dimensione massima di un messaggio composto
 
 // Flag di comunicazione tra server e client
 const int WAIT_FLAG = 0;       // Attendi un avversario
@@ -32,29 +48,67 @@ const int JOIN_PRIVATE = 12;    // Richiesta di unirsi a stanza privata
 const int JOIN_REQUEST = 13;    // Richiesta di join ricevuta
 const int JOIN_ACCEPTED = 14;   // Join accettato
 const int JOIN_REJECTED = 15;   // Join rifiutato
+const int TOURNAMENT_JOIN = 20;       // Richiesta di iscrizione al torneo
+const int TOURNAMENT_REGISTERED = 21; // Iscrizione confermata
+const int TOURNAMENT_ROUND = 22;      // Inizio di un turno del torneo
+const int TOURNAMENT_BYE = 23;        // Turno di riposo (o vittoria a tavolino)
+const int TOURNAMENT_STANDINGS = 24;  // Classifica aggiornata
+const int TOURNAMENT_END = 25;        // Torneo concluso
+const int RESUME_REQUEST = 26;        // Ricollegamento a una partita o stanza recuperata
+const int RESUME_REJECTED = 27;       // Nessuna partita o stanza da riprendere
+const int LEADERBOARD_REQUEST = 28;   // Richiesta di statistiche e classifica
+const int LEADERBOARD = 29;           // Statistiche del giocatore e classifica
+const int LOBBY_SUBSCRIBE = 30;       // Iscrizione all'elenco delle stanze aperte
+const int LOBBY_SNAPSHOT = 31;        // Elenco completo delle stanze aperte
+const int LOBBY_UPDATE = 32;          // Stanze aperte e chiuse dall'ultimo aggiornamento
+const int SERVER_BUSY = 33;           // Richiesta rifiutata o stanza chiusa per carenza di memoria
+const int UDP_REQUEST = 34;           // Il client vuole giocare su UDP (precede il flag iniziale)
+const int UDP_TOKEN = 35;             // Token della sessione UDP
+const int TOURNAMENT_CANCELLED = 36;  // Torneo annullato per iscritti insufficienti
+const int JOIN_EXPIRED = 37;          // Il creatore non ha risposto in tempo a una richiesta
 
-// Stati del gioco
-enum {
-    GAME_NOT_OVER, // Partita in corso
-    PLAYER1_WIN,   // Vittoria giocatore 1 (X)
-    PLAYER2_WIN,   // Vittoria giocatore 2 (O)
-    GAME_DRAW      // Pareggio
-};
+struct udp_session_t;
 
 // Struttura per rappresentare un giocatore
 typedef struct player_t {
     int socket;     // Socket del giocatore
     char *name;     // Nome del giocatore
     int name_len;   // Lunghezza del nome
+    struct udp_session_t *udp; // Sessione UDP richiesta e non ancora in uso
+    int udp_control; // Connessione TCP mentre la partita usa UDP (-1 se no)
 } player_t;
 
 // Struttura per una stanza privata
 typedef struct private_room_t {
     int id;             // ID unico della stanza
     player_t *creator;  // Giocatore che ha creato la stanza
+    int arena_slot;     // Slot nell'archivio su disco (-1 se nessuno)
+    uint32_t token;     // Codice di ripresa del creatore
+    unsigned long serial; // Ordine di apertura (le più vecchie si chiudono per prime)
+    player_t *joiner;   // Giocatore in attesa dell'approvazione (NULL se nessuno)
+    time_t join_deadline; // Scadenza della risposta del creatore
 } private_room_t;
 
 private_room_t *private_rooms[MAX_ROOMS]; // Array di stanze private
+unsigned long room_serial = 0;            // Stanze aperte finora
+
+// Contabilità della memoria (vedi MEMORIA)
+enum { MEM_PLAYERS, MEM_ROOMS, MEM_GAMES, MEM_STACKS, MEM_BUFFERS, MEM_TOURNAMENTS, MEM_STATS, MEM_CATEGORIES };
+extern long mem_conn_bytes;
+void mem_charge(int category, long bytes);
+
+// Cattura del traffico in ingresso (vedi CATTURA DEL TRAFFICO)
+ssize_t capture_recv(int socket, void *buf, size_t len, int flags);
+void capture_data(int socket, const void *buf, ssize_t n);
+
+// Notifiche all'elenco delle stanze aperte (vedi STANZE APERTE)
+void lobby_room_opened(const private_room_t *room);
+void lobby_room_closed(int id);
+
+// Trasporto UDP (vedi TRASPORTO UDP)
+void udp_release(struct udp_session_t *session);
+struct udp_session_t *udp_take(int socket);
+void udp_attach(player_t *player);
 
 // Genera un ID unico per una stanza privata
 int generate_unique_room_id() {
@@ -62,16 +116,20 @@ int generate_unique_room_id() {
     return 1000 + rand() % 9000; // ID tra 1000 e 9999
 }
 
-// Aggiunge una stanza privata all'array
-void add_private_room(private_room_t *room) {
+// Aggiunge una stanza privata all'array (-1 se non c'è posto)
+int add_private_room(private_room_t *room) {
     printf("[ROOM] Aggiunta stanza privata ID: %d\n", room->id);
     for (int i = 0; i < MAX_ROOMS; ++i) {
         if (private_rooms[i] == NULL) {
             private_rooms[i] = room;
-            return;
+            room->serial = ++room_serial;
+            mem_charge(MEM_ROOMS, sizeof(private_room_t));
+            lobby_room_opened(room);
+            return 0;
         }
     }
     printf("[ROOM] ERRORE: Numero massimo di stanze raggiunto\n");
+    return -1;
 }
 
 // Trova una stanza per ID
@@ -86,11 +144,29 @@ private_room_t *find_room_by_id(int id) {
     return NULL;
 }
 
+void arena_release(int slot);
+void delete_player(player_t *player);
+
+// Rifiuta il giocatore in attesa di entrare nella stanza
+void room_reject_joiner(private_room_t *room) {
+    player_t *joiner = room->joiner;
+    room->joiner = NULL;
+    send(joiner->socket, &JOIN_REJECTED, sizeof(int), MSG_NOSIGNAL);
+    close(joiner->socket);
+    delete_player(joiner);
+}
+
 // Rimuove una stanza per ID
 void remove_room_by_id(int id) {
     printf("[ROOM] Rimozione stanza ID: %d\n", id);
     for (int i = 0; i < MAX_ROOMS; ++i) {
         if (private_rooms[i] && private_rooms[i]->id == id) {
+            if (private_rooms[i]->joiner) {
+                room_reject_joiner(private_rooms[i]);
+            }
+            arena_release(private_rooms[i]->arena_slot);
+            lobby_room_closed(id);
+            mem_charge(MEM_ROOMS, -(long)sizeof(private_room_t));
             free(private_rooms[i]);
             private_rooms[i] = NULL;
         }
@@ -104,38 +180,218 @@ player_t *create_player(int socket, char *name, int name_len) {
     player->socket = socket;
     player->name = name;
     player->name_len = name_len;
+    player->udp = NULL;
+    player->udp_control = -1;
+    // Ogni giocatore è una connessione: ne conta anche i buffer del socket
+    mem_charge(MEM_PLAYERS, sizeof(player_t) + name_len + 1);
+    mem_charge(MEM_BUFFERS, mem_conn_bytes);
     return player;
 }
 
 // Elimina un giocatore
 void delete_player(player_t *player) {
     printf("[PLAYER] Eliminazione giocatore: %s\n", player->name);
+    mem_charge(MEM_PLAYERS, -(long)(sizeof(player_t) + player->name_len + 1));
+    mem_charge(MEM_BUFFERS, -mem_conn_bytes);
+    udp_release(player->udp);
     free(player->name);
     free(player);
 }
 
+// ======================= ARCHIVIO SU DISCO =======================
+// Partite e stanze private sono duplicate in un file mappato in memoria
+// con layout fisso: uno slot per partita o stanza. Ogni mossa aggiunge
+// allo slot un delta di 2 byte (cella e simbolo) e poi incrementa il
+// numero di sequenza, quindi lo slot è sempre coerente anche se il
+// processo termina a metà. Dopo un crash il server riavviato ricostruisce
+// le partite dal file e attende che i giocatori si ricolleghino.
+
+#define ARENA_MAGIC 0x414e5254      // "TRNA"
+#define ARENA_VERSION 2             // Versione del layout
+#define ARENA_SLOTS 1024            // Partite e stanze salvabili contemporaneamente
+#define ARENA_DEFAULT_PATH "tris_arena.bin"
+
+// Contenuto di uno slot
+enum {
+    ARENA_FREE,  // Slot libero
+    ARENA_GAME,  // Partita in corso
+    ARENA_ROOM   // Stanza privata in attesa
+};
+
+// Intestazione del file
+typedef struct arena_header_t {
+    uint32_t magic;      // ARENA_MAGIC
+    uint32_t version;    // ARENA_VERSION
+    uint32_t n_slots;    // ARENA_SLOTS
+    uint32_t slot_size;  // sizeof(arena_slot_t)
+} arena_header_t;
+
+// Slot di una partita o di una stanza
+typedef struct arena_slot_t {
+    uint32_t kind;                     // ARENA_FREE, ARENA_GAME o ARENA_ROOM
+    uint32_t seq;                      // Mosse confermate
+    int32_t id;                        // ID della partita o della stanza
+    uint8_t name_len[2];               // Lunghezza dei nomi
+    char names[2][MAX_NAME_LEN + 1];   // Giocatori (0 = X o creatore, 1 = O)
+    uint32_t tokens[2];                // Codici di ripresa dei giocatori
+    uint16_t moves[GRID_SIZE];         // Delta delle mosse: cella << 8 | simbolo
+} arena_slot_t;
+
+const char *arena_path = ARENA_DEFAULT_PATH; // TRIS_ARENA
+arena_slot_t *arena_slots = NULL;            // Slot mappati (NULL se disattivato)
+int arena_free_slots[ARENA_SLOTS];           // Pila degli slot liberi
+int arena_n_free = 0;
+pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Mappa il file dell'archivio. Con recover = 0, o se il file non è valido,
+// l'archivio viene azzerato; altrimenti gli slot occupati restano da
+// recuperare e non finiscono tra quelli liberi.
+void arena_open(int recover) {
+    const char *path = getenv("TRIS_ARENA");
+    if (path && *path) {
+        arena_path = path;
+    }
+    size_t size = sizeof(arena_header_t) + ARENA_SLOTS * sizeof(arena_slot_t);
+    int fd = open(arena_path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        perror("[ARENA] apertura archivio");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("[ARENA] mmap");
+        return;
+    }
+
+    arena_header_t *header = (arena_header_t *)map;
+    arena_slots = (arena_slot_t *)(header + 1);
+    if (!recover || header->magic != ARENA_MAGIC || header->version != ARENA_VERSION ||
+        header->n_slots != ARENA_SLOTS || header->slot_size != sizeof(arena_slot_t)) {
+        memset(map, 0, size);
+        header->magic = ARENA_MAGIC;
+        header->version = ARENA_VERSION;
+        header->n_slots = ARENA_SLOTS;
+        header->slot_size = sizeof(arena_slot_t);
+    }
+    for (int i = ARENA_SLOTS - 1; i >= 0; --i) {
+        if (arena_slots[i].kind == ARENA_FREE) {
+            arena_free_slots[arena_n_free++] = i;
+        }
+    }
+    printf("[ARENA] Archivio %s: %d slot liberi su %d\n", arena_path, arena_n_free, ARENA_SLOTS);
+}
+
+// Genera il codice di ripresa di un giocatore. Chi si ricollega deve
+// presentarlo insieme al nome, quindi deve essere imprevedibile (mai 0).
+uint32_t arena_token(void) {
+    uint32_t token = 0;
+    while (token == 0) {
+        if (getrandom(&token, sizeof(token), 0) != sizeof(token)) {
+            token = (uint32_t)rand() ^ (uint32_t)time(NULL);
+        }
+    }
+    return token;
+}
+
+// Occupa uno slot (-1 se l'archivio è pieno o disattivato); tokens ha un
+// codice di ripresa per ogni giocatore presente
+int arena_alloc(int kind, int id, const player_t *first, const player_t *second,
+                const uint32_t *tokens) {
+    pthread_mutex_lock(&arena_lock);
+    int slot = arena_n_free > 0 ? arena_free_slots[--arena_n_free] : -1;
+    pthread_mutex_unlock(&arena_lock);
+    if (slot < 0) {
+        return -1;
+    }
+
+    arena_slot_t *s = &arena_slots[slot];
+    const player_t *players[2] = {first, second};
+    memset(s, 0, sizeof(arena_slot_t));
+    s->id = id;
+    for (int i = 0; i < 2; ++i) {
+        if (players[i]) {
+            // Lo slot ha spazio per MAX_NAME_LEN caratteri, qualunque nome arrivi
+            int len = players[i]->name_len < MAX_NAME_LEN ? players[i]->name_len : MAX_NAME_LEN;
+            s->name_len[i] = (uint8_t)len;
+            memcpy(s->names[i], players[i]->name, len);
+            s->tokens[i] = tokens[i];
+        }
+    }
+    // Il tipo va scritto per ultimo: uno slot a metà resta libero
+    __atomic_store_n(&s->kind, kind, __ATOMIC_RELEASE);
+    return slot;
+}
+
+// Conferma una mossa: prima il delta, poi il numero di sequenza
+void arena_commit_move(int slot, int cell, char symbol) {
+    if (slot < 0) {
+        return;
+    }
+    arena_slot_t *s = &arena_slots[slot];
+    uint32_t seq = s->seq;
+    if (seq >= GRID_SIZE) {
+        return;
+    }
+    s->moves[seq] = (uint16_t)(cell << 8 | (uint8_t)symbol);
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Libera uno slot
+void arena_release(int slot) {
+    if (slot < 0) {
+        return;
+    }
+    __atomic_store_n(&arena_slots[slot].kind, ARENA_FREE, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&arena_lock);
+    arena_free_slots[arena_n_free++] = slot;
+    pthread_mutex_unlock(&arena_lock);
+}
+
 // Struttura per rappresentare una partita
+// Lo stato di gioco sta qui e non sullo stack della fibra, così può
+// essere trasferito a un nuovo processo durante un aggiornamento a caldo
 typedef struct game_t {
-    player_t *player1; // Giocatore 1 (X)
-    player_t *player2; // Giocatore 2 (O)
-    int game_id;       // ID unico della partita
+    player_t *player1;          // Giocatore 1 (X)
+    player_t *player2;          // Giocatore 2 (O)
+    int game_id;                // ID unico della partita
+    char table[GRID_SIZE];      // Griglia di gioco
+    int turn;                   // 0 = tocca a X, 1 = tocca a O
+    int move_count;             // Mosse giocate
+    int resumed;                // 1 se ripresa dopo un aggiornamento a caldo
+    int resync;                 // Giocatori (bit 0 = X, bit 1 = O) passati da UDP a TCP
+                                // con l'aggiornamento: la griglia va ricomunicata
+    int arena_slot;             // Slot nell'archivio su disco (-1 se nessuno)
+    uint32_t tokens[2];         // Codici di ripresa (0 = X, 1 = O)
+    struct game_t *prev, *next; // Lista delle partite in corso
 } game_t;
 
 // Crea una nuova partita
 game_t *create_game(player_t *player1, player_t *player2) {
     printf("[GAME] Creazione partita tra %s e %s\n", player1->name, player2->name);
-    game_t *game = malloc(sizeof(game_t));
+    game_t *game = calloc(1, sizeof(game_t));
     game->player1 = player1;
     game->player2 = player2;
     game->game_id = rand();
+    game->arena_slot = -1;
+    game->tokens[0] = arena_token();
+    game->tokens[1] = arena_token();
+    memset(game->table, ' ', GRID_SIZE);
+    mem_charge(MEM_GAMES, sizeof(game_t));
     return game;
 }
 
 // Elimina una partita
 void delete_game(game_t *game) {
     printf("[GAME] Eliminazione partita ID: %d\n", game->game_id);
+    close(game->player1->socket);
+    close(game->player2->socket);
     delete_player(game->player1);
     delete_player(game->player2);
+    mem_charge(MEM_GAMES, -(long)sizeof(game_t));
     free(game);
 }
 
@@ -144,15 +400,20 @@ player_t *receive_player(int socket) {
     printf("[PLAYER] Ricezione dati giocatore dal socket %d\n", socket);
     
     int name_len;
-    if (recv(socket, &name_len, sizeof(int), 0) <= 0) {
+    if (capture_recv(socket, &name_len, sizeof(int), 0) <= 0) {
         printf("[ERRORE] Ricezione lunghezza nome fallita\n");
         return NULL;
     }
     name_len = ntohs(name_len);
     printf("[PLAYER] Lunghezza nome ricevuta: %d\n", name_len);
+    // Il nome fa parte del budget della connessione: non si alloca quello che chiede il client
+    if (name_len <= 0 || name_len > MAX_NAME_LEN) {
+        printf("[ERRORE] Lunghezza nome non valida\n");
+        return NULL;
+    }
 
     char *name = malloc((name_len + 1) * sizeof(char));
-    if (recv(socket, name, name_len, 0) <= 0) {
+    if (capture_recv(socket, name, name_len, MSG_WAITALL) != name_len) {
         printf("[ERRORE] Ricezione nome fallita\n");
         free(name);
         return NULL;
@@ -160,402 +421,5369 @@ player_t *receive_player(int socket) {
     name[name_len] = '\0';
     printf("[PLAYER] Nome ricevuto: %s\n", name);
 
-    return create_player(socket, name, name_len);
+    player_t *player = create_player(socket, name, name_len);
+    player->udp = udp_take(socket);
+    return player;
 }
 
-// Converte coordinate riga/colonna in indice lineare
-uint8_t row_col(size_t i, size_t j) {
-    return TABLE_SIZE * i + j;
+// ======================= PARTITE IN CORSO =======================
+// Registro delle partite gestite dalle fibre e punti di sosta usati
+// durante un aggiornamento a caldo (vedi AGGIORNAMENTO A CALDO).
+
+// Stati dell'aggiornamento a caldo
+enum {
+    UPGRADE_IDLE,        // Nessun aggiornamento
+    UPGRADE_IN_PROGRESS  // Stato in trasferimento: i thread devono fermarsi
+};
+
+int upgrade_state = UPGRADE_IDLE;  // Stato dell'aggiornamento a caldo
+int upgrade_fd = -1;               // eventfd leggibile durante un aggiornamento
+game_t *live_games = NULL;         // Partite gestite da game_function
+pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t live_cond = PTHREAD_COND_INITIALIZER;
+
+// 1 se è in corso un aggiornamento a caldo
+int upgrade_pending(void) {
+    return __atomic_load_n(&upgrade_state, __ATOMIC_ACQUIRE) == UPGRADE_IN_PROGRESS;
 }
 
-// Controlla lo stato della partita (vittoria/pareggio)
-uint8_t check_win(char *table) {
-    printf("[GAME] Controllo stato partita\n");
-    
-    // Controlla diagonali
-    if (table[row_col(1, 1)] != ' ') {
-        if (table[row_col(0, 0)] == table[row_col(1, 1)] && 
-            table[row_col(1, 1)] == table[row_col(2, 2)]) {
-            printf("[GAME] Vittoria diagonale 1\n");
-            return table[row_col(1, 1)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
-        }
-        if (table[row_col(2, 0)] == table[row_col(1, 1)] && 
-            table[row_col(1, 1)] == table[row_col(0, 2)]) {
-            printf("[GAME] Vittoria diagonale 2\n");
-            return table[row_col(1, 1)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
-        }
+// Ferma il thread chiamante finché l'aggiornamento non termina. Se riesce
+// il processo esce senza risvegliarlo, altrimenti il thread riparte da qui.
+// held è il mutex eventualmente posseduto dal chiamante (viene rilasciato).
+void upgrade_park(int *parked, pthread_mutex_t *held) {
+    if (held) {
+        pthread_mutex_unlock(held);
     }
+    pthread_mutex_lock(&live_lock);
+    *parked = 1;
+    pthread_cond_broadcast(&live_cond);
+    while (upgrade_state == UPGRADE_IN_PROGRESS) {
+        pthread_cond_wait(&live_cond, &live_lock);
+    }
+    *parked = 0;
+    pthread_mutex_unlock(&live_lock);
+    if (held) {
+        pthread_mutex_lock(held);
+    }
+}
 
-    // Controlla righe e colonne
-    for (size_t i = 0; i < TABLE_SIZE; ++i) {
-        // Controlla colonne
-        if (table[row_col(0, i)] == table[row_col(1, i)] &&
-            table[row_col(1, i)] == table[row_col(2, i)] &&
-            table[row_col(0, i)] != ' ') {
-            printf("[GAME] Vittoria colonna %zu\n", i);
-            return table[row_col(0, i)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
-        }
-
-        // Controlla righe
-        if (table[row_col(i, 0)] == table[row_col(i, 1)] &&
-            table[row_col(i, 1)] == table[row_col(i, 2)] &&
-            table[row_col(i, 0)] != ' ') {
-            printf("[GAME] Vittoria riga %zu\n", i);
-            return table[row_col(i, 0)] == 'X' ? PLAYER1_WIN : PLAYER2_WIN;
-        }
+// Aggiunge una partita al registro
+void live_game_add(game_t *game) {
+    pthread_mutex_lock(&live_lock);
+    game->prev = NULL;
+    game->next = live_games;
+    if (live_games) {
+        live_games->prev = game;
     }
+    live_games = game;
+    pthread_mutex_unlock(&live_lock);
+}
 
-    // Controlla se ci sono ancora mosse disponibili
-    for (size_t i = 0; i < TABLE_SIZE * TABLE_SIZE; ++i) {
-        if (table[i] == ' ') {
-            printf("[GAME] Partita ancora in corso\n");
-            return GAME_NOT_OVER;
-        }
+// Rimuove una partita conclusa dal registro
+void live_game_remove(game_t *game) {
+    pthread_mutex_lock(&live_lock);
+    if (game->prev) {
+        game->prev->next = game->next;
+    } else {
+        live_games = game->next;
     }
+    if (game->next) {
+        game->next->prev = game->prev;
+    }
+    pthread_cond_broadcast(&live_cond);
+    pthread_mutex_unlock(&live_lock);
+}
 
-    printf("[GAME] Pareggio\n");
-    return GAME_DRAW;
+int fiber_wait(int fd, uint32_t events, int safe_point);
+
+// Attende che il giocatore di turno invii dati (0 = pronto, -1 = errore).
+// È l'unico punto in cui una partita può fermarsi per un aggiornamento a caldo.
+int wait_for_move(int socket) {
+    return fiber_wait(socket, EPOLLIN, 1);
 }
 
-// Funzione principale del gioco (eseguita in un thread separato)
-void *game_function(void *arg) {
-    game_t *game = (game_t *)arg;
-    player_t *player1 = game->player1;
-    player_t *player2 = game->player2;
-    int game_id = game->game_id;
+// Legge un intero positivo da una variabile d'ambiente
+int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    if (!value || atoi(value) <= 0) {
+        return fallback;
+    }
+    return atoi(value);
+}
 
-    printf("[GAME] Partita [%d] iniziata tra %s e %s\n",
-           game_id, player1->name, player2->name);
-
-    // Comunica l'inizio della partita ai giocatori
-    int net_game_id = htonl(game_id);
-    send(player1->socket, &START_FLAG, sizeof(int), NO_FLAG);
-    send(player1->socket, &net_game_id, sizeof(int), NO_FLAG);
-    send(player2->socket, &START_FLAG, sizeof(int), NO_FLAG);
-    send(player2->socket, &net_game_id, sizeof(int), NO_FLAG);
-
-    // Invia i nomi dei giocatori
-    printf("[GAME] Invio nomi giocatori\n");
-    int p1_len = htons(player1->name_len);
-    int p2_len = htons(player2->name_len);
-    send(player2->socket, &p1_len, sizeof(int), NO_FLAG);
-    send(player1->socket, &p2_len, sizeof(int), NO_FLAG);
-    send(player2->socket, player1->name, player1->name_len, NO_FLAG);
-    send(player1->socket, player2->name, player2->name_len, NO_FLAG);
-
-    // Assegna i simboli (X inizia sempre per primo)
-    printf("[GAME] Assegnazione simboli: %s=X, %s=O\n",
-           player1->name, player2->name);
-    char X = 'X', O = 'O';
-    send(player1->socket, &X, sizeof(char), NO_FLAG);
-    send(player2->socket, &O, sizeof(char), NO_FLAG);
-
-    // Inizializza la griglia di gioco
-    char table[GRID_SIZE];
-    memset(table, ' ', GRID_SIZE);
-    printf("[GAME] Griglia inizializzata\n");
-
-    // Loop principale del gioco
-    printf("[GAME] Inizio loop di gioco\n");
-    do {
-        uint8_t win_flag;
-        int move;
+// ======================= MEMORIA =======================
+// Contabilità della memoria per categoria. Ogni connessione ha un budget
+// fisso: il record del giocatore, con un nome di al più MAX_NAME_LEN byte,
+// e i buffer del socket, limitati con SO_SNDBUF/SO_RCVBUF. Gli stack delle
+// fibre contano per le pagine residenti, non per l'intero mapping. Oltre la soglia
+// alta (90% di TRIS_MEM_LIMIT_MB) il server rifiuta nuove partite e stanze,
+// classifiche e iscrizioni alla lobby e chiude le stanze private in attesa
+// da più tempo; torna a servire tutto sotto la soglia bassa (75%). SIGUSR1 stampa l'uso per categoria.
 
-        // Turno del giocatore 1 (X)
-        printf("[GAME] Turno di %s (X)\n", player1->name);
+#define MEM_LIMIT_MB 256       // Limite predefinito (TRIS_MEM_LIMIT_MB)
+#define MEM_CONN_BUFFER_KB 16  // Buffer del socket per direzione (TRIS_CONN_BUFFER_KB)
+#define MEM_HIGH_PERCENT 90    // Soglia oltre cui si scarta il carico
+#define MEM_LOW_PERCENT 75     // Soglia sotto cui si torna a servire tutto
 
-        // Comunica al player1 che è il suo turno
-        send(player1->socket, (const char *)&YOUR_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
+const char *mem_names[MEM_CATEGORIES] = {"giocatori", "stanze", "partite", "stack", "buffer",
+                                         "tornei", "statistiche"};
+long mem_used[MEM_CATEGORIES];  // Byte in uso per categoria
+long mem_total = 0;             // Byte in uso in totale
+long mem_peak = 0;              // Massimo di mem_total
+long mem_limit = (long)MEM_LIMIT_MB << 20;
+long mem_high = ((long)MEM_LIMIT_MB << 20) / 100 * MEM_HIGH_PERCENT;
+long mem_low = ((long)MEM_LIMIT_MB << 20) / 100 * MEM_LOW_PERCENT;
+int mem_conn_buffer = MEM_CONN_BUFFER_KB * 1024; // Richiesto per direzione
+long mem_conn_bytes = 0;        // Buffer di una connessione come li riserva il kernel
+int mem_shedding = 0;           // 1 tra la soglia alta e il rientro sotto quella bassa
 
-        // Comunica al player2 che deve attendere
-        send(player2->socket, (const char *)&OPPONENT_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
+// Aggiunge (o toglie, se negativo) byte a una categoria
+void mem_charge(int category, long bytes) {
+    __atomic_add_fetch(&mem_used[category], bytes, __ATOMIC_RELAXED);
+    long total = __atomic_add_fetch(&mem_total, bytes, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+    while (total > peak && !__atomic_compare_exchange_n(&mem_peak, &peak, total, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
 
-        // Ricevi mossa dal giocatore 1
-        if (recv(player1->socket, (char *)&move, sizeof(int), 0) <= 0) {
-            printf("[ERRORE] Ricezione mossa da %s fallita\n", player1->name);
-            break;
+    // Con l'isteresi lo stato cambia solo ai due estremi e si stampa una volta
+    int shedding = __atomic_load_n(&mem_shedding, __ATOMIC_RELAXED);
+    if (!shedding && total >= mem_high) {
+        if (__atomic_exchange_n(&mem_shedding, 1, __ATOMIC_RELAXED) == 0) {
+            printf("[MEM] Soglia alta superata (%ld KB): nuove partite rifiutate\n", total >> 10);
         }
-        move = ntohs(move);
-        printf("[GAME] %s ha mosso in posizione %d\n", player1->name, move);
-        table[move] = 'X';
+    } else if (shedding && total <= mem_low) {
+        if (__atomic_exchange_n(&mem_shedding, 0, __ATOMIC_RELAXED) == 1) {
+            printf("[MEM] Memoria rientrata (%ld KB): nuove partite di nuovo accettate\n", total >> 10);
+        }
+    }
+}
 
-        // Invia aggiornamento a entrambi i giocatori
-        send(player1->socket, (const char *)&OPPONENT_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-        send(player2->socket, (const char *)&OPPONENT_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
+// 1 se la memoria è oltre la soglia alta e non è ancora rientrata
+int mem_over_limit(void) {
+    return __atomic_load_n(&mem_shedding, __ATOMIC_RELAXED);
+}
 
-        // Controlla stato del gioco
-        win_flag = check_win(table);
-        printf("[GAME] Stato dopo mossa: %d\n", win_flag);
+// Limita i buffer del socket di una connessione al budget
+void mem_limit_socket(int socket) {
+    setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &mem_conn_buffer, sizeof(mem_conn_buffer));
+    setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &mem_conn_buffer, sizeof(mem_conn_buffer));
+}
 
-        // Gestisci fine partita
-        if (win_flag == GAME_DRAW) {
-            printf("[GAME] Pareggio!\n");
-            send(player1->socket, (const char *)&DRAW_FLAG, sizeof(int), NO_FLAG);
-            send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            send(player2->socket, (const char *)&DRAW_FLAG, sizeof(int), NO_FLAG);
-            send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            break;
-        } else if (win_flag == PLAYER1_WIN) {
-            printf("[GAME] %s ha vinto!\n", player1->name);
-            send(player1->socket, (const char *)&WIN_FLAG, sizeof(int), NO_FLAG);
-            send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            send(player2->socket, (const char *)&LOSE_FLAG, sizeof(int), NO_FLAG);
-            send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            break;
-        } else if (win_flag == PLAYER2_WIN) {
-            printf("[GAME] %s ha vinto!\n", player2->name);
-            send(player1->socket, (const char *)&LOSE_FLAG, sizeof(int), NO_FLAG);
-            send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            send(player2->socket, (const char *)&WIN_FLAG, sizeof(int), NO_FLAG);
-            send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            break;
+// Legge limite e budget dall'ambiente e misura i buffer di una connessione
+void mem_init(void) {
+    mem_limit = (long)env_int("TRIS_MEM_LIMIT_MB", MEM_LIMIT_MB) << 20;
+    mem_high = mem_limit / 100 * MEM_HIGH_PERCENT;
+    mem_low = mem_limit / 100 * MEM_LOW_PERCENT;
+    mem_conn_buffer = env_int("TRIS_CONN_BUFFER_KB", MEM_CONN_BUFFER_KB) * 1024;
+
+    // Il kernel raddoppia e arrotonda i valori richiesti: si conta quello che riserva davvero
+    int probe = socket(AF_INET, SOCK_STREAM, 0);
+    int sndbuf = mem_conn_buffer, rcvbuf = mem_conn_buffer;
+    if (probe >= 0) {
+        mem_limit_socket(probe);
+        socklen_t len = sizeof(int);
+        getsockopt(probe, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+        len = sizeof(int);
+        getsockopt(probe, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+        close(probe);
+    }
+    mem_conn_bytes = (long)sndbuf + rcvbuf;
+    printf("[MEM] Limite %ld MB, budget per connessione %ld KB\n", mem_limit >> 20, mem_conn_bytes >> 10);
+}
+
+// Stampa l'uso della memoria per categoria (SIGUSR1)
+void mem_report(void) {
+    printf("[MEM] In uso %ld KB (picco %ld KB, soglia alta %ld KB, limite %ld KB)%s\n",
+           __atomic_load_n(&mem_total, __ATOMIC_RELAXED) >> 10,
+           __atomic_load_n(&mem_peak, __ATOMIC_RELAXED) >> 10, mem_high >> 10, mem_limit >> 10,
+           mem_over_limit() ? ", nuove partite rifiutate" : "");
+    for (int i = 0; i < MEM_CATEGORIES; ++i) {
+        printf("[MEM]   %-10s %10ld byte\n", mem_names[i], __atomic_load_n(&mem_used[i], __ATOMIC_RELAXED));
+    }
+}
+
+// Oltre la soglia chiude le stanze private, dalla più vecchia, finché la
+// memoria non rientra. Le stanze appartengono al thread principale.
+void mem_evict_rooms(void) {
+    while (mem_over_limit()) {
+        private_room_t *oldest = NULL;
+        for (int i = 0; i < MAX_ROOMS; ++i) {
+            if (private_rooms[i] && (!oldest || private_rooms[i]->serial < oldest->serial)) {
+                oldest = private_rooms[i];
+            }
+        }
+        if (!oldest) {
+            return;
         }
+        int id = oldest->id;
+        player_t *creator = oldest->creator;
+        printf("[MEM] Chiusura della stanza %d di %s per carenza di memoria\n", id, creator->name);
+        remove_room_by_id(id);
+        send(creator->socket, &SERVER_BUSY, sizeof(int), 0);
+        close(creator->socket);
+        delete_player(creator);
+    }
+}
 
-        // Turno del giocatore 2 (O)
-        printf("[GAME] Turno di %s (O)\n", player2->name);
+// Oltre la soglia rifiuta la richiesta di una nuova partita, stanza, ripresa,
+// iscrizione alla lobby o classifica (1 = rifiutata: il giocatore viene avvisato e scollegato, poi si
+// liberano le stanze in attesa)
+int mem_refuse(player_t *player) {
+    if (!mem_over_limit()) {
+        return 0;
+    }
+    printf("[MEM] Richiesta di %s rifiutata per carenza di memoria\n", player->name);
+    send(player->socket, &SERVER_BUSY, sizeof(int), 0);
+    close(player->socket);
+    delete_player(player);
+    mem_evict_rooms();
+    return 1;
+}
 
-        // Comunica al player2 che è il suo turno
-        send(player2->socket, (const char *)&YOUR_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
+// ======================= FIBRE =======================
+// Le partite casuali e private girano su fibre: game_function resta codice
+// sequenziale, ma ogni partita ha uno stack di pochi KB invece di un thread
+// con 8 MB riservati. Le fibre sono distribuite su pochi thread (uno per
+// CPU), ognuno con la propria istanza epoll: quando una send o una recv non
+// può proseguire la fibra cede il controllo al proprio thread e riparte
+// quando il socket è pronto. Una fibra non cambia mai thread.
+//
+// Per un aggiornamento a caldo un thread si ferma quando tutte le sue fibre
+// sono in un punto di sosta (in attesa di una mossa): le mosse che arrivano
+// nel frattempo restano da servire e ripartono se l'aggiornamento fallisce.
 
-        // Comunica al player1 che deve attendere
-        send(player1->socket, (const char *)&OPPONENT_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
+#define FIBER_MAX_THREADS 32    // Numero massimo di thread per le fibre
+#define FIBER_STACK_KB 32       // Stack predefinito di una fibra (TRIS_FIBER_STACK_KB)
+#define FIBER_STACK_MIN_KB 16   // Stack minimo accettato
+#define FIBER_STACK_MAX_KB 64   // Stack massimo accettato
+#define FIBER_POOL_MAX 4096     // Stack conservati nel pool di ogni thread
+#define FIBER_MAX_EVENTS 256    // Eventi letti per ogni epoll_wait
 
-        // Ricevi mossa dal giocatore 2
-        if (recv(player2->socket, (char *)&move, sizeof(int), 0) <= 0) {
-            printf("[ERRORE] Ricezione mossa da %s fallita\n", player2->name);
-            break;
-        }
-        move = ntohs(move);
-        printf("[GAME] %s ha mosso in posizione %d\n", player2->name, move);
-        table[move] = 'O';
+struct fiber_thread_t;
 
-        // Invia aggiornamento a entrambi i giocatori
-        send(player1->socket, (const char *)&OPPONENT_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-        send(player2->socket, (const char *)&OPPONENT_MOVE_FLAG, sizeof(int), NO_FLAG);
-        send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
+// Fibra: contesto, stack e funzione da eseguire
+typedef struct fiber_t {
+    ucontext_t context;            // Registri salvati quando la fibra è ferma
+    char *stack;                   // Mapping dello stack (pagina di guardia inclusa)
+    void *(*fn)(void *);           // Funzione della fibra
+    void *arg;                     // Argomento di fn
+    size_t stack_charge;           // Byte dello stack contati in MEM_STACKS
+    int done;                      // 1 quando fn è terminata
+    int waiting;                   // 1 se ferma in un punto di sosta
+    struct fiber_thread_t *thread; // Thread che esegue la fibra
+    struct fiber_t *next;          // Collegamento nelle code del thread
+} fiber_t;
 
-        // Controlla stato del gioco
-        win_flag = check_win(table);
-        printf("[GAME] Stato dopo mossa: %d\n", win_flag);
+// Thread che esegue le fibre
+typedef struct fiber_thread_t {
+    pthread_t thread;          // Thread di sistema
+    int epoll_fd;              // Istanza epoll
+    int wake_fd;               // eventfd per consegnare nuove fibre
+    pthread_mutex_t lock;      // Protegge la lista incoming
+    fiber_t *incoming;         // Fibre consegnate e non ancora avviate
+    fiber_t *ready;            // Fibre pronte a ripartire
+    fiber_t *ready_tail;       // Ultima fibra pronta
+    fiber_t *deferred;         // Fibre in sosta risvegliate durante un aggiornamento
+    fiber_t *current;          // Fibra in esecuzione (NULL nel loop del thread)
+    char *pool;                // Stack liberi (collegati tramite fiber_stack_link)
+    int pool_size;             // Stack nel pool
+    int busy;                  // Fibre fuori dai punti di sosta
+    int parked;                // 1 se fermo per un aggiornamento a caldo
+    ucontext_t context;        // Contesto del loop del thread
+} fiber_thread_t;
 
-        // Gestisci fine partita
-        if (win_flag == GAME_DRAW) {
-            printf("[GAME] Pareggio!\n");
-            send(player1->socket, (const char *)&DRAW_FLAG, sizeof(int), NO_FLAG);
-            send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            send(player2->socket, (const char *)&DRAW_FLAG, sizeof(int), NO_FLAG);
-            send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            break;
-        } else if (win_flag == PLAYER1_WIN) {
-            printf("[GAME] %s ha vinto!\n", player1->name);
-            send(player1->socket, (const char *)&WIN_FLAG, sizeof(int), NO_FLAG);
-            send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            send(player2->socket, (const char *)&LOSE_FLAG, sizeof(int), NO_FLAG);
-            send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            break;
-        } else if (win_flag == PLAYER2_WIN) {
-            printf("[GAME] %s ha vinto!\n", player2->name);
-            send(player1->socket, (const char *)&LOSE_FLAG, sizeof(int), NO_FLAG);
-            send(player1->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            send(player2->socket, (const char *)&WIN_FLAG, sizeof(int), NO_FLAG);
-            send(player2->socket, table, GRID_SIZE * sizeof(char), NO_FLAG);
-            break;
-        }
-    } while (RUNNING);
+fiber_thread_t fiber_threads[FIBER_MAX_THREADS];
+int fiber_n_threads = 0;
+int fiber_next_thread = 0;
+size_t fiber_stack_size = FIBER_STACK_KB * 1024; // Stack utilizzabile (senza guardia)
+size_t fiber_page_size = 4096;
+pthread_once_t fiber_once = PTHREAD_ONCE_INIT;
+__thread fiber_thread_t *fiber_self = NULL;      // Thread delle fibre corrente
 
-    printf("[GAME] Partita [%d] terminata\n", game_id);
-    delete_game(game);
-    return NULL;
+// Fibra in esecuzione sul thread corrente (NULL fuori da una fibra)
+fiber_t *fiber_current(void) {
+    return fiber_self ? fiber_self->current : NULL;
 }
 
-int main() {
-    setbuf(stdout, NULL);
-    printf("[SERVER] Avvio server...\n");
-    srand(time(NULL));
-    
-    // Creazione socket server
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+// Collegamento nel pool, in cima allo stack (la parte che ogni fibra usa comunque)
+char **fiber_stack_link(char *stack) {
+    return (char **)(stack + fiber_page_size + fiber_stack_size - sizeof(char *));
+}
+
+// Byte contati in MEM_STACKS per uno stack nel pool, accanto al collegamento
+size_t *fiber_stack_charge(char *stack) {
+    return (size_t *)fiber_stack_link(stack) - 1;
+}
+
+// Byte dello stack effettivamente in memoria: con MAP_NORESERVE una pagina
+// esiste solo dopo il primo accesso (la pagina di guardia non conta)
+size_t fiber_stack_resident(char *stack) {
+    unsigned char pages[FIBER_STACK_MAX_KB * 1024 / 4096];
+    size_t n = fiber_stack_size / fiber_page_size;
+    if (n > sizeof(pages) || mincore(stack + fiber_page_size, fiber_stack_size, pages) < 0) {
+        return fiber_stack_size;
+    }
+    size_t resident = 0;
+    for (size_t i = 0; i < n; ++i) {
+        resident += pages[i] & 1;
     }
-    printf("[SERVER] Socket creato\n");
+    return resident * fiber_page_size;
+}
 
-    // Configurazione indirizzo server
-    struct sockaddr_in server = {0};
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8080);
-    server.sin_addr.s_addr = INADDR_ANY;
+// Stack dal pool del thread o, se vuoto, da un nuovo mapping. Solo lo stack
+// effettivamente usato occupa memoria; la pagina più bassa è di guardia, così
+// uno stack troppo piccolo causa un segfault invece di corrompere la memoria.
+// In *charge restituisce i byte già contati per lo stack.
+char *fiber_stack_alloc(fiber_thread_t *t, size_t *charge) {
+    if (t->pool) {
+        char *stack = t->pool;
+        t->pool = *fiber_stack_link(stack);
+        t->pool_size--;
+        *charge = *fiber_stack_charge(stack);
+        return stack;
+    }
+    char *stack = mmap(NULL, fiber_stack_size + fiber_page_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        return NULL;
+    }
+    mprotect(stack, fiber_page_size, PROT_NONE);
+    // La fibra tocca subito la pagina più alta; il resto si conta a fine fibra
+    *charge = fiber_page_size;
+    mem_charge(MEM_STACKS, fiber_page_size);
+    return stack;
+}
 
-    // Binding del socket
-    if (bind(server_socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
-        perror("bind");
-        close(server_socket);
-        exit(EXIT_FAILURE);
+// Restituisce uno stack al pool (oltre FIBER_POOL_MAX lo libera). Le pagine
+// toccate dalla fibra oltre quelle già contate (charge) si contano ora.
+void fiber_stack_free(fiber_thread_t *t, char *stack, size_t charge) {
+    size_t resident = fiber_stack_resident(stack);
+    mem_charge(MEM_STACKS, (long)resident - (long)charge);
+    if (t->pool_size >= FIBER_POOL_MAX) {
+        munmap(stack, fiber_stack_size + fiber_page_size);
+        mem_charge(MEM_STACKS, -(long)resident);
+        return;
     }
-    printf("[SERVER] Bind effettuato sulla porta 8080\n");
+    *fiber_stack_charge(stack) = resident;
+    *fiber_stack_link(stack) = t->pool;
+    t->pool = stack;
+    t->pool_size++;
+}
 
-    // Inizio ascolto connessioni
-    if (listen(server_socket, CLIENTS_LIMIT) < 0) {
-        perror("listen");
-        close(server_socket);
-        exit(EXIT_FAILURE);
+// Accoda una fibra tra quelle pronte
+void fiber_make_ready(fiber_thread_t *t, fiber_t *f) {
+    f->next = NULL;
+    if (t->ready_tail) {
+        t->ready_tail->next = f;
+    } else {
+        t->ready = f;
     }
-    printf("[SERVER] In ascolto per connessioni...\n");
+    t->ready_tail = f;
+}
+
+// Punto di ingresso di ogni fibra: esegue fn e torna al loop del thread (uc_link)
+void fiber_entry(void) {
+    fiber_t *f = fiber_self->current;
+    f->fn(f->arg);
+    f->done = 1;
+}
 
-    struct sockaddr_in player1_struct, player2_struct;
-    socklen_t len_struct = sizeof(struct sockaddr_in);
+// Prepara le fibre consegnate da altri thread (0 se non ce n'erano)
+int fiber_take_incoming(fiber_thread_t *t) {
+    pthread_mutex_lock(&t->lock);
+    fiber_t *batch = t->incoming;
+    t->incoming = NULL;
+    pthread_mutex_unlock(&t->lock);
 
-    // Loop principale del server
-    while (1) {
-        printf("[SERVER] In attesa di connessioni...\n");
-        
-        // Accetta connessione da un client
-        int client_socket = accept(server_socket, (struct sockaddr *)&player1_struct, &len_struct);
-        if (client_socket < 0) {
-            printf("[SERVER] Errore nell'accettare la connessione\n");
-            continue;
+    int count = 0;
+    while (batch) {
+        fiber_t *f = batch;
+        batch = batch->next;
+        f->stack = fiber_stack_alloc(t, &f->stack_charge);
+        if (!f->stack) {
+            perror("[FIBER] stack");
+            exit(EXIT_FAILURE);
         }
-        printf("[SERVER] Nuova connessione accettata\n");
+        getcontext(&f->context);
+        f->context.uc_stack.ss_sp = f->stack + fiber_page_size;
+        f->context.uc_stack.ss_size = fiber_stack_size;
+        f->context.uc_link = &t->context;
+        makecontext(&f->context, fiber_entry, 0);
+        t->busy++;
+        fiber_make_ready(t, f);
+        count++;
+    }
+    return count;
+}
 
-        // Ricevi il flag iniziale dal client
-        int initial_flag;
-        if (recv(client_socket, &initial_flag, sizeof(int), 0) <= 0) {
-            printf("[SERVER] Errore nella ricezione del flag iniziale\n");
-            close(client_socket);
-            continue;
+// Esegue le fibre pronte finché non si fermano o terminano
+void fiber_run_ready(fiber_thread_t *t) {
+    while (t->ready) {
+        fiber_t *f = t->ready;
+        t->ready = f->next;
+        if (!t->ready) {
+            t->ready_tail = NULL;
         }
-        printf("[SERVER] Flag iniziale ricevuto: %d\n", initial_flag);
+        t->current = f;
+        swapcontext(&t->context, &f->context);
+        t->current = NULL;
+        if (f->done) {
+            t->busy--;
+            fiber_stack_free(t, f->stack, f->stack_charge);
+            mem_charge(MEM_GAMES, -(long)sizeof(fiber_t));
+            free(f);
+        }
+    }
+}
 
-        // Gestione stanze private
-        if (initial_flag == CREATE_PRIVATE) {
-            printf("[SERVER] Richiesta creazione stanza privata\n");
-            player_t *creator = receive_player(client_socket);
-            if (!creator) {
-                printf("[SERVER] Errore nella ricezione del creatore\n");
-                close(client_socket);
-                continue;
-            }
+// Ferma la fibra corrente finché fd non è pronto per events (EPOLLIN o EPOLLOUT).
+// safe_point = 1 se lo stato della partita è coerente e può essere trasferito
+// da un aggiornamento a caldo. Restituisce -1 se chiamata fuori da una fibra.
+int fiber_wait(int fd, uint32_t events, int safe_point) {
+    fiber_t *f = fiber_current();
+    if (!f) {
+        return -1;
+    }
+    fiber_thread_t *t = f->thread;
+    struct epoll_event ev = {0};
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = f;
+    // Il socket resta registrato tra un'attesa e l'altra: basta riarmarlo
+    if (epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+        (errno != ENOENT || epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)) {
+        return -1;
+    }
+    f->waiting = safe_point;
+    t->busy -= safe_point;
+    swapcontext(&f->context, &t->context);
+    t->busy += safe_point;
+    f->waiting = 0;
+    return 0;
+}
 
-            // Crea una nuova stanza privata
-            int room_id = generate_unique_room_id();
-            private_room_t *room = malloc(sizeof(private_room_t));
-            room->id = room_id;
-            room->creator = creator;
-            add_private_room(room);
+// Loop di un thread delle fibre
+void *fiber_thread_main(void *arg) {
+    fiber_thread_t *t = (fiber_thread_t *)arg;
+    struct epoll_event events[FIBER_MAX_EVENTS];
+    fiber_self = t;
 
-            // Comunica l'ID della stanza al creatore
-            int net_room_id = htonl(room_id);
-            send(creator->socket, &PRIVATE_CREATED, sizeof(int), 0);
-            send(creator->socket, &net_room_id, sizeof(int), 0);
-            printf("[SERVER] Stanza privata %d creata da %s\n", room_id, creator->name);
-            continue;
-        } 
-        else if (initial_flag == JOIN_PRIVATE) {
-            printf("[SERVER] Richiesta di unione a stanza privata\n");
-            int net_room_id;
-            recv(client_socket, &net_room_id, sizeof(int), 0);
-            int room_id = ntohl(net_room_id);
-            printf("[SERVER] Tentativo di unione a stanza %d\n", room_id);
+    while (RUNNING) {
+        fiber_run_ready(t);
 
-            player_t *joiner = receive_player(client_socket);
-            if (!joiner) {
-                printf("[SERVER] Errore nella ricezione del giocatore\n");
-                close(client_socket);
-                continue;
+        // Aggiornamento a caldo: ci si ferma quando tutte le fibre sono in sosta
+        if (upgrade_pending() && t->busy == 0 && !fiber_take_incoming(t)) {
+            upgrade_park(&t->parked, NULL);
+            // Aggiornamento annullato: ripartono le fibre risvegliate nel frattempo
+            while (t->deferred) {
+                fiber_t *f = t->deferred;
+                t->deferred = f->next;
+                fiber_make_ready(t, f);
             }
+            continue;
+        }
 
-            private_room_t *room = find_room_by_id(room_id);
-            if (!room) {
-                printf("[SERVER] Stanza %d non trovata\n", room_id);
-                send(joiner->socket, &JOIN_REJECTED, sizeof(int), 0);
-                delete_player(joiner);
+        int n = epoll_wait(t->epoll_fd, events, FIBER_MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &upgrade_fd) {
+                continue; // Lo stato dell'aggiornamento si controlla a ogni giro
+            }
+            if (ptr == NULL) {
+                uint64_t count;
+                if (read(t->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    perror("read eventfd");
+                }
+                fiber_take_incoming(t);
                 continue;
             }
-
-            // Invia richiesta di join al creatore della stanza
-            printf("[SERVER] Invio richiesta di join a %s\n", room->creator->name);
-            int req = JOIN_REQUEST;
-            int name_len = htons(joiner->name_len);
-            send(room->creator->socket, &req, sizeof(int), 0);
-            send(room->creator->socket, &name_len, sizeof(int), 0);
-            send(room->creator->socket, joiner->name, joiner->name_len, 0);
-
-            // Attendi risposta dal creatore
-            int response;
-            recv(room->creator->socket, &response, sizeof(int), 0);
-
-            if (response == JOIN_ACCEPTED) {
-                printf("[SERVER] Join accettato per %s\n", joiner->name);
-                send(joiner->socket, &JOIN_ACCEPTED, sizeof(int), 0);
-                
-                // Crea un thread per la partita
-                pthread_t thread_id;
-                pthread_create(&thread_id, NULL, game_function, create_game(room->creator, joiner));
-                pthread_detach(thread_id);
-                
-                // Rimuovi la stanza (ora la partita è iniziata)
-                remove_room_by_id(room_id);
+            fiber_t *f = (fiber_t *)ptr;
+            if (f->waiting && upgrade_pending()) {
+                f->next = t->deferred;
+                t->deferred = f;
             } else {
-                printf("[SERVER] Join rifiutato per %s\n", joiner->name);
-                send(joiner->socket, &JOIN_REJECTED, sizeof(int), 0);
-                delete_player(joiner);
-            }
-            continue;
-        } 
-        else {
-            // Modalità gioco normale (non privata)
-            printf("[SERVER] Modalità gioco normale\n");
-            player_t *player1 = receive_player(client_socket);
-            if (!player1) {
-                printf("[SERVER] Errore nella ricezione del giocatore 1\n");
-                close(client_socket);
-                continue;
+                fiber_make_ready(t, f);
             }
+        }
+    }
+    return NULL;
+}
 
-            printf("[SERVER] Giocatore 1 connesso: %s\n", player1->name);
-            send(player1->socket, &WAIT_FLAG, sizeof(int), 0);
-            printf("[SERVER] In attesa del secondo giocatore...\n");
+// Avvia i thread delle fibre (uno per CPU, o TRIS_FIBER_THREADS)
+void fiber_init(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = env_int("TRIS_FIBER_THREADS", cpus < 1 ? 1 : (int)cpus);
+    fiber_n_threads = threads > FIBER_MAX_THREADS ? FIBER_MAX_THREADS : threads;
 
-            // Accetta connessione dal secondo giocatore
-            int player2_socket = accept(server_socket, (struct sockaddr *)&player2_struct, &len_struct);
-            if (player2_socket < 0) {
-                printf("[SERVER] Errore nell'accettare il secondo giocatore\n");
-                delete_player(player1);
-                continue;
-            }
+    int stack_kb = env_int("TRIS_FIBER_STACK_KB", FIBER_STACK_KB);
+    stack_kb = stack_kb < FIBER_STACK_MIN_KB ? FIBER_STACK_MIN_KB
+             : stack_kb > FIBER_STACK_MAX_KB ? FIBER_STACK_MAX_KB : stack_kb;
+    fiber_stack_size = (size_t)stack_kb * 1024;
+    fiber_page_size = sysconf(_SC_PAGESIZE);
 
-            // Verifica che il secondo client sia un giocatore (non una richiesta speciale)
-            int second_flag;
-            if (recv(player2_socket, &second_flag, sizeof(int), 0) <= 0 || second_flag != NO_FLAG) {
-                printf("[SERVER] Secondo client non valido\n");
-                delete_player(player1);
-                close(player2_socket);
-                continue;
-            }
+    for (int i = 0; i < fiber_n_threads; ++i) {
+        fiber_thread_t *t = &fiber_threads[i];
+        t->epoll_fd = epoll_create1(0);
+        t->wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (t->epoll_fd < 0 || t->wake_fd < 0) {
+            perror("fiber");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&t->lock, NULL);
 
-            player_t *player2 = receive_player(player2_socket);
-            if (!player2) {
-                printf("[SERVER] Errore nella ricezione del giocatore 2\n");
-                delete_player(player1);
-                close(player2_socket);
-                continue;
-            }
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->wake_fd, &ev);
+        // Edge-triggered: l'eventfd resta leggibile per tutto l'aggiornamento
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &upgrade_fd;
+        epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &ev);
+
+        pthread_create(&t->thread, NULL, fiber_thread_main, t);
+        pthread_detach(t->thread);
+    }
+    printf("[FIBER] Avviati %d thread, stack da %d KB\n", fiber_n_threads, stack_kb);
+}
+
+// Crea una fibra che esegue fn(arg) su uno dei thread (chiamabile da qualsiasi thread)
+void fiber_spawn(void *(*fn)(void *), void *arg) {
+    pthread_once(&fiber_once, fiber_init);
+    int next = __atomic_fetch_add(&fiber_next_thread, 1, __ATOMIC_RELAXED);
+    fiber_thread_t *t = &fiber_threads[next % fiber_n_threads];
+
+    fiber_t *f = calloc(1, sizeof(fiber_t));
+    mem_charge(MEM_GAMES, sizeof(fiber_t));
+    f->fn = fn;
+    f->arg = arg;
+    f->thread = t;
+    pthread_mutex_lock(&t->lock);
+    f->next = t->incoming;
+    t->incoming = f;
+    pthread_mutex_unlock(&t->lock);
+
+    uint64_t one = 1;
+    if (write(t->wake_fd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+}
 
-            printf("[SERVER] Giocatore 2 connesso: %s\n", player2->name);
-            
-            // Crea un thread per la partita
-            pthread_t thread_id;
-            pthread_create(&thread_id, NULL, game_function, create_game(player1, player2));
-            pthread_detach(thread_id);
-            printf("[SERVER] Partita avviata tra %s e %s\n", player1->name, player2->name);
+// ======================= MESSAGGI COMPOSTI =======================
+
+// Buffer per comporre un messaggio e spedirlo con una sola send
+typedef struct msg_t {
+    size_t len;          // Byte già scritti
+    int overflow;        // 1 se il messaggio non entra nel buffer
+    char data[MSG_MAX];  // Contenuto del messaggio
+} msg_t;
+
+void msg_init(msg_t *msg) {
+    msg->len = 0;
+    msg->overflow = 0;
+}
+
+// Accoda byte grezzi al messaggio
+void msg_put(msg_t *msg, const void *src, size_t n) {
+    if (msg->len + n > MSG_MAX) {
+        msg->overflow = 1;
+        return;
+    }
+    memcpy(msg->data + msg->len, src, n);
+    msg->len += n;
+}
+
+// Accoda un flag (i flag viaggiano nell'ordine dell'host, come nel resto del protocollo)
+void msg_put_flag(msg_t *msg, int flag) {
+    msg_put(msg, &flag, sizeof(int));
+}
+
+// Accoda un intero in network byte order
+void msg_put_int(msg_t *msg, int value) {
+    int net_value = htonl(value);
+    msg_put(msg, &net_value, sizeof(int));
+}
+
+// Accoda una lunghezza codificata come nel resto del protocollo (htons su un int)
+void msg_put_len(msg_t *msg, int len) {
+    int net_len = htons(len);
+    msg_put(msg, &net_len, sizeof(int));
+}
+
+// Accoda un flag seguito dalla griglia
+void msg_put_board(msg_t *msg, int flag, const char *table) {
+    msg_put_flag(msg, flag);
+    msg_put(msg, table, GRID_SIZE * sizeof(char));
+}
+
+// Invia tutto il buffer, bloccando se necessario (0 = ok, -1 = errore).
+// Su una fibra il socket non è bloccante: se il buffer è pieno la fibra
+// cede il controllo finché il socket non torna scrivibile.
+int send_all(int socket, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t sent = send(socket, p, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && fiber_current()) {
+            if (fiber_wait(socket, EPOLLOUT, 0) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+// Invia un messaggio senza bloccare: un client che non legge
+// viene trattato come disconnesso invece di fermare il chiamante
+int send_nonblocking(int socket, const msg_t *msg) {
+    if (msg->overflow) {
+        return -1;
+    }
+    ssize_t sent = send(socket, msg->data, msg->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return sent == (ssize_t)msg->len ? 0 : -1;
+}
+
+// ======================= CONFIGURAZIONE TORNEI =======================
+
+// Formati di torneo
+enum {
+    FORMAT_SWISS,       // Sistema svizzero
+    FORMAT_ROUND_ROBIN  // Girone all'italiana (tutti contro tutti)
+};
+
+// Configurazione dei tornei (letta dalle variabili d'ambiente)
+typedef struct tournament_config_t {
+    int format;            // TRIS_TOURNAMENT_FORMAT=swiss|roundrobin
+    int capacity;          // TRIS_TOURNAMENT_SIZE
+    int rounds;            // TRIS_TOURNAMENT_ROUNDS (0 = automatico)
+    int registration_secs; // TRIS_TOURNAMENT_REGISTRATION
+    int move_timeout;      // TRIS_TOURNAMENT_MOVE_TIMEOUT
+} tournament_config_t;
+
+tournament_config_t tournament_config = {FORMAT_SWISS, 256, 0, 60, 60};
+
+// Carica la configurazione dei tornei
+void tournament_load_config(void) {
+    const char *format = getenv("TRIS_TOURNAMENT_FORMAT");
+    if (format && strcmp(format, "roundrobin") == 0) {
+        tournament_config.format = FORMAT_ROUND_ROBIN;
+    }
+    tournament_config.capacity = env_int("TRIS_TOURNAMENT_SIZE", tournament_config.capacity);
+    if (tournament_config.capacity < 2) {
+        tournament_config.capacity = 2;
+    }
+    tournament_config.rounds = env_int("TRIS_TOURNAMENT_ROUNDS", tournament_config.rounds);
+    tournament_config.registration_secs =
+        env_int("TRIS_TOURNAMENT_REGISTRATION", tournament_config.registration_secs);
+    tournament_config.move_timeout =
+        env_int("TRIS_TOURNAMENT_MOVE_TIMEOUT", tournament_config.move_timeout);
+    printf("[TORNEO] Formato %s, %d posti, iscrizioni aperte per %d s\n",
+           tournament_config.format == FORMAT_SWISS ? "svizzero" : "girone",
+           tournament_config.capacity, tournament_config.registration_secs);
+}
+
+// ======================= STATISTICHE GIOCATORI =======================
+// Statistiche per nome giocatore in una hash map divisa in shard, ognuno
+// con il proprio lock. Le scritture avvengono a fine partita; le letture
+// non prendono lock: le voci non vengono mai rimosse e ciascuna è protetta
+// da un seqlock. La classifica usa un indice per punteggio (una lista per
+// ogni valore di rating) da cui si ricava, solo quando cambia, la top-K
+// pubblicata anch'essa con un seqlock. Uno snapshot compatto viene
+// scritto periodicamente su disco e ricaricato all'avvio.
+
+#define STATS_SHARDS 64             // Shard della hash map (potenza di 2)
+#define STATS_BUCKETS 256           // Bucket per shard (potenza di 2)
+#define STATS_INITIAL_RATING 1200   // Rating Elo iniziale
+#define STATS_MAX_RATING 4000       // Rating massimo (escluso)
+#define STATS_ELO_K 32              // Fattore K dell'Elo
+#define STATS_ELO_RANGE 800         // Oltre questa differenza il risultato atteso non cambia
+#define STATS_TOP_K 50              // Righe massime della classifica
+#define STATS_MAGIC 0x41545354      // "TSTA"
+#define STATS_VERSION 1             // Versione del file di snapshot
+#define STATS_DEFAULT_PATH "tris_stats.bin"
+
+// Contatori di un giocatore (protetti dal seqlock della voce)
+typedef struct stats_counts_t {
+    int wins;                     // Vittorie
+    int losses;                   // Sconfitte
+    int draws;                    // Pareggi
+    int streak;                   // >0 vittorie consecutive, <0 sconfitte consecutive
+    int best_streak;              // Serie di vittorie più lunga
+    int rating;                   // Rating Elo
+} stats_counts_t;
+
+// Statistiche di un giocatore
+typedef struct stats_entry_t {
+    char name[MAX_NAME_LEN + 1];  // Nome (chiave, non cambia dopo la creazione)
+    unsigned seq;                 // Seqlock: dispari durante una scrittura
+    stats_counts_t counts;        // Contatori
+    struct stats_entry_t *next;   // Catena del bucket
+    struct stats_entry_t *rank_prev, *rank_next; // Lista del rating nell'indice
+} stats_entry_t;
+
+// Shard della hash map
+typedef struct stats_shard_t {
+    pthread_mutex_t lock;                    // Serializza le scritture
+    stats_entry_t *buckets[STATS_BUCKETS];   // Catene (lette senza lock)
+} stats_shard_t;
+
+// Riga della classifica pubblicata
+typedef struct stats_row_t {
+    char name[MAX_NAME_LEN + 1];
+    int rating, wins, losses, draws;
+} stats_row_t;
+
+// Classifica pubblicata con seqlock
+typedef struct stats_board_t {
+    unsigned seq;                     // Seqlock della classifica
+    int count;                        // Righe valide
+    int threshold;                    // Rating dell'ultima riga
+    stats_row_t rows[STATS_TOP_K];    // Righe in ordine di rating
+} stats_board_t;
+
+stats_shard_t stats_shards[STATS_SHARDS];
+stats_entry_t *stats_by_rating[STATS_MAX_RATING];   // Indice: liste per rating
+pthread_mutex_t stats_index_lock = PTHREAD_MUTEX_INITIALIZER;
+stats_board_t stats_board;
+double stats_expected[2 * STATS_ELO_RANGE + 1]; // Risultato atteso per differenza di rating
+unsigned stats_version = 0;        // Incrementato a ogni modifica
+const char *stats_path = STATS_DEFAULT_PATH; // TRIS_STATS
+int stats_snapshot_secs = 30;      // TRIS_STATS_SNAPSHOT
+pthread_mutex_t stats_save_lock = PTHREAD_MUTEX_INITIALIZER; // Un solo snapshot alla volta (e stats_path)
+
+// Seqlock: lo scrittore (unico, protetto da un lock) rende dispari il
+// contatore durante la modifica; il lettore riprova se lo trova cambiato.
+// I dati protetti si copiano solo con seq_store_words e seq_load_words.
+void seq_write_begin(unsigned *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+}
+
+void seq_write_end(unsigned *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+unsigned seq_read_begin(const unsigned *seq) {
+    unsigned value;
+    while ((value = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+        // Scrittura in corso: dura poche istruzioni
+    }
+    return value;
+}
+
+int seq_read_retry(const unsigned *seq, unsigned start) {
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+// Copiano i dati di un seqlock una parola alla volta (size multiplo di
+// sizeof(unsigned)). Ogni parola è un accesso atomico, quindi un lettore
+// concorrente a una scrittura non è una data race. Le store in rilascio e
+// le load in acquisizione restano tra le due letture del contatore senza
+// barriere separate; su x86 sono normali mov.
+void seq_store_words(void *dst, const void *src, size_t size) {
+    unsigned *to = dst;
+    for (size_t i = 0; i < size / sizeof(unsigned); ++i) {
+        unsigned word;
+        memcpy(&word, (const char *)src + i * sizeof(unsigned), sizeof(unsigned));
+        __atomic_store_n(&to[i], word, __ATOMIC_RELEASE);
+    }
+}
+
+void seq_load_words(void *dst, const void *src, size_t size) {
+    const unsigned *from = src;
+    for (size_t i = 0; i < size / sizeof(unsigned); ++i) {
+        unsigned word = __atomic_load_n(&from[i], __ATOMIC_ACQUIRE);
+        memcpy((char *)dst + i * sizeof(unsigned), &word, sizeof(unsigned));
+    }
+}
+
+// Hash FNV-1a del nome. Come chiave vale solo la parte che stats_create
+// conserva, cioè i primi MAX_NAME_LEN caratteri.
+uint32_t stats_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < MAX_NAME_LEN && name[i]; ++i) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Cerca una voce senza lock (NULL se il giocatore non ha statistiche)
+stats_entry_t *stats_find(const char *name) {
+    uint32_t hash = stats_hash(name);
+    stats_shard_t *shard = &stats_shards[hash % STATS_SHARDS];
+    stats_entry_t *entry = __atomic_load_n(&shard->buckets[(hash / STATS_SHARDS) % STATS_BUCKETS],
+                                           __ATOMIC_ACQUIRE);
+    for (; entry; entry = entry->next) {
+        if (strncmp(entry->name, name, MAX_NAME_LEN) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Copia coerente dei contatori di una voce (senza lock)
+void stats_read(const stats_entry_t *entry, stats_counts_t *copy) {
+    unsigned start;
+    do {
+        start = seq_read_begin(&entry->seq);
+        seq_load_words(copy, &entry->counts, sizeof(stats_counts_t));
+    } while (seq_read_retry(&entry->seq, start));
+}
+
+// Inserisce o sposta una voce nell'indice per rating (con stats_index_lock)
+void stats_index_unlink(stats_entry_t *entry) {
+    if (entry->rank_prev) {
+        entry->rank_prev->rank_next = entry->rank_next;
+    } else {
+        stats_by_rating[entry->counts.rating] = entry->rank_next;
+    }
+    if (entry->rank_next) {
+        entry->rank_next->rank_prev = entry->rank_prev;
+    }
+}
+
+void stats_index_link(stats_entry_t *entry) {
+    entry->rank_prev = NULL;
+    entry->rank_next = stats_by_rating[entry->counts.rating];
+    if (entry->rank_next) {
+        entry->rank_next->rank_prev = entry;
+    }
+    stats_by_rating[entry->counts.rating] = entry;
+}
+
+// Ricava la top-K dall'indice e la pubblica (con stats_index_lock).
+// Scorre i rating dall'alto e si ferma dopo STATS_TOP_K voci.
+void stats_publish_board(void) {
+    seq_write_begin(&stats_board.seq);
+    int count = 0, threshold = 0;
+    for (int rating = STATS_MAX_RATING - 1; rating >= 0 && count < STATS_TOP_K; --rating) {
+        for (stats_entry_t *e = stats_by_rating[rating]; e && count < STATS_TOP_K; e = e->rank_next) {
+            stats_row_t row;
+            memcpy(row.name, e->name, sizeof(row.name));
+            row.rating = e->counts.rating;
+            row.wins = e->counts.wins;
+            row.losses = e->counts.losses;
+            row.draws = e->counts.draws;
+            seq_store_words(&stats_board.rows[count++], &row, sizeof(stats_row_t));
+            threshold = row.rating;
+        }
+    }
+    __atomic_store_n(&stats_board.count, count, __ATOMIC_RELEASE);
+    stats_board.threshold = threshold; // Letta solo con stats_index_lock
+    seq_write_end(&stats_board.seq);
+}
+
+// Crea la voce di un giocatore (con il lock del suo shard)
+stats_entry_t *stats_create(stats_shard_t *shard, uint32_t hash, const char *name) {
+    stats_entry_t *entry = calloc(1, sizeof(stats_entry_t));
+    mem_charge(MEM_STATS, sizeof(stats_entry_t)); // Le voci restano fino all'uscita
+    strncpy(entry->name, name, MAX_NAME_LEN);
+    entry->counts.rating = STATS_INITIAL_RATING;
+
+    pthread_mutex_lock(&stats_index_lock);
+    stats_index_link(entry);
+    pthread_mutex_unlock(&stats_index_lock);
+
+    // Pubblicata per ultima: chi legge senza lock la vede già completa
+    stats_entry_t **bucket = &shard->buckets[(hash / STATS_SHARDS) % STATS_BUCKETS];
+    entry->next = *bucket;
+    __atomic_store_n(bucket, entry, __ATOMIC_RELEASE);
+    return entry;
+}
+
+// Voce di un giocatore, creata se manca (con il lock del suo shard)
+stats_entry_t *stats_get_locked(const char *name) {
+    stats_entry_t *entry = stats_find(name);
+    if (!entry) {
+        uint32_t hash = stats_hash(name);
+        entry = stats_create(&stats_shards[hash % STATS_SHARDS], hash, name);
+    }
+    return entry;
+}
+
+// Pubblica nuovi contatori per una voce (un solo scrittore alla volta)
+void stats_store(stats_entry_t *entry, const stats_counts_t *counts) {
+    seq_write_begin(&entry->seq);
+    seq_store_words(&entry->counts, counts, sizeof(stats_counts_t));
+    seq_write_end(&entry->seq);
+}
+
+// Aggiorna una voce con l'esito (score2: 2 = vittoria, 1 = pareggio, 0 = sconfitta)
+void stats_apply(stats_entry_t *entry, int score2, int rating) {
+    stats_counts_t counts = entry->counts;
+    if (score2 == 2) {
+        counts.wins++;
+        counts.streak = counts.streak > 0 ? counts.streak + 1 : 1;
+        if (counts.streak > counts.best_streak) {
+            counts.best_streak = counts.streak;
+        }
+    } else if (score2 == 0) {
+        counts.losses++;
+        counts.streak = counts.streak < 0 ? counts.streak - 1 : -1;
+    } else {
+        counts.draws++;
+        counts.streak = 0;
+    }
+    counts.rating = rating;
+    stats_store(entry, &counts);
+}
+
+// Nuovo rating Elo dato il rating avversario e il punteggio x2
+int stats_elo(int rating, int opponent, int score2) {
+    int diff = rating - opponent;
+    diff = diff < -STATS_ELO_RANGE ? -STATS_ELO_RANGE : diff > STATS_ELO_RANGE ? STATS_ELO_RANGE : diff;
+    double delta = STATS_ELO_K * (score2 / 2.0 - stats_expected[STATS_ELO_RANGE + diff]);
+    int updated = rating + (int)(delta >= 0 ? delta + 0.5 : delta - 0.5);
+    return updated < 0 ? 0 : updated >= STATS_MAX_RATING ? STATS_MAX_RATING - 1 : updated;
+}
+
+// Registra l'esito di una partita (result come check_win)
+void stats_record_game(const char *name1, const char *name2, int result) {
+    if (strncmp(name1, name2, MAX_NAME_LEN) == 0) {
+        return; // Stesso nome: la partita non conta
+    }
+    int shard1 = stats_hash(name1) % STATS_SHARDS;
+    int shard2 = stats_hash(name2) % STATS_SHARDS;
+    // Lock in ordine di indice per evitare deadlock tra partite concorrenti
+    int first = shard1 < shard2 ? shard1 : shard2;
+    int second = shard1 < shard2 ? shard2 : shard1;
+    pthread_mutex_lock(&stats_shards[first].lock);
+    if (second != first) {
+        pthread_mutex_lock(&stats_shards[second].lock);
+    }
+
+    stats_entry_t *e1 = stats_get_locked(name1);
+    stats_entry_t *e2 = stats_get_locked(name2);
+    int score1 = result == PLAYER1_WIN ? 2 : result == GAME_DRAW ? 1 : 0;
+    int old1 = e1->counts.rating, old2 = e2->counts.rating;
+
+    pthread_mutex_lock(&stats_index_lock);
+    stats_index_unlink(e1);
+    stats_index_unlink(e2);
+    stats_apply(e1, score1, stats_elo(old1, old2, score1));
+    stats_apply(e2, 2 - score1, stats_elo(old2, old1, 2 - score1));
+    stats_index_link(e1);
+    stats_index_link(e2);
+    // La classifica va ricalcolata solo se i due giocatori ne fanno o ne facevano parte
+    int threshold = stats_board.threshold;
+    if (stats_board.count < STATS_TOP_K || old1 >= threshold || old2 >= threshold ||
+        e1->counts.rating >= threshold || e2->counts.rating >= threshold) {
+        stats_publish_board();
+    }
+    pthread_mutex_unlock(&stats_index_lock);
+
+    if (second != first) {
+        pthread_mutex_unlock(&stats_shards[second].lock);
+    }
+    pthread_mutex_unlock(&stats_shards[first].lock);
+    __atomic_add_fetch(&stats_version, 1, __ATOMIC_RELAXED);
+}
+
+// Copia della classifica pubblicata (senza lock)
+int stats_read_board(stats_row_t *rows, int k) {
+    unsigned start;
+    int count;
+    do {
+        start = seq_read_begin(&stats_board.seq);
+        count = __atomic_load_n(&stats_board.count, __ATOMIC_ACQUIRE);
+        count = count < k ? count : k;
+        seq_load_words(rows, stats_board.rows, count * sizeof(stats_row_t));
+    } while (seq_read_retry(&stats_board.seq, start));
+    return count;
+}
+
+// Invia a un giocatore le sue statistiche e le prime k righe della classifica
+void stats_send_leaderboard(player_t *player, int k) {
+    if (k <= 0 || k > STATS_TOP_K) {
+        k = STATS_TOP_K;
+    }
+    stats_row_t rows[STATS_TOP_K];
+    int count = stats_read_board(rows, k);
+
+    stats_counts_t own = {0};
+    stats_entry_t *entry = stats_find(player->name);
+    if (entry) {
+        stats_read(entry, &own);
+    }
+
+    msg_t msg;
+    msg_init(&msg);
+    msg_put_flag(&msg, LEADERBOARD);
+    msg_put_int(&msg, entry != NULL);
+    msg_put_int(&msg, entry ? own.rating : STATS_INITIAL_RATING);
+    msg_put_int(&msg, own.wins);
+    msg_put_int(&msg, own.losses);
+    msg_put_int(&msg, own.draws);
+    msg_put_int(&msg, own.streak);
+    msg_put_int(&msg, own.best_streak);
+    msg_put_int(&msg, count);
+    for (int i = 0; i < count; ++i) {
+        int name_len = strlen(rows[i].name);
+        msg_put_int(&msg, rows[i].rating);
+        msg_put_int(&msg, rows[i].wins);
+        msg_put_int(&msg, rows[i].losses);
+        msg_put_int(&msg, rows[i].draws);
+        msg_put_len(&msg, name_len);
+        msg_put(&msg, rows[i].name, name_len);
+    }
+    if (msg.overflow || send_all(player->socket, msg.data, msg.len) < 0) {
+        printf("[STATS] Invio classifica a %s fallito\n", player->name);
+    }
+}
+
+// Scrive lo snapshot compatto su disco (file temporaneo + rename).
+// Legge le voci senza lock, quindi non ferma le partite in corso; il
+// thread degli snapshot, l'aggiornamento a caldo e SIGTERM condividono
+// però il file temporaneo, per cui gli snapshot sono serializzati.
+void stats_save(void) {
+    char tmp_path[512];
+    pthread_mutex_lock(&stats_save_lock);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", stats_path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        perror("[STATS] snapshot");
+        pthread_mutex_unlock(&stats_save_lock);
+        return;
+    }
+    unsigned version = __atomic_load_n(&stats_version, __ATOMIC_RELAXED);
+    int32_t header[3] = {STATS_MAGIC, STATS_VERSION, 0};
+    fwrite(header, sizeof(header), 1, file);
+
+    int32_t count = 0;
+    for (int s = 0; s < STATS_SHARDS; ++s) {
+        for (int b = 0; b < STATS_BUCKETS; ++b) {
+            stats_entry_t *entry = __atomic_load_n(&stats_shards[s].buckets[b], __ATOMIC_ACQUIRE);
+            for (; entry; entry = entry->next) {
+                stats_counts_t copy;
+                stats_read(entry, &copy);
+                uint8_t name_len = strlen(entry->name);
+                int32_t fields[6] = {copy.rating, copy.wins, copy.losses, copy.draws,
+                                     copy.streak, copy.best_streak};
+                fwrite(&name_len, 1, 1, file);
+                fwrite(entry->name, 1, name_len, file);
+                fwrite(fields, sizeof(fields), 1, file);
+                count++;
+            }
+        }
+    }
+    header[2] = count;
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, file);
+    if (fclose(file) != 0 || rename(tmp_path, stats_path) < 0) {
+        perror("[STATS] snapshot");
+        pthread_mutex_unlock(&stats_save_lock);
+        return;
+    }
+    printf("[STATS] Snapshot di %d giocatori scritto su %s (versione %u)\n", count, stats_path, version);
+    pthread_mutex_unlock(&stats_save_lock);
+}
+
+// Carica lo snapshot all'avvio
+void stats_load(void) {
+    FILE *file = fopen(stats_path, "rb");
+    if (!file) {
+        return;
+    }
+    int32_t header[3];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != STATS_MAGIC ||
+        header[1] != STATS_VERSION) {
+        printf("[STATS] Snapshot %s non valido, ignorato\n", stats_path);
+        fclose(file);
+        return;
+    }
+    int loaded = 0;
+    for (int i = 0; i < header[2]; ++i) {
+        uint8_t name_len;
+        char name[256];
+        int32_t fields[6];
+        if (fread(&name_len, 1, 1, file) != 1 || fread(name, 1, name_len, file) != name_len ||
+            fread(fields, sizeof(fields), 1, file) != 1) {
+            break;
+        }
+        name[name_len] = '\0';
+        if (name_len > MAX_NAME_LEN || fields[0] < 0 || fields[0] >= STATS_MAX_RATING ||
+            stats_find(name)) {
+            continue;
+        }
+        uint32_t hash = stats_hash(name);
+        stats_entry_t *entry = stats_create(&stats_shards[hash % STATS_SHARDS], hash, name);
+        stats_counts_t counts = {fields[1], fields[2], fields[3], fields[4], fields[5], fields[0]};
+        pthread_mutex_lock(&stats_index_lock);
+        stats_index_unlink(entry);
+        stats_store(entry, &counts);
+        stats_index_link(entry);
+        pthread_mutex_unlock(&stats_index_lock);
+        loaded++;
+    }
+    fclose(file);
+
+    pthread_mutex_lock(&stats_index_lock);
+    stats_publish_board();
+    pthread_mutex_unlock(&stats_index_lock);
+    printf("[STATS] Caricate le statistiche di %d giocatori da %s\n", loaded, stats_path);
+}
+
+// Thread che scrive lo snapshot a intervalli regolari se qualcosa è cambiato
+void *stats_snapshot_main(void *arg) {
+    (void)arg;
+    unsigned saved = __atomic_load_n(&stats_version, __ATOMIC_RELAXED);
+    while (RUNNING) {
+        sleep(stats_snapshot_secs);
+        unsigned version = __atomic_load_n(&stats_version, __ATOMIC_RELAXED);
+        if (version != saved) {
+            stats_save();
+            saved = version;
+        }
+    }
+    return NULL;
+}
+
+// Inizializza gli shard e, se richiesto, carica lo snapshot
+void stats_init(int load) {
+    // Il thread dei segnali è già attivo e può chiamare stats_save
+    const char *path = getenv("TRIS_STATS");
+    pthread_mutex_lock(&stats_save_lock);
+    if (path && *path) {
+        stats_path = path;
+    }
+    pthread_mutex_unlock(&stats_save_lock);
+    stats_snapshot_secs = env_int("TRIS_STATS_SNAPSHOT", stats_snapshot_secs);
+    for (int i = 0; i < STATS_SHARDS; ++i) {
+        pthread_mutex_init(&stats_shards[i].lock, NULL);
+    }
+
+    // 1 / (1 + 10^(-d/400)) con le potenze di 10^(1/400) calcolate per prodotti successivi
+    double power = 1.0;
+    for (int d = 0; d <= STATS_ELO_RANGE; ++d) {
+        stats_expected[STATS_ELO_RANGE + d] = power / (1.0 + power);
+        stats_expected[STATS_ELO_RANGE - d] = 1.0 / (1.0 + power);
+        power *= 1.0057730630017383;
+    }
+    if (load) {
+        stats_load();
+    }
+
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, stats_snapshot_main, NULL);
+    pthread_detach(thread_id);
+}
+
+// ======================= TRACCIAMENTO LATENZE =======================
+// Span temporizzati per partita e per mossa, esportati nel formato JSON
+// di Chrome/Perfetto (chrome://tracing, ui.perfetto.dev).
+//
+// Ogni thread scrive in un proprio buffer circolare senza lock; un thread
+// dedicato svuota periodicamente i buffer nel file. Il file è un array
+// JSON senza la parentesi di chiusura, che i visualizzatori accettano:
+// così resta leggibile anche se il server termina all'improvviso.
+//
+// TRIS_TRACE=percorso attiva il tracciamento all'avvio, TRIS_TRACE_SAMPLE=N
+// traccia una partita ogni N. SIGUSR2 lo attiva/disattiva a runtime.
+
+#define TRACE_BUFFER_SIZE 1024   // Span per buffer di thread (potenza di 2)
+#define TRACE_FLUSH_MS 200       // Intervallo di scrittura su file
+#define TRACE_DEFAULT_PATH "tris_trace.json"
+
+// Span registrato da un thread
+typedef struct trace_span_t {
+    const char *name;   // Nome dello span (stringa statica)
+    int game_id;        // Partita a cui appartiene
+    int move;           // Numero della mossa (-1 se non pertinente)
+    uint64_t start;     // Inizio (ns, CLOCK_MONOTONIC)
+    uint64_t end;       // Fine (ns, CLOCK_MONOTONIC)
+} trace_span_t;
+
+// Buffer circolare di un thread (un produttore, un consumatore)
+typedef struct trace_buffer_t {
+    int tid;                        // ID del thread nel sistema
+    const char *label;              // Nome del thread (argomento di ogni span)
+    int closed;                     // 1 quando il thread è terminato
+    uint64_t dropped;               // Span persi perché il buffer era pieno
+    unsigned head;                  // Prossima posizione da scrivere
+    unsigned tail;                  // Prossima posizione da leggere
+    trace_span_t spans[TRACE_BUFFER_SIZE];
+    struct trace_buffer_t *next;    // Lista globale dei buffer
+} trace_buffer_t;
+
+volatile sig_atomic_t trace_enabled = 0;  // Tracciamento attivo
+int trace_sample_every = 1;               // Una partita tracciata ogni N
+unsigned trace_sample_counter = 0;
+const char *trace_path = TRACE_DEFAULT_PATH;
+int64_t trace_realtime_offset = 0;        // CLOCK_REALTIME - CLOCK_MONOTONIC (ns)
+
+trace_buffer_t *trace_buffers = NULL;     // Buffer registrati
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t trace_key;                  // Segnala la fine del thread
+__thread trace_buffer_t *trace_local = NULL;
+__thread const char *trace_thread_label = "game";
+
+// Istante corrente in nanosecondi
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Marca il buffer come chiuso quando il thread termina
+void trace_thread_exit(void *arg) {
+    trace_buffer_t *buffer = (trace_buffer_t *)arg;
+    __atomic_store_n(&buffer->closed, 1, __ATOMIC_RELEASE);
+}
+
+// Buffer del thread corrente (creato al primo span)
+trace_buffer_t *trace_buffer(void) {
+    if (trace_local) {
+        return trace_local;
+    }
+    trace_buffer_t *buffer = calloc(1, sizeof(trace_buffer_t));
+    buffer->tid = (int)syscall(SYS_gettid);
+    buffer->label = trace_thread_label;
+    pthread_setspecific(trace_key, buffer);
+
+    pthread_mutex_lock(&trace_lock);
+    buffer->next = trace_buffers;
+    trace_buffers = buffer;
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_local = buffer;
+    return buffer;
+}
+
+// Dà un nome al thread corrente nella traccia
+void trace_set_thread_label(const char *label) {
+    trace_thread_label = label;
+}
+
+// Registra uno span
+void trace_span(const char *name, int game_id, int move, uint64_t start, uint64_t end) {
+    trace_buffer_t *buffer = trace_buffer();
+    unsigned head = buffer->head;
+    if (head - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) >= TRACE_BUFFER_SIZE) {
+        __atomic_fetch_add(&buffer->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    trace_span_t *span = &buffer->spans[head & (TRACE_BUFFER_SIZE - 1)];
+    if (end < start) {
+        end = start; // Timestamp del kernel leggermente sfasati rispetto al nostro clock
+    }
+    span->name = name;
+    span->game_id = game_id;
+    span->move = move;
+    span->start = start;
+    span->end = end;
+    __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Decide se tracciare una nuova partita (campionamento 1 su N)
+int trace_sample(void) {
+    if (!trace_enabled) {
+        return 0;
+    }
+    unsigned n = __atomic_fetch_add(&trace_sample_counter, 1, __ATOMIC_RELAXED);
+    return n % trace_sample_every == 0;
+}
+
+// Converte un timestamp del kernel (CLOCK_REALTIME) nel clock della traccia
+uint64_t trace_from_realtime(const struct timespec *ts) {
+    int64_t realtime = (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+    return (uint64_t)(realtime - trace_realtime_offset);
+}
+
+// Chiede al kernel l'istante di arrivo dei pacchetti (usato per lo span "queue")
+void trace_enable_socket(int socket) {
+    int on = 1;
+    setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+}
+
+// recv che restituisce anche l'istante di arrivo del dato nel kernel (0 se ignoto)
+ssize_t trace_recv(int socket, void *buf, size_t len, int flags, uint64_t *arrival) {
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = {buf, len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *arrival = 0;
+    ssize_t n = recvmsg(socket, &msg, flags);
+    capture_data(socket, buf, n);
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); n > 0 && c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            *arrival = trace_from_realtime(&ts);
+        }
+    }
+    return n;
+}
+
+// Scrive su file gli span accumulati e libera i buffer dei thread terminati
+void trace_flush(FILE **file) {
+    pthread_mutex_lock(&trace_lock);
+    trace_buffer_t **link = &trace_buffers;
+    while (*link) {
+        trace_buffer_t *buffer = *link;
+        int closed = __atomic_load_n(&buffer->closed, __ATOMIC_ACQUIRE);
+        unsigned head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+        unsigned tail = buffer->tail;
+
+        if (head != tail && !*file) {
+            *file = fopen(trace_path, "w");
+            if (!*file) {
+                perror("fopen trace");
+                trace_enabled = 0;
+                break;
+            }
+            fprintf(*file, "[\n");
+            printf("[TRACE] Scrittura traccia su %s\n", trace_path);
+        }
+        // Una traccia per partita: un worker o un thread di fibre alterna molte
+        // partite, i cui span sulla traccia del thread si sovrapporrebbero senza
+        // annidarsi. Il thread resta come argomento dello span.
+        for (; tail != head; ++tail) {
+            trace_span_t *span = &buffer->spans[tail & (TRACE_BUFFER_SIZE - 1)];
+            if (strcmp(span->name, "game") == 0) {
+                fprintf(*file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"name\":\"partita %d\"}},\n",
+                        getpid(), span->game_id, span->game_id);
+            }
+            fprintf(*file, "{\"name\":\"%s\",\"cat\":\"tris\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"game\":%d,\"move\":%d,\"thread\":\"%s-%d\"}},\n",
+                    span->name, span->start / 1000.0, (span->end - span->start) / 1000.0,
+                    getpid(), span->game_id, span->game_id, span->move, buffer->label, buffer->tid);
+        }
+        __atomic_store_n(&buffer->tail, tail, __ATOMIC_RELEASE);
+
+        // Il contatore è incrementato dal thread proprietario anche durante lo svuotamento
+        uint64_t dropped = __atomic_exchange_n(&buffer->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            printf("[TRACE] Thread %d: %llu span persi (buffer pieno)\n",
+                   buffer->tid, (unsigned long long)dropped);
+        }
+        if (closed && tail == __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE)) {
+            *link = buffer->next;
+            free(buffer);
+            continue;
+        }
+        link = &buffer->next;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    if (*file) {
+        fflush(*file);
+    }
+}
+
+FILE *trace_file = NULL;
+
+// Thread di scrittura della traccia
+void *trace_writer_main(void *arg) {
+    (void)arg;
+    while (RUNNING) {
+        usleep(TRACE_FLUSH_MS * 1000);
+        trace_flush(&trace_file);
+    }
+    return NULL;
+}
+
+// Attiva o disattiva il tracciamento (SIGUSR2)
+void trace_toggle(void) {
+    trace_enabled = !trace_enabled;
+    printf("[TRACE] Tracciamento %s (1 partita ogni %d)\n",
+           trace_enabled ? "attivato" : "disattivato", trace_sample_every);
+}
+
+// Configura il tracciamento e avvia il thread di scrittura
+void trace_init(void) {
+    struct timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    trace_realtime_offset = ((int64_t)realtime.tv_sec - monotonic.tv_sec) * 1000000000LL +
+                            (realtime.tv_nsec - monotonic.tv_nsec);
+
+    pthread_key_create(&trace_key, trace_thread_exit);
+    trace_sample_every = env_int("TRIS_TRACE_SAMPLE", 1);
+    const char *path = getenv("TRIS_TRACE");
+    if (path && *path) {
+        trace_path = path;
+        trace_enabled = 1;
+        printf("[TRACE] Tracciamento attivo su %s (1 partita ogni %d)\n",
+               trace_path, trace_sample_every);
+    }
+
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, trace_writer_main, NULL);
+    pthread_detach(thread_id);
+}
+
+// Misura una sezione solo se la partita è tracciata
+#define TRACE_BEGIN(traced) ((traced) ? trace_now() : 0)
+#define TRACE_END(traced, name, game_id, move, start)                    \
+    do {                                                                 \
+        if (traced) {                                                    \
+            trace_span((name), (game_id), (move), (start), trace_now()); \
+        }                                                                \
+    } while (0)
+
+// Invia flag e griglia con una sola send, tracciando serializzazione e invio
+int send_board(int socket, int flag, const char *table, int traced, int game_id, int move) {
+    uint64_t start = TRACE_BEGIN(traced);
+    msg_t msg;
+    msg_init(&msg);
+    msg_put_board(&msg, flag, table);
+    TRACE_END(traced, "serialize", game_id, move, start);
+
+    start = TRACE_BEGIN(traced);
+    int result = send_all(socket, msg.data, msg.len);
+    TRACE_END(traced, "send", game_id, move, start);
+    return result;
+}
+
+// Comunica l'esito finale ai due giocatori
+void send_result(player_t *player1, player_t *player2, uint8_t win_flag, const char *table,
+                 int traced, int game_id, int move) {
+    int flag1 = win_flag == PLAYER1_WIN ? WIN_FLAG : win_flag == PLAYER2_WIN ? LOSE_FLAG : DRAW_FLAG;
+    int flag2 = win_flag == PLAYER1_WIN ? LOSE_FLAG : win_flag == PLAYER2_WIN ? WIN_FLAG : DRAW_FLAG;
+    send_board(player1->socket, flag1, table, traced, game_id, move);
+    send_board(player2->socket, flag2, table, traced, game_id, move);
+}
+
+// Comunica a un giocatore inizio, ID, nome dell'avversario, simbolo e codice
+// di ripresa con un solo messaggio. Tenuta fuori da game_function perché il
+// buffer del messaggio non si sommi sullo stack della fibra a quello di send_board.
+void send_start(player_t *player, player_t *opponent, int game_id, char symbol, uint32_t token) {
+    msg_t msg;
+    msg_init(&msg);
+    msg_put_flag(&msg, START_FLAG);
+    msg_put_int(&msg, game_id);
+    msg_put_len(&msg, opponent->name_len);
+    msg_put(&msg, opponent->name, opponent->name_len);
+    msg_put(&msg, &symbol, sizeof(char));
+    msg_put_int(&msg, (int)token);
+    send_all(player->socket, msg.data, msg.len);
+}
+
+// Riceve i 4 byte di una mossa da un socket non bloccante. Restituisce 0 se
+// non è ancora arrivato nulla, -1 se il giocatore si è disconnesso. Una mossa
+// arrivata solo in parte viene completata cedendo la fibra.
+ssize_t recv_move(int socket, int *move, uint64_t *arrival) {
+    char *p = (char *)move;
+    size_t got = 0;
+    while (got < sizeof(int)) {
+        ssize_t n = arrival && got == 0
+            ? trace_recv(socket, p, sizeof(int), MSG_DONTWAIT, arrival)
+            : capture_recv(socket, p + got, sizeof(int) - got, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (got == 0) {
+                return 0;
+            }
+            if (fiber_wait(socket, EPOLLIN, 0) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+    return got;
+}
+
+// Funzione principale del gioco (eseguita su una fibra, vedi FIBRE)
+void *game_function(void *arg) {
+    game_t *game = (game_t *)arg;
+    player_t *player1 = game->player1;
+    player_t *player2 = game->player2;
+    int game_id = game->game_id;
+    int traced = trace_sample();
+    uint64_t game_start = TRACE_BEGIN(traced);
+
+    printf("[GAME] Partita [%d] %s tra %s e %s%s\n", game_id,
+           game->resumed ? "ripresa" : "iniziata", player1->name, player2->name,
+           traced ? " (tracciata)" : "");
+    if (traced) {
+        trace_enable_socket(player1->socket);
+        trace_enable_socket(player2->socket);
+    }
+    // Le attese sui socket diventano cessioni della fibra (vedi FIBRE)
+    fcntl(player1->socket, F_SETFL, fcntl(player1->socket, F_GETFL) | O_NONBLOCK);
+    fcntl(player2->socket, F_SETFL, fcntl(player2->socket, F_GETFL) | O_NONBLOCK);
+
+    // Una partita ripresa dopo un aggiornamento a caldo ha già comunicato
+    // inizio, nomi e simboli, e il turno corrente è già stato annunciato
+    if (!game->resumed) {
+        printf("[GAME] Assegnazione simboli: %s=X, %s=O\n",
+               player1->name, player2->name);
+        send_start(player1, player2, game_id, 'X', game->tokens[0]);
+        send_start(player2, player1, game_id, 'O', game->tokens[1]);
+    }
+
+    // La griglia è inizializzata da create_game
+    char *table = game->table;
+
+    // Loop principale del gioco: a ogni giro muove il giocatore di turno
+    printf("[GAME] Inizio loop di gioco\n");
+    player_t *players[2] = {player1, player2};
+    const char symbols[2] = {'X', 'O'};
+    do {
+        int turn = game->turn;
+        int move_count = game->move_count;
+        player_t *mover = players[turn];
+        player_t *other = players[!turn];
+        uint8_t win_flag;
+        int move;
+
+        printf("[GAME] Turno di %s (%c)\n", mover->name, symbols[turn]);
+        uint64_t move_start = TRACE_BEGIN(traced);
+
+        // Comunica al giocatore di turno che tocca a lui e all'altro che deve attendere
+        // tranne a chi lo sa già perché la partita è stata ripresa
+        if (!game->resumed || (game->resync & (1 << turn))) {
+            send_board(mover->socket, YOUR_MOVE_FLAG, table, traced, game_id, move_count);
+        }
+        if (!game->resumed || (game->resync & (1 << !turn))) {
+            send_board(other->socket, OPPONENT_MOVE_FLAG, table, traced, game_id, move_count);
+        }
+        game->resumed = 0;
+        game->resync = 0;
+
+        // Ricevi la mossa (ripetuta finché non è valida)
+        uint64_t wait_start = TRACE_BEGIN(traced);
+        uint64_t arrival = 0;
+        ssize_t received;
+        while (1) {
+            if (wait_for_move(mover->socket) < 0) {
+                received = -1;
+                break;
+            }
+            uint64_t recv_start = TRACE_BEGIN(traced);
+            received = recv_move(mover->socket, &move, traced ? &arrival : NULL);
+            if (received == 0) {
+                continue; // Risveglio senza dati: si torna in attesa
+            }
+            if (received < 0) {
+                break;
+            }
+            if (traced) {
+                // L'attesa va dall'invio del turno all'arrivo nel kernel, la coda
+                // dall'arrivo alla lettura da parte del server
+                uint64_t ready = arrival && arrival < recv_start ? arrival : recv_start;
+                trace_span("wait_move", game_id, move_count, wait_start, ready);
+                trace_span("queue", game_id, move_count, ready < wait_start ? wait_start : ready, recv_start);
+                trace_span("recv", game_id, move_count, recv_start, trace_now());
+            }
+
+            uint64_t validate_start = TRACE_BEGIN(traced);
+            move = ntohs(move);
+            int valid = move >= 0 && move < GRID_SIZE && table[move] == ' ';
+            TRACE_END(traced, "validate", game_id, move_count, validate_start);
+            if (valid) {
+                break;
+            }
+            printf("[GAME] Mossa non valida da %s: %d\n", mover->name, move);
+            send_board(mover->socket, YOUR_MOVE_FLAG, table, traced, game_id, move_count);
+            wait_start = TRACE_BEGIN(traced);
+        }
+        if (received < 0) {
+            printf("[ERRORE] Ricezione mossa da %s fallita\n", mover->name);
+            // Chi abbandona la partita la perde
+            stats_record_game(player1->name, player2->name, turn ? PLAYER1_WIN : PLAYER2_WIN);
+            break;
+        }
+        printf("[GAME] %s ha mosso in posizione %d\n", mover->name, move);
+
+        uint64_t update_start = TRACE_BEGIN(traced);
+        table[move] = symbols[turn];
+        arena_commit_move(game->arena_slot, move, symbols[turn]);
+        TRACE_END(traced, "update", game_id, move_count, update_start);
+
+        // Invia aggiornamento a entrambi i giocatori
+        send_board(player1->socket, OPPONENT_MOVE_FLAG, table, traced, game_id, move_count);
+        send_board(player2->socket, OPPONENT_MOVE_FLAG, table, traced, game_id, move_count);
+
+        // Controlla stato del gioco
+        uint64_t check_start = TRACE_BEGIN(traced);
+        win_flag = check_win(table);
+        TRACE_END(traced, "check_win", game_id, move_count, check_start);
+        printf("[GAME] Stato dopo mossa: %d\n", win_flag);
+
+        // Gestisci fine partita
+        if (win_flag != GAME_NOT_OVER) {
+            if (win_flag == GAME_DRAW) {
+                printf("[GAME] Pareggio!\n");
+            } else {
+                printf("[GAME] %s ha vinto!\n", win_flag == PLAYER1_WIN ? player1->name : player2->name);
+            }
+            send_result(player1, player2, win_flag, table, traced, game_id, move_count);
+            stats_record_game(player1->name, player2->name, win_flag);
+            TRACE_END(traced, "move", game_id, move_count, move_start);
+            break;
+        }
+        TRACE_END(traced, "move", game_id, move_count, move_start);
+
+        game->turn = !turn;
+        game->move_count++;
+    } while (RUNNING);
+
+    TRACE_END(traced, "game", game_id, -1, game_start);
+    printf("[GAME] Partita [%d] terminata\n", game_id);
+    live_game_remove(game);
+    arena_release(game->arena_slot);
+    delete_game(game);
+    return NULL;
+}
+
+int arena_save_game(game_t *game);
+
+// Avvia la fibra di una partita e la registra tra quelle in corso
+void start_game_fiber(game_t *game) {
+    if (game->arena_slot < 0) {
+        game->arena_slot = arena_save_game(game);
+    }
+    // I giocatori che hanno chiesto UDP passano al trasporto UDP
+    udp_attach(game->player1);
+    udp_attach(game->player2);
+    live_game_add(game);
+    fiber_spawn(game_function, game);
+}
+
+// ======================= CATTURA DEL TRAFFICO =======================
+// Registra i byte ricevuti da ogni connessione, con l'istante di arrivo,
+// per riprodurre il traffico reale su un server locale (vedi replay/).
+// Si attiva con TRIS_CAPTURE=percorso; senza, ogni recv costa un confronto.
+//
+// Formato del file: "TRISCAP1" seguito da record
+//   tipo (1 byte), µs dal record precedente (varint), connessione (varint)
+//   CAPTURE_DATA: lunghezza (varint) e byte ricevuti
+//   CAPTURE_ROOM: ID della stanza creata dalla connessione (varint)
+// Gli ID delle stanze sono casuali: il replay li usa per tradurre
+// le richieste JOIN_PRIVATE negli ID assegnati dal nuovo server.
+//
+// I record finiscono in un buffer in memoria, scritto su file da un thread
+// dedicato ogni CAPTURE_FLUSH_MS. Dopo un aggiornamento a caldo il nuovo
+// processo scrive su percorso.<pid> e registra solo le nuove connessioni.
+
+#define CAPTURE_MAGIC "TRISCAP1"
+#define CAPTURE_FLUSH_MS 200       // Intervallo di scrittura su file
+
+// Tipi di record
+enum {
+    CAPTURE_OPEN = 1,   // Connessione accettata
+    CAPTURE_DATA = 2,   // Byte ricevuti
+    CAPTURE_CLOSE = 3,  // Connessione chiusa dal client
+    CAPTURE_ROOM = 4    // Stanza privata creata
+};
+
+int capture_enabled = 0;               // 1 se la cattura è attiva
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+char *capture_buffer = NULL;           // Record non ancora scritti
+size_t capture_len = 0;
+size_t capture_cap = 0;
+uint64_t capture_last = 0;             // Istante dell'ultimo record (ns)
+int *capture_conns = NULL;             // Connessione associata a ogni socket (0 = nessuna)
+int capture_n_conns = 0;
+int capture_next_conn = 1;
+FILE *capture_file = NULL;
+
+// Accoda byte al buffer (con capture_lock)
+void capture_put(const void *src, size_t n) {
+    if (capture_len + n > capture_cap) {
+        size_t old_cap = capture_cap;
+        while (capture_len + n > capture_cap) {
+            capture_cap = capture_cap ? capture_cap * 2 : 65536;
+        }
+        capture_buffer = realloc(capture_buffer, capture_cap);
+        mem_charge(MEM_BUFFERS, (long)(capture_cap - old_cap));
+    }
+    memcpy(capture_buffer + capture_len, src, n);
+    capture_len += n;
+}
+
+// Accoda un intero senza segno in 7 bit per byte (con capture_lock)
+void capture_put_varint(uint64_t value) {
+    uint8_t bytes[10];
+    int n = 0;
+    do {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            bytes[n] |= 0x80;
+        }
+        n++;
+    } while (value);
+    capture_put(bytes, n);
+}
+
+// Accoda l'intestazione di un record (con capture_lock)
+void capture_put_header(int type, int conn) {
+    uint64_t now = trace_now();
+    uint8_t t = type;
+    capture_put(&t, 1);
+    capture_put_varint(capture_last ? (now - capture_last) / 1000 : 0);
+    capture_put_varint(conn);
+    capture_last = now;
+}
+
+// Connessione associata al socket (con capture_lock, 0 se non registrata)
+int capture_conn(int socket) {
+    return socket >= 0 && socket < capture_n_conns ? capture_conns[socket] : 0;
+}
+
+// Registra una connessione appena accettata
+void capture_open(int socket) {
+    if (!capture_enabled || socket < 0) {
+        return;
+    }
+    pthread_mutex_lock(&capture_lock);
+    if (socket >= capture_n_conns) {
+        int n = capture_n_conns ? capture_n_conns : 256;
+        while (n <= socket) {
+            n *= 2;
+        }
+        capture_conns = realloc(capture_conns, n * sizeof(int));
+        memset(capture_conns + capture_n_conns, 0, (n - capture_n_conns) * sizeof(int));
+        capture_n_conns = n;
+    }
+    capture_conns[socket] = capture_next_conn++;
+    capture_put_header(CAPTURE_OPEN, capture_conns[socket]);
+    pthread_mutex_unlock(&capture_lock);
+}
+
+// Dimentica il socket: il descrittore ora è interno e non va registrato
+void capture_forget(int socket) {
+    if (!capture_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&capture_lock);
+    if (capture_conn(socket)) {
+        capture_conns[socket] = 0;
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+// Registra l'esito di una recv: dati ricevuti o chiusura del client
+void capture_data(int socket, const void *buf, ssize_t n) {
+    if (!capture_enabled) {
+        return;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    int saved_errno = errno;
+    pthread_mutex_lock(&capture_lock);
+    int conn = capture_conn(socket);
+    if (conn && n > 0) {
+        capture_put_header(CAPTURE_DATA, conn);
+        capture_put_varint(n);
+        capture_put(buf, n);
+    } else if (conn) {
+        capture_put_header(CAPTURE_CLOSE, conn);
+        capture_conns[socket] = 0;
+    }
+    pthread_mutex_unlock(&capture_lock);
+    errno = saved_errno;
+}
+
+// recv con registrazione dei byte ricevuti
+ssize_t capture_recv(int socket, void *buf, size_t len, int flags) {
+    ssize_t n = recv(socket, buf, len, flags);
+    capture_data(socket, buf, n);
+    return n;
+}
+
+// Registra l'ID della stanza privata creata dalla connessione
+void capture_room(int socket, int room_id) {
+    if (!capture_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&capture_lock);
+    int conn = capture_conn(socket);
+    if (conn) {
+        capture_put_header(CAPTURE_ROOM, conn);
+        capture_put_varint(room_id);
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+// Scrive su file i record accumulati
+void capture_flush(void) {
+    // Chiamata anche dal thread dei segnali, avviato prima di capture_init
+    if (!__atomic_load_n(&capture_enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&capture_lock);
+    char *data = capture_buffer;
+    size_t len = capture_len;
+    size_t cap = capture_cap;
+    capture_buffer = NULL;
+    capture_len = capture_cap = 0;
+    pthread_mutex_unlock(&capture_lock);
+
+    if (len > 0 && fwrite(data, 1, len, capture_file) != len) {
+        perror("fwrite capture");
+    }
+    fflush(capture_file);
+    free(data);
+    mem_charge(MEM_BUFFERS, -(long)cap);
+}
+
+// Thread di scrittura della cattura
+void *capture_writer_main(void *arg) {
+    (void)arg;
+    while (RUNNING) {
+        usleep(CAPTURE_FLUSH_MS * 1000);
+        capture_flush();
+    }
+    return NULL;
+}
+
+// Apre il file di cattura se richiesto (takeover = subentro a caldo)
+void capture_init(int takeover) {
+    const char *path = getenv("TRIS_CAPTURE");
+    if (!path || !*path) {
+        return;
+    }
+    char takeover_path[512];
+    if (takeover) {
+        snprintf(takeover_path, sizeof(takeover_path), "%s.%d", path, getpid());
+        path = takeover_path;
+    }
+    capture_file = fopen(path, "wb");
+    if (!capture_file) {
+        perror("fopen capture");
+        return;
+    }
+    fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), capture_file);
+    __atomic_store_n(&capture_enabled, 1, __ATOMIC_RELEASE);
+    printf("[CAPTURE] Cattura del traffico in ingresso su %s\n", path);
+
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, capture_writer_main, NULL);
+    pthread_detach(thread_id);
+}
+
+// ======================= STANZE APERTE =======================
+// Elenco delle stanze private aperte per i client iscritti. All'iscrizione
+// il client riceve lo stato completo, poi solo le stanze aggiunte e rimosse,
+// raccolte per LOBBY_TICK_MS. Ogni aggiornamento è codificato una volta e
+// lo stesso buffer va a tutti gli iscritti: il costo cresce con le modifiche,
+// non con iscritti × stanze.
+//
+// Le stanze cambiano solo nel thread principale, che accoda le modifiche.
+// Il thread della lobby le applica a una propria copia dell'elenco, da cui
+// prende lo stato completo per i nuovi iscritti: ogni modifica successiva
+// arriva comunque a tutti gli iscritti, quindi non serve un lock su
+// private_rooms.
+
+#define LOBBY_TICK_MS 200      // Intervallo di raccolta delle modifiche
+#define LOBBY_MAX_EVENTS 64    // Eventi letti per ogni epoll_wait
+
+// Operazioni su una stanza
+enum {
+    LOBBY_ADD,    // Stanza aperta
+    LOBBY_REMOVE  // Stanza chiusa
+};
+
+// Stanza nell'elenco della lobby (o modifica in attesa)
+typedef struct lobby_room_t {
+    int op;                         // LOBBY_ADD o LOBBY_REMOVE (solo per le modifiche)
+    int id;                         // ID della stanza
+    int name_len;                   // Lunghezza del nome del creatore
+    char name[MAX_NAME_LEN + 1];    // Nome del creatore
+} lobby_room_t;
+
+// Client iscritto
+typedef struct lobby_subscriber_t {
+    player_t *player;                       // Giocatore e socket
+    struct lobby_subscriber_t *prev, *next; // Lista degli iscritti
+} lobby_subscriber_t;
+
+pthread_mutex_t lobby_lock = PTHREAD_MUTEX_INITIALIZER; // Protegge modifiche e nuovi iscritti
+lobby_room_t *lobby_pending = NULL;     // Modifiche non ancora inviate
+int lobby_n_pending = 0;
+int lobby_cap_pending = 0;
+lobby_subscriber_t *lobby_incoming = NULL; // Iscritti in attesa dello stato completo
+lobby_room_t lobby_rooms[MAX_ROOMS];    // Copia dell'elenco (solo thread della lobby)
+int lobby_n_rooms = 0;
+lobby_subscriber_t *lobby_subscribers = NULL; // Iscritti attivi (solo thread della lobby)
+int lobby_epoll_fd = -1;
+int lobby_wake_fd = -1;
+int lobby_parked = 0;                   // 1 se fermo per un aggiornamento a caldo
+
+// Accoda l'apertura o la chiusura di una stanza (thread principale)
+void lobby_publish(int op, int id, const player_t *creator) {
+    if (lobby_wake_fd < 0) {
+        return;
+    }
+    lobby_room_t change = {op, id, 0, ""};
+    if (creator) {
+        change.name_len = creator->name_len > MAX_NAME_LEN ? MAX_NAME_LEN : creator->name_len;
+        memcpy(change.name, creator->name, change.name_len);
+    }
+
+    pthread_mutex_lock(&lobby_lock);
+    if (lobby_n_pending == lobby_cap_pending) {
+        int old_cap = lobby_cap_pending;
+        lobby_cap_pending = lobby_cap_pending ? lobby_cap_pending * 2 : 16;
+        lobby_pending = realloc(lobby_pending, lobby_cap_pending * sizeof(lobby_room_t));
+        mem_charge(MEM_BUFFERS, (long)(lobby_cap_pending - old_cap) * sizeof(lobby_room_t));
+    }
+    lobby_pending[lobby_n_pending++] = change;
+    int first = lobby_n_pending == 1;
+    pthread_mutex_unlock(&lobby_lock);
+
+    // La prima modifica avvia il conteggio del tick
+    uint64_t one = 1;
+    if (first && write(lobby_wake_fd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+}
+
+void lobby_room_opened(const private_room_t *room) {
+    lobby_publish(LOBBY_ADD, room->id, room->creator);
+}
+
+void lobby_room_closed(int id) {
+    lobby_publish(LOBBY_REMOVE, id, NULL);
+}
+
+// Iscrive un client alla lobby (il giocatore passa alla lobby)
+void lobby_subscribe(player_t *player) {
+    lobby_subscriber_t *sub = calloc(1, sizeof(lobby_subscriber_t));
+    sub->player = player;
+    pthread_mutex_lock(&lobby_lock);
+    sub->next = lobby_incoming;
+    lobby_incoming = sub;
+    pthread_mutex_unlock(&lobby_lock);
+
+    uint64_t one = 1;
+    if (write(lobby_wake_fd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+}
+
+// Accoda una stanza al messaggio
+void lobby_put_room(msg_t *msg, const lobby_room_t *room) {
+    msg_put_int(msg, room->id);
+    msg_put_len(msg, room->name_len);
+    msg_put(msg, room->name, room->name_len);
+}
+
+// Stato completo: numero di stanze e, per ognuna, ID e creatore
+void lobby_encode_snapshot(msg_t *msg) {
+    msg_init(msg);
+    msg_put_flag(msg, LOBBY_SNAPSHOT);
+    msg_put_int(msg, lobby_n_rooms);
+    for (int i = 0; i < lobby_n_rooms; ++i) {
+        lobby_put_room(msg, &lobby_rooms[i]);
+    }
+}
+
+// Toglie un iscritto e chiude la sua connessione
+void lobby_drop(lobby_subscriber_t *sub) {
+    if (sub->prev) {
+        sub->prev->next = sub->next;
+    } else {
+        lobby_subscribers = sub->next;
+    }
+    if (sub->next) {
+        sub->next->prev = sub->prev;
+    }
+    printf("[LOBBY] %s lascia la lobby\n", sub->player->name);
+    close(sub->player->socket);
+    delete_player(sub->player);
+    free(sub);
+}
+
+// Invia lo stesso messaggio a tutti gli iscritti. Chi non riesce a riceverlo
+// subito viene scollegato: un messaggio inviato a metà renderebbe illeggibili
+// i successivi, e ricollegandosi riceve di nuovo lo stato completo.
+void lobby_broadcast(const msg_t *msg) {
+    lobby_subscriber_t *sub = lobby_subscribers;
+    while (sub) {
+        lobby_subscriber_t *next = sub->next;
+        if (send_nonblocking(sub->player->socket, msg) < 0) {
+            lobby_drop(sub);
+        }
+        sub = next;
+    }
+}
+
+// Applica le modifiche accodate e le invia agli iscritti con un solo messaggio
+void lobby_flush(void) {
+    pthread_mutex_lock(&lobby_lock);
+    lobby_room_t *changes = lobby_pending;
+    int n_changes = lobby_n_pending;
+    int cap_changes = lobby_cap_pending;
+    lobby_pending = NULL;
+    lobby_n_pending = lobby_cap_pending = 0;
+    pthread_mutex_unlock(&lobby_lock);
+    if (n_changes == 0) {
+        return;
+    }
+
+    // Una stanza aperta e chiusa nello stesso tick non viene mai inviata
+    int n_ops = 0;
+    for (int i = 0; i < n_changes; ++i) {
+        lobby_room_t *c = &changes[i];
+        if (c->op == LOBBY_ADD) {
+            if (lobby_n_rooms < MAX_ROOMS) {
+                lobby_rooms[lobby_n_rooms++] = *c;
+            }
+            changes[n_ops++] = *c;
+            continue;
+        }
+        for (int r = 0; r < lobby_n_rooms; ++r) {
+            if (lobby_rooms[r].id == c->id) {
+                lobby_rooms[r] = lobby_rooms[--lobby_n_rooms];
+                break;
+            }
+        }
+        int cancelled = 0;
+        for (int j = n_ops - 1; j >= 0; --j) {
+            if (changes[j].id == c->id) {
+                if (changes[j].op == LOBBY_ADD) {
+                    memmove(&changes[j], &changes[j + 1], (n_ops - j - 1) * sizeof(lobby_room_t));
+                    n_ops--;
+                    cancelled = 1;
+                }
+                break;
+            }
+        }
+        if (!cancelled) {
+            changes[n_ops++] = *c;
+        }
+    }
+
+    if (n_ops > 0 && lobby_subscribers) {
+        msg_t msg;
+        msg_init(&msg);
+        msg_put_flag(&msg, LOBBY_UPDATE);
+        msg_put_int(&msg, n_ops);
+        for (int i = 0; i < n_ops; ++i) {
+            msg_put_int(&msg, changes[i].op);
+            if (changes[i].op == LOBBY_ADD) {
+                lobby_put_room(&msg, &changes[i]);
+            } else {
+                msg_put_int(&msg, changes[i].id);
+            }
+        }
+        // Troppe modifiche per un messaggio: si invia di nuovo lo stato completo
+        if (msg.overflow) {
+            lobby_encode_snapshot(&msg);
+        }
+        lobby_broadcast(&msg);
+        printf("[LOBBY] %d modifiche inviate\n", n_ops);
+    }
+    free(changes);
+    mem_charge(MEM_BUFFERS, -(long)cap_changes * sizeof(lobby_room_t));
+}
+
+// Invia lo stato completo ai nuovi iscritti e li aggiunge alla lista
+void lobby_accept_incoming(void) {
+    pthread_mutex_lock(&lobby_lock);
+    lobby_subscriber_t *batch = lobby_incoming;
+    lobby_incoming = NULL;
+    pthread_mutex_unlock(&lobby_lock);
+    if (!batch) {
+        return;
+    }
+
+    // Le modifiche in attesa partono subito: lo stato completo per i nuovi
+    // iscritti le include già e gli altri le ricevono prima di quelle successive
+    lobby_flush();
+    msg_t msg;
+    lobby_encode_snapshot(&msg);
+    while (batch) {
+        lobby_subscriber_t *sub = batch;
+        batch = batch->next;
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = sub;
+        if (send_nonblocking(sub->player->socket, &msg) < 0 ||
+            epoll_ctl(lobby_epoll_fd, EPOLL_CTL_ADD, sub->player->socket, &ev) < 0) {
+            close(sub->player->socket);
+            delete_player(sub->player);
+            free(sub);
+            continue;
+        }
+        printf("[LOBBY] %s iscritto alla lobby (%d stanze)\n", sub->player->name, lobby_n_rooms);
+        sub->prev = NULL;
+        sub->next = lobby_subscribers;
+        if (lobby_subscribers) {
+            lobby_subscribers->prev = sub;
+        }
+        lobby_subscribers = sub;
+    }
+}
+
+// Loop del thread della lobby
+void *lobby_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[LOBBY_MAX_EVENTS];
+    trace_set_thread_label("lobby");
+    uint64_t flush_at = 0; // Istante del prossimo invio (0 = nessuna modifica in attesa)
+
+    while (RUNNING) {
+        int timeout = -1;
+        if (flush_at) {
+            uint64_t now = trace_now();
+            timeout = now >= flush_at ? 0 : (int)((flush_at - now) / 1000000) + 1;
+        }
+        int n = epoll_wait(lobby_epoll_fd, events, LOBBY_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &upgrade_fd) {
+                if (upgrade_pending()) {
+                    upgrade_park(&lobby_parked, NULL);
+                }
+                continue;
+            }
+            if (ptr == NULL) {
+                uint64_t count;
+                if (read(lobby_wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    perror("read eventfd");
+                }
+                if (!flush_at) {
+                    flush_at = trace_now() + LOBBY_TICK_MS * 1000000ULL;
+                }
+                lobby_accept_incoming();
+                continue;
+            }
+            // Un iscritto non invia nulla: il socket diventa leggibile
+            // solo quando il client chiude la connessione per lasciare la lobby
+            lobby_drop((lobby_subscriber_t *)ptr);
+        }
+        if (flush_at && trace_now() >= flush_at) {
+            flush_at = 0;
+            lobby_flush();
+        }
+    }
+    return NULL;
+}
+
+// Avvia il thread della lobby
+void lobby_init(void) {
+    lobby_epoll_fd = epoll_create1(0);
+    lobby_wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (lobby_epoll_fd < 0 || lobby_wake_fd < 0) {
+        perror("lobby");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(lobby_epoll_fd, EPOLL_CTL_ADD, lobby_wake_fd, &ev);
+    ev.data.ptr = &upgrade_fd;
+    epoll_ctl(lobby_epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &ev);
+
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, lobby_main, NULL);
+    pthread_detach(thread_id);
+}
+
+// ======================= TRASPORTO UDP =======================
+// Trasporto opzionale per le partite casuali e private, pensato per reti
+// con perdite: su TCP un segmento perso blocca anche i messaggi successivi
+// finché non viene ritrasmesso, dopo almeno 200 ms.
+//
+// Il client chiede UDP premettendo UDP_REQUEST al flag iniziale e riceve su
+// TCP un token di sessione (UDP_TOKEN), che invia nel primo datagramma
+// (UDP_HELLO) per far conoscere il proprio indirizzo. All'avvio della
+// partita il socket del giocatore viene sostituito da un socketpair
+// SOCK_SEQPACKET: game_function non cambia e questo thread inoltra ogni
+// messaggio in un datagramma numerato, ritrasmesso dopo un RTO stimato dal
+// RTT finché il client non lo conferma. Le mosse fanno il percorso inverso.
+// I datagrammi si leggono e si inviano a blocchi con recvmmsg/sendmmsg.
+//
+// Ogni messaggio di gioco contiene la griglia completa: se i messaggi
+// restano senza conferma per UDP_RESYNC_AFTER ritrasmissioni, la coda viene
+// sostituita da un solo UDP_RESYNC con lo stato più recente. Se il client
+// tace per UDP_FALLBACK_MS lo stesso stato viene inviato su TCP e la
+// sessione prosegue su TCP. La connessione TCP resta aperta per tutta la
+// partita: se si chiude, la partita vede la disconnessione del giocatore.
+//
+// TRIS_UDP_LOSS=N scarta N datagrammi su 100, in ingresso e in uscita, come
+// la perdita di netem: serve a provare il trasporto in locale.
+
+#define UDP_HEADER 17           // Tipo (1 byte), token (8), seq (4), ack (4)
+#define UDP_PAYLOAD_MAX 128     // Messaggio più lungo (START con il nome: 62 byte)
+#define UDP_BATCH 64            // Datagrammi per recvmmsg/sendmmsg
+#define UDP_WINDOW 16           // Messaggi senza conferma per sessione
+#define UDP_RTO_INITIAL_MS 200  // RTO prima della prima misura del RTT
+#define UDP_RTO_MIN_MS 20
+#define UDP_RTO_MAX_MS 2000
+#define UDP_RESYNC_AFTER 3      // Ritrasmissioni prima di ridurre la coda allo stato
+#define UDP_FALLBACK_MS 5000    // Silenzio del client prima di tornare a TCP
+#define UDP_CLOSE_MS 5000       // Attesa delle ultime conferme a partita finita
+#define UDP_TICK_MS 10          // Controllo delle ritrasmissioni
+#define UDP_BUCKETS 1024        // Liste della tabella dei token
+
+// Tipi di datagramma
+enum {
+    UDP_HELLO = 1,   // Client: indirizzo della sessione
+    UDP_DATA = 2,    // Messaggio numerato
+    UDP_ACK = 3,     // Sola conferma
+    UDP_RESYNC = 4   // Stato completo: sostituisce i messaggi non confermati
+};
+
+// Stati di una sessione
+enum {
+    UDP_PENDING,  // Token assegnato, partita non ancora iniziata
+    UDP_ACTIVE,   // Partita in corso sul socketpair
+    UDP_CLOSING   // Partita finita: si attendono le ultime conferme
+};
+
+// Messaggio inviato e non ancora confermato
+typedef struct udp_message_t {
+    uint32_t seq;                // Numero di sequenza
+    int type;                    // UDP_DATA o UDP_RESYNC
+    int len;                     // Byte in data
+    uint64_t sent_at;            // Ultimo invio (0 = mai inviato)
+    int retransmitted;           // 1 se ritrasmesso: niente misura del RTT (Karn)
+    char data[UDP_PAYLOAD_MAX];  // Messaggio del protocollo
+} udp_message_t;
+
+// Socket osservato dal thread UDP per una sessione
+typedef struct udp_watch_t {
+    struct udp_session_t *session;
+    int tcp;                     // 1 = connessione di controllo, 0 = socketpair
+} udp_watch_t;
+
+typedef struct udp_session_t {
+    uint64_t token;              // Token comunicato su TCP
+    int state;                   // UDP_PENDING, UDP_ACTIVE o UDP_CLOSING
+    int tcp;                     // Connessione TCP di controllo (-1 finché in attesa)
+    int bridge;                  // Lato del socketpair letto da questo thread
+    int tcp_mode;                // 1 dopo il ritorno a TCP
+    struct sockaddr_in addr;     // Ultimo indirizzo UDP del client
+    int addr_known;              // 1 dopo il primo datagramma valido
+    uint64_t last_heard;         // Ultimo datagramma valido dal client
+    uint64_t waiting_since;      // Da quando la coda non è vuota
+    uint64_t deadline;           // Chiusura forzata (UDP_CLOSING)
+    uint32_t next_seq;           // Prossimo numero di sequenza in uscita
+    uint32_t expected;           // Prossimo numero di sequenza atteso dal client
+    udp_message_t queue[UDP_WINDOW]; // Messaggi non confermati, in ordine
+    int n_queue;
+    int timeouts;                // Scadenze consecutive senza conferme
+    uint64_t srtt, rttvar, rto;  // Stima del RTT e timeout di ritrasmissione (ns)
+    char start[UDP_PAYLOAD_MAX]; // Messaggio START, finché non è confermato
+    int start_len;
+    uint32_t start_seq;          // Datagramma che lo contiene
+    uint32_t state_seq;          // Ultimo datagramma con un messaggio di gioco
+    char last[UDP_PAYLOAD_MAX];  // Ultimo messaggio di gioco (griglia completa)
+    int last_len;
+    char move[sizeof(int)];      // Mossa ricevuta in parte su TCP dopo il ritorno a TCP
+    int move_len;
+    int retransmissions;         // Statistiche per il log di chiusura
+    int resyncs;
+    udp_watch_t watch[2];        // Socketpair e connessione di controllo
+    struct udp_session_t *hash_next;   // Lista della tabella dei token
+    struct udp_session_t *prev, *next; // Sessioni attive (o appena agganciate)
+} udp_session_t;
+
+int udp_socket = -1;            // Socket UDP del server (-1 = trasporto disattivato)
+int udp_epoll_fd = -1;
+int udp_wake_fd = -1;           // Segnala sessioni appena agganciate
+int udp_parked = 0;             // 1 se fermo per un aggiornamento a caldo
+int udp_expired = 0;            // 1 se qualche sessione va chiusa subito
+int udp_loss = 0;               // Datagrammi scartati su 100 (TRIS_UDP_LOSS)
+unsigned udp_seed = 0;
+pthread_mutex_t udp_lock = PTHREAD_MUTEX_INITIALIZER; // Protegge tabella e sessioni
+udp_session_t *udp_buckets[UDP_BUCKETS];
+udp_session_t *udp_sessions = NULL; // Sessioni con partita (solo thread UDP)
+udp_session_t *udp_attached = NULL; // Agganciate e non ancora osservate (con udp_lock)
+
+// Sessione della connessione che il thread principale sta leggendo
+udp_session_t *udp_handshake = NULL;
+int udp_handshake_socket = -1;
+
+// Datagrammi in uscita, inviati insieme da udp_flush
+struct mmsghdr udp_out[UDP_BATCH];
+struct iovec udp_out_iov[UDP_BATCH];
+struct sockaddr_in udp_out_addr[UDP_BATCH];
+char udp_out_buf[UDP_BATCH][UDP_HEADER + UDP_PAYLOAD_MAX];
+int udp_n_out = 0;
+
+// Datagrammi in ingresso
+struct mmsghdr udp_in[UDP_BATCH];
+struct iovec udp_in_iov[UDP_BATCH];
+struct sockaddr_in udp_in_addr[UDP_BATCH];
+char udp_in_buf[UDP_BATCH][UDP_HEADER + UDP_PAYLOAD_MAX];
+
+void udp_put32(char *p, uint32_t value) {
+    value = htonl(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+uint32_t udp_get32(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+// Sessione con il token dato (con udp_lock)
+udp_session_t *udp_find(uint64_t token) {
+    udp_session_t *s = udp_buckets[token % UDP_BUCKETS];
+    while (s && s->token != token) {
+        s = s->hash_next;
+    }
+    return s;
+}
+
+// Toglie una sessione dalla tabella dei token (con udp_lock)
+void udp_unhash(udp_session_t *s) {
+    udp_session_t **link = &udp_buckets[s->token % UDP_BUCKETS];
+    while (*link && *link != s) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = s->hash_next;
+    }
+}
+
+// Crea una sessione e ne comunica il token sulla connessione TCP
+udp_session_t *udp_request(int socket) {
+    if (udp_socket < 0) {
+        return NULL;
+    }
+    udp_session_t *s = calloc(1, sizeof(udp_session_t));
+    mem_charge(MEM_BUFFERS, sizeof(udp_session_t));
+    s->tcp = s->bridge = -1;
+    s->next_seq = s->expected = 1;
+    s->rto = UDP_RTO_INITIAL_MS * 1000000ULL;
+    s->last_heard = trace_now();
+
+    pthread_mutex_lock(&udp_lock);
+    // Il token autentica i datagrammi: deve essere imprevedibile
+    do {
+        if (getrandom(&s->token, sizeof(s->token), 0) != sizeof(s->token)) {
+            s->token = ((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ trace_now();
+        }
+    } while (s->token == 0 || udp_find(s->token));
+    s->hash_next = udp_buckets[s->token % UDP_BUCKETS];
+    udp_buckets[s->token % UDP_BUCKETS] = s;
+    pthread_mutex_unlock(&udp_lock);
+
+    msg_t msg;
+    msg_init(&msg);
+    msg_put_flag(&msg, UDP_TOKEN);
+    msg_put_int(&msg, (int)(s->token >> 32));
+    msg_put_int(&msg, (int)(s->token & 0xffffffffu));
+    send_all(socket, msg.data, msg.len);
+    return s;
+}
+
+// Libera una sessione mai agganciata a una partita
+void udp_release(udp_session_t *s) {
+    if (!s) {
+        return;
+    }
+    pthread_mutex_lock(&udp_lock);
+    udp_unhash(s);
+    pthread_mutex_unlock(&udp_lock);
+    mem_charge(MEM_BUFFERS, -(long)sizeof(udp_session_t));
+    free(s);
+}
+
+// Legge il flag iniziale di una connessione (-1 = errore). Un client che
+// vuole giocare su UDP premette UDP_REQUEST: riceve subito il token e la
+// sessione passa al giocatore letto poi da receive_player.
+int receive_flag(int socket) {
+    // Una sessione rimasta qui apparteneva a una richiesta fallita
+    udp_release(udp_handshake);
+    udp_handshake = NULL;
+
+    // UDP_REQUEST non si registra: nel replay la partita si gioca su TCP, con
+    // le mosse arrivate su UDP registrate come ricevute dalla connessione
+    int flag;
+    ssize_t n = recv(socket, &flag, sizeof(int), MSG_WAITALL);
+    if (n != sizeof(int) || flag != UDP_REQUEST) {
+        capture_data(socket, &flag, n);
+    }
+    if (n != sizeof(int)) {
+        return -1;
+    }
+    if (flag != UDP_REQUEST) {
+        return flag;
+    }
+    printf("[UDP] Richiesta di trasporto UDP dal socket %d\n", socket);
+    udp_handshake = udp_request(socket);
+    udp_handshake_socket = socket;
+    if (capture_recv(socket, &flag, sizeof(int), MSG_WAITALL) != sizeof(int)) {
+        return -1;
+    }
+    return flag;
+}
+
+// Sessione richiesta dalla connessione del giocatore appena letto
+udp_session_t *udp_take(int socket) {
+    if (!udp_handshake || udp_handshake_socket != socket) {
+        return NULL;
+    }
+    udp_session_t *s = udp_handshake;
+    udp_handshake = NULL;
+    return s;
+}
+
+// All'avvio della partita sposta il giocatore su UDP: la partita usa un
+// lato del socketpair, il thread UDP l'altro e la connessione TCP
+void udp_attach(player_t *player) {
+    udp_session_t *s = player->udp;
+    if (!s) {
+        return;
+    }
+    player->udp = NULL;
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+        perror("[UDP] socketpair");
+        udp_release(s);
+        return;
+    }
+    // I descrittori possono riusare numeri di connessioni catturate
+    capture_forget(pair[0]);
+    capture_forget(pair[1]);
+
+    pthread_mutex_lock(&udp_lock);
+    s->state = UDP_ACTIVE;
+    s->tcp = player->socket;
+    s->bridge = pair[1];
+    s->next = udp_attached;
+    udp_attached = s;
+    pthread_mutex_unlock(&udp_lock);
+    uint64_t one = 1;
+    if (write(udp_wake_fd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+
+    player->udp_control = player->socket;
+    player->socket = pair[0];
+    printf("[UDP] %s gioca su UDP\n", player->name);
+}
+
+// 1 se la perdita simulata scarta il datagramma
+int udp_lost(void) {
+    return udp_loss > 0 && (int)(rand_r(&udp_seed) % 100) < udp_loss;
+}
+
+// Invia i datagrammi accodati con il minor numero di sendmmsg
+void udp_flush(void) {
+    int n = 0;
+    for (int i = 0; i < udp_n_out; ++i) {
+        if (!udp_lost()) {
+            udp_out[n++] = udp_out[i];
+        }
+    }
+    int sent = 0;
+    while (sent < n) {
+        int r = sendmmsg(udp_socket, udp_out + sent, n - sent, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break; // Buffer pieno: i datagrammi persi verranno ritrasmessi
+        }
+        sent += r;
+    }
+    udp_n_out = 0;
+}
+
+// Accoda un datagramma per il client di una sessione
+void udp_push(udp_session_t *s, int type, uint32_t seq, const char *data, int len) {
+    if (udp_n_out == UDP_BATCH) {
+        udp_flush();
+    }
+    int i = udp_n_out++;
+    char *p = udp_out_buf[i];
+    p[0] = (char)type;
+    udp_put32(p + 1, (uint32_t)(s->token >> 32));
+    udp_put32(p + 5, (uint32_t)s->token);
+    udp_put32(p + 9, seq);
+    udp_put32(p + 13, s->expected);
+    if (len > 0) {
+        memcpy(p + UDP_HEADER, data, len);
+    }
+    udp_out_iov[i].iov_base = p;
+    udp_out_iov[i].iov_len = UDP_HEADER + len;
+    udp_out_addr[i] = s->addr;
+    memset(&udp_out[i], 0, sizeof(udp_out[i]));
+    udp_out[i].msg_hdr.msg_name = &udp_out_addr[i];
+    udp_out[i].msg_hdr.msg_namelen = sizeof(udp_out_addr[i]);
+    udp_out[i].msg_hdr.msg_iov = &udp_out_iov[i];
+    udp_out[i].msg_hdr.msg_iovlen = 1;
+}
+
+// Invia (o ritrasmette) un messaggio non confermato
+void udp_transmit(udp_session_t *s, udp_message_t *m, uint64_t now) {
+    if (!s->addr_known || s->tcp_mode) {
+        return;
+    }
+    udp_push(s, m->type, m->seq, m->data, m->len);
+    m->retransmitted = m->sent_at != 0;
+    m->sent_at = now;
+}
+
+// Aggiorna la stima del RTT con una misura (come TCP, RFC 6298)
+void udp_rtt_sample(udp_session_t *s, uint64_t rtt) {
+    if (!s->srtt) {
+        s->srtt = rtt;
+        s->rttvar = rtt / 2;
+    } else {
+        uint64_t err = rtt > s->srtt ? rtt - s->srtt : s->srtt - rtt;
+        s->rttvar = (3 * s->rttvar + err) / 4;
+        s->srtt = (7 * s->srtt + rtt) / 8;
+    }
+    s->rto = s->srtt + 4 * s->rttvar;
+    if (s->rto < UDP_RTO_MIN_MS * 1000000ULL) {
+        s->rto = UDP_RTO_MIN_MS * 1000000ULL;
+    } else if (s->rto > UDP_RTO_MAX_MS * 1000000ULL) {
+        s->rto = UDP_RTO_MAX_MS * 1000000ULL;
+    }
+}
+
+// Stato corrente della partita: START se non ancora confermato e ultimo
+// messaggio di gioco (restituisce i byte scritti in dst)
+int udp_state(const udp_session_t *s, char *dst) {
+    memcpy(dst, s->start, s->start_len);
+    memcpy(dst + s->start_len, s->last, s->last_len);
+    return s->start_len + s->last_len;
+}
+
+// Sostituisce i messaggi non confermati con un solo UDP_RESYNC
+// (preceduto dal numero dell'ultimo datagramma che conteneva lo stato: il
+// client che l'ha già ricevuto lo ignora, senza rispondere due volte a un turno)
+void udp_resync(udp_session_t *s, uint64_t now) {
+    udp_message_t *m = &s->queue[0];
+    m->seq = s->next_seq++;
+    m->type = UDP_RESYNC;
+    udp_put32(m->data, s->state_seq);
+    m->len = sizeof(uint32_t) + udp_state(s, m->data + sizeof(uint32_t));
+    m->sent_at = 0;
+    s->state_seq = m->seq;
+    if (s->start_len) {
+        s->start_seq = m->seq;
+    }
+    s->n_queue = 1;
+    s->resyncs++;
+    udp_transmit(s, m, now);
+}
+
+// Il client non risponde: lo stato corrente e i messaggi successivi vanno su TCP
+void udp_fallback(udp_session_t *s) {
+    char state[2 * UDP_PAYLOAD_MAX];
+    int len = udp_state(s, state);
+    printf("[UDP] Nessuna risposta su UDP: la sessione %016llx torna su TCP\n",
+           (unsigned long long)s->token);
+    s->tcp_mode = 1;
+    s->n_queue = 0;
+    if (send(s->tcp, state, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) {
+        shutdown(s->tcp, SHUT_RDWR); // Il thread vedrà la chiusura e libererà la sessione
+    }
+}
+
+// Un messaggio uscito dalla partita: lo invia o lo accoda
+void udp_send_message(udp_session_t *s, const char *data, int len, uint64_t now) {
+    if (len >= (int)sizeof(int) && memcmp(data, &START_FLAG, sizeof(int)) == 0) {
+        memcpy(s->start, data, len);
+        s->start_len = len;
+    } else {
+        memcpy(s->last, data, len);
+        s->last_len = len;
+    }
+    if (s->tcp_mode) {
+        if (send(s->tcp, data, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) {
+            shutdown(s->tcp, SHUT_RDWR);
+        }
+        return;
+    }
+    if (s->n_queue == UDP_WINDOW) {
+        udp_resync(s, now); // Contiene già anche questo messaggio
+        return;
+    }
+    if (s->n_queue == 0) {
+        s->waiting_since = now;
+    }
+    udp_message_t *m = &s->queue[s->n_queue++];
+    m->seq = s->next_seq++;
+    m->type = UDP_DATA;
+    m->len = len;
+    m->sent_at = 0;
+    memcpy(m->data, data, len);
+    if (s->start_len && memcmp(data, &START_FLAG, sizeof(int)) == 0) {
+        s->start_seq = m->seq;
+    }
+    s->state_seq = m->seq;
+    udp_transmit(s, m, now);
+}
+
+// Conferma cumulativa: il client ha ricevuto tutto prima di ack
+void udp_acked(udp_session_t *s, uint32_t ack, uint64_t now) {
+    int acked = 0;
+    while (acked < s->n_queue && (int32_t)(ack - s->queue[acked].seq) > 0) {
+        acked++;
+    }
+    if (s->start_len && (int32_t)(ack - s->start_seq) > 0) {
+        s->start_len = 0;
+    }
+    if (acked == 0) {
+        return;
+    }
+    const udp_message_t *newest = &s->queue[acked - 1];
+    if (newest->sent_at && !newest->retransmitted) {
+        udp_rtt_sample(s, now - newest->sent_at);
+    }
+    memmove(s->queue, s->queue + acked, (s->n_queue - acked) * sizeof(udp_message_t));
+    s->n_queue -= acked;
+    s->timeouts = 0;
+    s->waiting_since = now;
+}
+
+// Elabora un datagramma del client
+void udp_receive(const char *data, int len, const struct sockaddr_in *from, uint64_t now) {
+    if (len < UDP_HEADER) {
+        return;
+    }
+    uint64_t token = (uint64_t)udp_get32(data + 1) << 32 | udp_get32(data + 5);
+    udp_session_t *s = udp_find(token);
+    if (!s) {
+        return;
+    }
+    int type = data[0];
+    uint32_t seq = udp_get32(data + 9);
+
+    // L'indirizzo segue il client se cambia rete (mobile)
+    int was_known = s->addr_known;
+    s->addr = *from;
+    s->addr_known = 1;
+    s->last_heard = now;
+    udp_acked(s, udp_get32(data + 13), now);
+    if (!was_known) {
+        for (int i = 0; i < s->n_queue; ++i) {
+            udp_transmit(s, &s->queue[i], now);
+        }
+    }
+
+    if (type == UDP_DATA && seq == s->expected && s->bridge >= 0) {
+        // Se la partita non ha ancora letto la mossa precedente il client ritrasmetterà
+        if (send(s->bridge, data + UDP_HEADER, len - UDP_HEADER, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+            capture_data(s->tcp, data + UDP_HEADER, len - UDP_HEADER);
+            s->expected++;
+        }
+    }
+    if (type == UDP_HELLO || type == UDP_DATA) {
+        udp_push(s, UDP_ACK, 0, NULL, 0);
+    }
+}
+
+// Legge i datagrammi disponibili a blocchi di UDP_BATCH
+void udp_receive_all(uint64_t now) {
+    while (1) {
+        for (int i = 0; i < UDP_BATCH; ++i) {
+            udp_in_iov[i].iov_base = udp_in_buf[i];
+            udp_in_iov[i].iov_len = sizeof(udp_in_buf[i]);
+            memset(&udp_in[i], 0, sizeof(udp_in[i]));
+            udp_in[i].msg_hdr.msg_name = &udp_in_addr[i];
+            udp_in[i].msg_hdr.msg_namelen = sizeof(udp_in_addr[i]);
+            udp_in[i].msg_hdr.msg_iov = &udp_in_iov[i];
+            udp_in[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(udp_socket, udp_in, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (!udp_lost()) {
+                udp_receive(udp_in_buf[i], udp_in[i].msg_len, &udp_in_addr[i], now);
+            }
+        }
+        if (n < UDP_BATCH) {
+            return;
+        }
+    }
+}
+
+// Chiude una sessione: la partita, se ancora in corso, vede la disconnessione
+void udp_close_session(udp_session_t *s) {
+    if (s->bridge >= 0) {
+        close(s->bridge);
+    }
+    close(s->tcp);
+    udp_unhash(s);
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        udp_sessions = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+    printf("[UDP] Sessione %016llx chiusa (%d ritrasmissioni, %d risincronizzazioni)\n",
+           (unsigned long long)s->token, s->retransmissions, s->resyncs);
+    mem_charge(MEM_BUFFERS, -(long)sizeof(udp_session_t));
+    free(s);
+}
+
+// Messaggi della partita da inoltrare al client
+void udp_bridge_readable(udp_session_t *s, uint64_t now) {
+    char data[UDP_PAYLOAD_MAX];
+    while (1) {
+        ssize_t n = recv(s->bridge, data, sizeof(data), MSG_DONTWAIT);
+        if (n > 0) {
+            udp_send_message(s, data, (int)n, now);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        // La partita è finita: restano da consegnare gli ultimi messaggi
+        close(s->bridge);
+        s->bridge = -1;
+        s->state = UDP_CLOSING;
+        s->deadline = now + UDP_CLOSE_MS * 1000000ULL;
+        return;
+    }
+}
+
+// Connessione di controllo: i dati (mosse di un client tornato a TCP)
+// vanno alla partita, la chiusura termina la sessione
+void udp_tcp_readable(udp_session_t *s) {
+    char data[64];
+    ssize_t n = capture_recv(s->tcp, data, sizeof(data), MSG_DONTWAIT);
+    // Sul socketpair ogni mossa deve restare un messaggio a sé
+    for (ssize_t i = 0; i < n; ++i) {
+        s->move[s->move_len++] = data[i];
+        if (s->move_len == sizeof(int)) {
+            if (s->bridge >= 0) {
+                send(s->bridge, s->move, sizeof(int), MSG_DONTWAIT | MSG_NOSIGNAL);
+            }
+            s->move_len = 0;
+        }
+    }
+    if (n > 0) {
+        return;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    // Il client si è disconnesso: la partita lo vede dalla chiusura del
+    // socketpair. La sessione si libera in udp_timers, perché altri eventi
+    // dello stesso blocco possono ancora riferirla.
+    epoll_ctl(udp_epoll_fd, EPOLL_CTL_DEL, s->tcp, NULL);
+    if (s->bridge >= 0) {
+        close(s->bridge);
+        s->bridge = -1;
+    }
+    s->state = UDP_CLOSING;
+    s->n_queue = 0;
+    udp_expired = 1;
+}
+
+// Ritrasmissioni, risincronizzazioni e chiusure scadute (1 se restano timer attivi)
+int udp_timers(uint64_t now) {
+    int active = 0;
+    udp_expired = 0;
+    udp_session_t *next;
+    for (udp_session_t *s = udp_sessions; s; s = next) {
+        next = s->next;
+        if (s->state == UDP_CLOSING && (s->n_queue == 0 || now >= s->deadline)) {
+            if (s->n_queue > 0) {
+                udp_fallback(s); // L'esito della partita arriva almeno su TCP
+            }
+            udp_close_session(s);
+            continue;
+        }
+        if (s->n_queue == 0) {
+            continue;
+        }
+        active = 1;
+        uint64_t quiet = now - (s->last_heard > s->waiting_since ? s->last_heard : s->waiting_since);
+        if (quiet >= UDP_FALLBACK_MS * 1000000ULL) {
+            udp_fallback(s);
+            continue;
+        }
+        udp_message_t *oldest = &s->queue[0];
+        if (!s->addr_known || (oldest->sent_at && now - oldest->sent_at < s->rto)) {
+            continue;
+        }
+        s->rto = s->rto * 2 > UDP_RTO_MAX_MS * 1000000ULL ? UDP_RTO_MAX_MS * 1000000ULL : s->rto * 2;
+        s->retransmissions += s->n_queue;
+        if (++s->timeouts >= UDP_RESYNC_AFTER && s->n_queue > 1) {
+            udp_resync(s, now);
+            continue;
+        }
+        for (int i = 0; i < s->n_queue; ++i) {
+            udp_transmit(s, &s->queue[i], now);
+        }
+    }
+    return active;
+}
+
+// Inizia a osservare le sessioni appena agganciate (con udp_lock)
+void udp_watch_attached(void) {
+    while (udp_attached) {
+        udp_session_t *s = udp_attached;
+        udp_attached = s->next;
+        s->prev = NULL;
+        s->next = udp_sessions;
+        if (udp_sessions) {
+            udp_sessions->prev = s;
+        }
+        udp_sessions = s;
+
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        s->watch[0] = (udp_watch_t){s, 0};
+        ev.data.ptr = &s->watch[0];
+        epoll_ctl(udp_epoll_fd, EPOLL_CTL_ADD, s->bridge, &ev);
+        s->watch[1] = (udp_watch_t){s, 1};
+        ev.data.ptr = &s->watch[1];
+        epoll_ctl(udp_epoll_fd, EPOLL_CTL_ADD, s->tcp, &ev);
+    }
+}
+
+// Thread del trasporto UDP
+void *udp_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[UDP_BATCH];
+    trace_set_thread_label("udp");
+    int timers = 0;           // 1 se qualche sessione attende conferme
+    uint64_t next_check = 0;  // Prossimo controllo delle ritrasmissioni
+
+    while (RUNNING) {
+        int n = epoll_wait(udp_epoll_fd, events, UDP_BATCH, timers ? UDP_TICK_MS : -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        int park = 0;
+        pthread_mutex_lock(&udp_lock);
+        uint64_t now = trace_now();
+        udp_watch_attached();
+        for (int i = 0; i < n; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &upgrade_fd) {
+                park = 1;
+            } else if (ptr == &udp_wake_fd) {
+                uint64_t count;
+                if (read(udp_wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    perror("read eventfd");
+                }
+            } else if (ptr == &udp_socket) {
+                udp_receive_all(now);
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &upgrade_fd || ptr == &udp_wake_fd || ptr == &udp_socket) {
+                continue;
+            }
+            udp_watch_t *watch = (udp_watch_t *)ptr;
+            udp_session_t *s = watch->session;
+            if (watch->tcp) {
+                udp_tcp_readable(s);
+            } else if (s->bridge >= 0) {
+                udp_bridge_readable(s, now);
+            }
+        }
+        if (now >= next_check || !timers || udp_expired) {
+            timers = udp_timers(now);
+            next_check = now + UDP_TICK_MS * 1000000ULL;
+        }
+        udp_flush();
+        pthread_mutex_unlock(&udp_lock);
+
+        if (park && upgrade_pending()) {
+            upgrade_park(&udp_parked, NULL);
+        }
+    }
+    return NULL;
+}
+
+// Apre il socket UDP sulla porta del server TCP e avvia il thread
+void udp_init(int server_socket) {
+    udp_epoll_fd = epoll_create1(0);
+    udp_wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (udp_epoll_fd < 0 || udp_wake_fd < 0) {
+        perror("udp");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &udp_wake_fd;
+    epoll_ctl(udp_epoll_fd, EPOLL_CTL_ADD, udp_wake_fd, &ev);
+    ev.data.ptr = &upgrade_fd;
+    epoll_ctl(udp_epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &ev);
+
+    // Durante un aggiornamento a caldo i due processi usano la stessa porta
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int reuse = 1;
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (s < 0 || getsockname(server_socket, (struct sockaddr *)&addr, &len) < 0 ||
+        setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0 ||
+        bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("[UDP] socket");
+        if (s >= 0) {
+            close(s);
+        }
+        printf("[UDP] Trasporto UDP disattivato\n");
+    } else {
+        udp_socket = s;
+        ev.data.ptr = &udp_socket;
+        epoll_ctl(udp_epoll_fd, EPOLL_CTL_ADD, udp_socket, &ev);
+        udp_loss = env_int("TRIS_UDP_LOSS", 0);
+        udp_loss = udp_loss > 100 ? 100 : udp_loss;
+        udp_seed = (unsigned)time(NULL);
+        printf("[UDP] In ascolto sulla porta %d%s\n", ntohs(addr.sin_port),
+               udp_loss ? " con perdita simulata" : "");
+    }
+
+    // Il thread parte comunque: un aggiornamento a caldo attende che si fermi
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, udp_main, NULL);
+    pthread_detach(thread_id);
+}
+
+// ======================= MOTORE PARTITE A EVENTI =======================
+// Le partite dei tornei non hanno un thread ciascuna: vengono distribuite
+// su un pool fisso di worker, ognuno con la propria istanza epoll. Ogni
+// partita è una macchina a stati che avanza quando il giocatore di turno
+// invia la mossa.
+
+#define ENGINE_MAX_WORKERS 32  // Numero massimo di worker
+#define ENGINE_TICK_MS 250     // Intervallo di controllo dei timeout
+#define ENGINE_MAX_EVENTS 256  // Eventi letti per ogni epoll_wait
+
+struct match_t;
+struct tournament_t;
+
+// Worker del motore: un thread, un'istanza epoll, le sue partite
+typedef struct engine_worker_t {
+    pthread_t thread;          // Thread del worker
+    int epoll_fd;              // Istanza epoll
+    int wake_fd;               // eventfd per consegnare nuove partite
+    pthread_mutex_t lock;      // Protegge la lista incoming
+    struct match_t *incoming;  // Partite consegnate e non ancora avviate
+    struct match_t *active;    // Partite in corso (per i timeout)
+    int parked;                // 1 se fermo per un aggiornamento a caldo
+} engine_worker_t;
+
+// Partita gestita dal motore a eventi
+typedef struct match_t {
+    struct tournament_t *tournament; // Torneo di appartenenza
+    int side[2];                     // Indici nel torneo (0 = X, 1 = O)
+    player_t *players[2];            // Giocatori (0 = X, 1 = O)
+    int dropped[2];                  // 1 se il giocatore si è disconnesso
+    int game_id;                     // ID della partita
+    char table[GRID_SIZE];           // Griglia di gioco
+    int turn;                        // 0 = tocca a X, 1 = tocca a O
+    int registered_fd;               // Socket registrato in epoll (-1 se nessuno)
+    char move_buf[sizeof(int)];      // Mossa ricevuta parzialmente
+    int move_len;                    // Byte della mossa già ricevuti
+    int move_count;                  // Mosse giocate
+    int traced;                      // 1 se la partita è tracciata
+    uint64_t game_start;             // Inizio della partita (traccia)
+    uint64_t turn_start;             // Inizio del turno corrente (traccia)
+    int resumed;                     // 1 se ripresa dopo un aggiornamento a caldo
+    time_t deadline;                 // Scadenza della mossa corrente
+    uint8_t result;                  // Esito finale della partita
+    engine_worker_t *worker;         // Worker che gestisce la partita
+    struct match_t *prev, *next;     // Collegamenti nelle liste del worker
+} match_t;
+
+engine_worker_t engine_workers[ENGINE_MAX_WORKERS];
+int engine_n_workers = 0;
+int engine_next_worker = 0;
+pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+
+void tournament_match_done(match_t *match);
+
+// Rimuove da epoll il socket attualmente osservato
+void engine_unregister(match_t *match) {
+    if (match->registered_fd >= 0) {
+        epoll_ctl(match->worker->epoll_fd, EPOLL_CTL_DEL, match->registered_fd, NULL);
+        match->registered_fd = -1;
+    }
+}
+
+// Osserva il socket del giocatore di turno
+int engine_register(match_t *match, int socket) {
+    engine_unregister(match);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = match;
+    if (epoll_ctl(match->worker->epoll_fd, EPOLL_CTL_ADD, socket, &ev) < 0) {
+        return -1;
+    }
+    match->registered_fd = socket;
+    return 0;
+}
+
+// Invia flag e griglia a uno dei due giocatori
+int match_send_board(match_t *match, int side, int flag) {
+    uint64_t start = TRACE_BEGIN(match->traced);
+    msg_t msg;
+    msg_init(&msg);
+    msg_put_board(&msg, flag, match->table);
+    TRACE_END(match->traced, "serialize", match->game_id, match->move_count, start);
+
+    start = TRACE_BEGIN(match->traced);
+    int result = send_nonblocking(match->players[side]->socket, &msg);
+    TRACE_END(match->traced, "send", match->game_id, match->move_count, start);
+    return result;
+}
+
+// Chiude la partita, comunica l'esito e lo riporta al torneo
+void match_finish(match_t *match, uint8_t result) {
+    engine_unregister(match);
+
+    engine_worker_t *w = match->worker;
+    if (match->prev) {
+        match->prev->next = match->next;
+    } else {
+        w->active = match->next;
+    }
+    if (match->next) {
+        match->next->prev = match->prev;
+    }
+
+    match->result = result;
+    int flags[2];
+    if (result == PLAYER1_WIN) {
+        flags[0] = WIN_FLAG;
+        flags[1] = LOSE_FLAG;
+    } else if (result == PLAYER2_WIN) {
+        flags[0] = LOSE_FLAG;
+        flags[1] = WIN_FLAG;
+    } else {
+        flags[0] = DRAW_FLAG;
+        flags[1] = DRAW_FLAG;
+    }
+    for (int side = 0; side < 2; ++side) {
+        if (!match->dropped[side] && match_send_board(match, side, flags[side]) < 0) {
+            match->dropped[side] = 1;
+        }
+    }
+
+    TRACE_END(match->traced, "game", match->game_id, -1, match->game_start);
+    printf("[ENGINE] Partita [%d] terminata con esito %d\n", match->game_id, result);
+    tournament_match_done(match);
+}
+
+// Sconfitta a tavolino del giocatore indicato
+void match_forfeit(match_t *match, int side, int dropped) {
+    printf("[ENGINE] Partita [%d]: %s perde a tavolino\n",
+           match->game_id, match->players[side]->name);
+    match->dropped[side] |= dropped;
+    match_finish(match, side == 0 ? PLAYER2_WIN : PLAYER1_WIN);
+}
+
+// Inizia il turno di un giocatore (stessa sequenza di game_function)
+void match_begin_turn(match_t *match, int side) {
+    match->turn = side;
+    match->move_len = 0;
+    match->deadline = time(NULL) + tournament_config.move_timeout;
+
+    if (match_send_board(match, side, YOUR_MOVE_FLAG) < 0) {
+        match_forfeit(match, side, 1);
+        return;
+    }
+    if (match_send_board(match, !side, OPPONENT_MOVE_FLAG) < 0) {
+        match_forfeit(match, !side, 1);
+        return;
+    }
+    // Come wait_start in game_function: l'attesa inizia dopo gli invii,
+    // così nella traccia della partita gli span restano annidati
+    match->turn_start = TRACE_BEGIN(match->traced);
+    if (engine_register(match, match->players[side]->socket) < 0) {
+        match_forfeit(match, side, 1);
+    }
+}
+
+// Avvia una partita appena consegnata al worker
+void match_start(match_t *match) {
+    engine_worker_t *w = match->worker;
+    match->prev = NULL;
+    match->next = w->active;
+    if (w->active) {
+        w->active->prev = match;
+    }
+    w->active = match;
+
+    match->registered_fd = -1;
+    if (match->resumed) {
+        // Partita trasferita da un aggiornamento a caldo: il turno corrente
+        // è già stato annunciato, si torna solo ad attendere la mossa
+        printf("[ENGINE] Partita [%d] ripresa\n", match->game_id);
+        match->deadline = time(NULL) + tournament_config.move_timeout;
+        if (engine_register(match, match->players[match->turn]->socket) < 0) {
+            match_forfeit(match, match->turn, 1);
+        }
+        return;
+    }
+
+    match->game_id = rand();
+    memset(match->table, ' ', GRID_SIZE);
+    match->traced = trace_sample();
+    match->game_start = TRACE_BEGIN(match->traced);
+    printf("[ENGINE] Partita [%d] iniziata tra %s e %s%s\n", match->game_id,
+           match->players[0]->name, match->players[1]->name, match->traced ? " (tracciata)" : "");
+    if (match->traced) {
+        trace_enable_socket(match->players[0]->socket);
+        trace_enable_socket(match->players[1]->socket);
+    }
+
+    // Un giocatore già ritirato perde senza giocare
+    for (int side = 0; side < 2; ++side) {
+        if (match->dropped[side]) {
+            match_forfeit(match, side, 1);
+            return;
+        }
+    }
+
+    char symbols[2] = {'X', 'O'};
+    for (int side = 0; side < 2; ++side) {
+        player_t *opponent = match->players[!side];
+        msg_t msg;
+        msg_init(&msg);
+        msg_put_flag(&msg, START_FLAG);
+        msg_put_int(&msg, match->game_id);
+        msg_put_len(&msg, opponent->name_len);
+        msg_put(&msg, opponent->name, opponent->name_len);
+        msg_put(&msg, &symbols[side], sizeof(char));
+        msg_put_int(&msg, 0); // Le partite del torneo non si riprendono
+        if (send_nonblocking(match->players[side]->socket, &msg) < 0) {
+            match_forfeit(match, side, 1);
+            return;
+        }
+    }
+
+    match_begin_turn(match, 0);
+}
+
+// Il giocatore di turno ha inviato dati
+void match_on_readable(match_t *match) {
+    int side = match->turn;
+    player_t *player = match->players[side];
+    int traced = match->traced;
+    int game_id = match->game_id;
+    int move_number = match->move_count;
+
+    uint64_t recv_start = TRACE_BEGIN(traced);
+    uint64_t arrival = 0;
+    char *dst = match->move_buf + match->move_len;
+    size_t wanted = sizeof(int) - match->move_len;
+    ssize_t n = traced ? trace_recv(player->socket, dst, wanted, MSG_DONTWAIT, &arrival)
+                       : capture_recv(player->socket, dst, wanted, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        printf("[ERRORE] Ricezione mossa da %s fallita\n", player->name);
+        match_forfeit(match, side, 1);
+        return;
+    }
+    if (traced) {
+        // L'attesa va dall'inizio del turno all'arrivo nel kernel, la coda
+        // dall'arrivo alla lettura da parte del worker
+        uint64_t ready = arrival && arrival < recv_start ? arrival : recv_start;
+        trace_span("wait_move", game_id, move_number, match->turn_start, ready);
+        trace_span("queue", game_id, move_number, ready < match->turn_start ? match->turn_start : ready, recv_start);
+        trace_span("recv", game_id, move_number, recv_start, trace_now());
+    }
+    match->move_len += n;
+    if (match->move_len < (int)sizeof(int)) {
+        return;
+    }
+
+    uint64_t move_start = recv_start;
+    int move;
+    memcpy(&move, match->move_buf, sizeof(int));
+    match->move_len = 0;
+
+    uint64_t validate_start = TRACE_BEGIN(traced);
+    move = ntohs(move);
+    int valid = move >= 0 && move < GRID_SIZE && match->table[move] == ' ';
+    TRACE_END(traced, "validate", game_id, move_number, validate_start);
+
+    // Mossa non valida: il giocatore deve ripetere il turno
+    if (!valid) {
+        printf("[ENGINE] Mossa non valida da %s: %d\n", player->name, move);
+        match->turn_start = TRACE_BEGIN(traced);
+        if (match_send_board(match, side, YOUR_MOVE_FLAG) < 0) {
+            match_forfeit(match, side, 1);
+        }
+        return;
+    }
+
+    printf("[ENGINE] %s ha mosso in posizione %d\n", player->name, move);
+    uint64_t update_start = TRACE_BEGIN(traced);
+    match->table[move] = side == 0 ? 'X' : 'O';
+    TRACE_END(traced, "update", game_id, move_number, update_start);
+
+    for (int s = 0; s < 2; ++s) {
+        if (match_send_board(match, s, OPPONENT_MOVE_FLAG) < 0) {
+            match_forfeit(match, s, 1);
+            return;
+        }
+    }
+
+    uint64_t check_start = TRACE_BEGIN(traced);
+    uint8_t win_flag = check_win(match->table);
+    TRACE_END(traced, "check_win", game_id, move_number, check_start);
+    TRACE_END(traced, "move", game_id, move_number, move_start);
+
+    match->move_count++;
+    if (win_flag != GAME_NOT_OVER) {
+        match_finish(match, win_flag);
+        return;
+    }
+    match_begin_turn(match, !side);
+}
+
+// Assegna la sconfitta a chi ha superato il tempo per la mossa
+void engine_check_timeouts(engine_worker_t *w) {
+    time_t now = time(NULL);
+    match_t *match = w->active;
+    while (match) {
+        match_t *next = match->next;
+        if (now >= match->deadline) {
+            printf("[ENGINE] Tempo scaduto per %s\n", match->players[match->turn]->name);
+            match_forfeit(match, match->turn, 0);
+        }
+        match = next;
+    }
+}
+
+// Loop di un worker del motore
+void *engine_worker_main(void *arg) {
+    engine_worker_t *w = (engine_worker_t *)arg;
+    struct epoll_event events[ENGINE_MAX_EVENTS];
+    trace_set_thread_label("engine");
+
+    while (RUNNING) {
+        int n = epoll_wait(w->epoll_fd, events, ENGINE_MAX_EVENTS, ENGINE_TICK_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &upgrade_fd) {
+                if (upgrade_pending()) {
+                    upgrade_park(&w->parked, NULL);
+                }
+                continue;
+            }
+            if (events[i].data.ptr != NULL) {
+                match_on_readable((match_t *)events[i].data.ptr);
+                continue;
+            }
+
+            // Nuove partite consegnate dal direttore di torneo
+            uint64_t count;
+            if (read(w->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("read eventfd");
+            }
+            pthread_mutex_lock(&w->lock);
+            match_t *batch = w->incoming;
+            w->incoming = NULL;
+            pthread_mutex_unlock(&w->lock);
+            while (batch) {
+                match_t *next = batch->next;
+                match_start(batch);
+                batch = next;
+            }
+        }
+        engine_check_timeouts(w);
+    }
+    return NULL;
+}
+
+// Avvia il pool di worker (uno per CPU)
+void engine_init(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    engine_n_workers = cpus < 1 ? 1 : cpus > ENGINE_MAX_WORKERS ? ENGINE_MAX_WORKERS : (int)cpus;
+
+    for (int i = 0; i < engine_n_workers; ++i) {
+        engine_worker_t *w = &engine_workers[i];
+        w->epoll_fd = epoll_create1(0);
+        w->wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (w->epoll_fd < 0 || w->wake_fd < 0) {
+            perror("engine");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&w->lock, NULL);
+        w->incoming = NULL;
+        w->active = NULL;
+
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &ev);
+        ev.data.ptr = &upgrade_fd;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &ev);
+
+        pthread_create(&w->thread, NULL, engine_worker_main, w);
+        pthread_detach(w->thread);
+    }
+    printf("[ENGINE] Avviati %d worker\n", engine_n_workers);
+}
+
+// Consegna un intero turno di partite ai worker, con una sola
+// notifica per worker indipendentemente dal numero di partite
+void engine_submit_batch(match_t **matches, int count) {
+    pthread_once(&engine_once, engine_init);
+
+    match_t *lists[ENGINE_MAX_WORKERS] = {0};
+    for (int i = 0; i < count; ++i) {
+        int next = __atomic_fetch_add(&engine_next_worker, 1, __ATOMIC_RELAXED);
+        engine_worker_t *w = &engine_workers[next % engine_n_workers];
+        matches[i]->worker = w;
+        matches[i]->next = lists[w - engine_workers];
+        lists[w - engine_workers] = matches[i];
+    }
+
+    for (int i = 0; i < engine_n_workers; ++i) {
+        if (!lists[i]) {
+            continue;
+        }
+        engine_worker_t *w = &engine_workers[i];
+        match_t *tail = lists[i];
+        while (tail->next) {
+            tail = tail->next;
+        }
+        pthread_mutex_lock(&w->lock);
+        tail->next = w->incoming;
+        w->incoming = lists[i];
+        pthread_mutex_unlock(&w->lock);
+
+        uint64_t one = 1;
+        if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+            perror("write eventfd");
+        }
+    }
+}
+
+// ======================= TORNEI =======================
+// Iscrizione, abbinamenti automatici (svizzero o girone all'italiana),
+// bye, sconfitte a tavolino, spareggi e classifiche dopo ogni turno.
+
+#define TOURNAMENT_STANDINGS_TOP 32 // Righe di classifica inviate ai giocatori
+#define TOURNAMENT_SEND_TIMEOUT 5   // Secondi massimi per inviare a un giocatore
+
+// Fasi del torneo
+enum {
+    TOURNAMENT_REGISTRATION,  // Iscrizioni aperte
+    TOURNAMENT_ROUND_START,   // Il turno current_round deve ancora iniziare
+    TOURNAMENT_ROUND_PLAYING  // Partite del turno current_round in corso
+};
+
+// Giocatore iscritto a un torneo
+typedef struct tournament_player_t {
+    player_t *player;   // Dati del giocatore
+    int seed;           // Ordine di iscrizione
+    int score2;         // Punteggio x2 (vittoria = 2, pareggio = 1)
+    int wins;           // Vittorie
+    int games_as_x;     // Partite giocate con la X
+    int had_bye;        // 1 se ha già avuto un turno di riposo
+    int withdrawn;      // 1 se si è disconnesso
+    int *opponents;     // Avversari affrontati (indici)
+    int *results;       // Esito contro ciascun avversario (2/1/0)
+    int n_opponents;    // Numero di avversari affrontati
+    int buchholz2;      // Spareggio Buchholz x2
+    int sonneborn4;     // Spareggio Sonneborn-Berger x4
+} tournament_player_t;
+
+// Torneo
+typedef struct tournament_t {
+    int id;                        // ID del torneo
+    int format;                    // FORMAT_SWISS o FORMAT_ROUND_ROBIN
+    int capacity;                  // Numero massimo di iscritti
+    int n_players;                 // Iscritti
+    tournament_player_t *players;  // Iscritti (in ordine di iscrizione)
+    int registration_open;         // 1 finché si accettano iscrizioni
+    time_t registration_deadline;  // Chiusura delle iscrizioni
+    int rounds;                    // Turni previsti
+    int phase;                     // Fase corrente (TOURNAMENT_REGISTRATION, ...)
+    int current_round;             // Turno corrente (da 1)
+    int pending;                   // Partite del turno ancora in corso
+    int parked;                    // 1 se il direttore è fermo per un aggiornamento a caldo
+    int confirming;                // Conferme di iscrizione in invio (con tournament_registry_lock)
+    long mem_bytes;                // Byte contati in MEM_TOURNAMENTS
+    pthread_mutex_t lock;          // Protegge risultati e pending
+    pthread_cond_t round_done;     // Segnalata quando pending arriva a 0
+    struct tournament_t *prev, *next; // Lista dei tornei attivi
+} tournament_t;
+
+tournament_t *live_tournaments = NULL; // Tornei attivi (protetta da live_lock)
+
+tournament_t *open_tournament = NULL; // Torneo che accetta iscrizioni
+pthread_mutex_t tournament_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t tournament_registry_cond = PTHREAD_COND_INITIALIZER;
+
+// Abbinamento di un turno (indici dei giocatori)
+typedef struct pairing_t {
+    int x; // Gioca con la X
+    int o; // Gioca con la O
+} pairing_t;
+
+// Invia un messaggio a un iscritto; se fallisce lo considera ritirato
+void tournament_send(tournament_player_t *tp, const msg_t *msg) {
+    if (tp->withdrawn) {
+        return;
+    }
+    if (msg->overflow || send_all(tp->player->socket, msg->data, msg->len) < 0) {
+        printf("[TORNEO] %s non raggiungibile, ritirato\n", tp->player->name);
+        tp->withdrawn = 1;
+    }
+}
+
+// Registra l'esito di una partita (result_x: 2 vittoria X, 1 pareggio, 0 vittoria O)
+void tournament_record(tournament_t *t, int x, int o, int result_x) {
+    tournament_player_t *px = &t->players[x];
+    tournament_player_t *po = &t->players[o];
+    px->opponents[px->n_opponents] = o;
+    px->results[px->n_opponents++] = result_x;
+    po->opponents[po->n_opponents] = x;
+    po->results[po->n_opponents++] = 2 - result_x;
+    px->score2 += result_x;
+    po->score2 += 2 - result_x;
+    px->wins += result_x == 2;
+    po->wins += result_x == 0;
+}
+
+// Chiamata dal motore quando una partita del torneo termina
+void tournament_match_done(match_t *match) {
+    tournament_t *t = match->tournament;
+    int result_x = match->result == PLAYER1_WIN ? 2 : match->result == PLAYER2_WIN ? 0 : 1;
+
+    pthread_mutex_lock(&t->lock);
+    tournament_record(t, match->side[0], match->side[1], result_x);
+    t->players[match->side[0]].games_as_x++;
+    for (int side = 0; side < 2; ++side) {
+        if (match->dropped[side]) {
+            t->players[match->side[side]].withdrawn = 1;
+        }
+    }
+    if (--t->pending == 0) {
+        pthread_cond_signal(&t->round_done);
+    }
+    pthread_mutex_unlock(&t->lock);
+    mem_charge(MEM_GAMES, -(long)sizeof(match_t));
+    free(match);
+}
+
+// Verifica se due giocatori si sono già affrontati
+int tournament_have_played(tournament_t *t, int a, int b) {
+    tournament_player_t *pa = &t->players[a];
+    for (int i = 0; i < pa->n_opponents; ++i) {
+        if (pa->opponents[i] == b) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Ordine di classifica: punti, Buchholz, Sonneborn-Berger, vittorie, iscrizione
+int tournament_compare(const void *a, const void *b) {
+    const tournament_player_t *pa = *(tournament_player_t *const *)a;
+    const tournament_player_t *pb = *(tournament_player_t *const *)b;
+    if (pa->score2 != pb->score2) return pb->score2 - pa->score2;
+    if (pa->buchholz2 != pb->buchholz2) return pb->buchholz2 - pa->buchholz2;
+    if (pa->sonneborn4 != pb->sonneborn4) return pb->sonneborn4 - pa->sonneborn4;
+    if (pa->wins != pb->wins) return pb->wins - pa->wins;
+    return pa->seed - pb->seed;
+}
+
+// Calcola gli spareggi e riempie ranking in ordine di classifica
+void tournament_rank(tournament_t *t, tournament_player_t **ranking) {
+    for (int i = 0; i < t->n_players; ++i) {
+        tournament_player_t *tp = &t->players[i];
+        tp->buchholz2 = 0;
+        tp->sonneborn4 = 0;
+        for (int k = 0; k < tp->n_opponents; ++k) {
+            int opponent_score2 = t->players[tp->opponents[k]].score2;
+            tp->buchholz2 += opponent_score2;
+            tp->sonneborn4 += tp->results[k] * opponent_score2;
+        }
+        ranking[i] = tp;
+    }
+    qsort(ranking, t->n_players, sizeof(tournament_player_t *), tournament_compare);
+}
+
+// Assegna la X a chi l'ha avuta meno volte
+pairing_t tournament_colors(tournament_t *t, int a, int b, int round) {
+    pairing_t p = {a, b};
+    int xa = t->players[a].games_as_x, xb = t->players[b].games_as_x;
+    if (xb < xa || (xa == xb && round % 2 == 0)) {
+        p.x = b;
+        p.o = a;
+    }
+    return p;
+}
+
+// Abbinamenti del sistema svizzero: i giocatori vengono ordinati per
+// classifica e abbinati al primo avversario vicino non ancora affrontato
+int tournament_pair_swiss(tournament_t *t, int round, pairing_t *pairs, int *byes, int *n_byes) {
+    tournament_player_t **ranking = malloc(t->n_players * sizeof(tournament_player_t *));
+    int *order = malloc(t->n_players * sizeof(int));
+    int *used = calloc(t->n_players, sizeof(int));
+    int n = 0, n_pairs = 0;
+
+    tournament_rank(t, ranking);
+    for (int i = 0; i < t->n_players; ++i) {
+        if (!ranking[i]->withdrawn) {
+            order[n++] = ranking[i] - t->players;
+        }
+    }
+
+    // Con un numero dispari di giocatori il bye va al peggior
+    // classificato che non ne ha ancora avuto uno
+    if (n % 2 == 1) {
+        int bye = n - 1;
+        for (int i = n - 1; i >= 0; --i) {
+            if (!t->players[order[i]].had_bye) {
+                bye = i;
+                break;
+            }
+        }
+        byes[(*n_byes)++] = order[bye];
+        used[bye] = 1;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (used[i]) {
+            continue;
+        }
+        int partner = -1;
+        for (int j = i + 1; j < n; ++j) {
+            if (!used[j] && !tournament_have_played(t, order[i], order[j])) {
+                partner = j;
+                break;
+            }
+        }
+        // Nessun avversario nuovo disponibile: si accetta una rivincita
+        for (int j = i + 1; partner < 0 && j < n; ++j) {
+            if (!used[j]) {
+                partner = j;
+            }
+        }
+        if (partner < 0) {
+            break;
+        }
+        used[i] = used[partner] = 1;
+        pairs[n_pairs++] = tournament_colors(t, order[i], order[partner], round);
+    }
+
+    free(ranking);
+    free(order);
+    free(used);
+    return n_pairs;
+}
+
+// Abbinamenti del girone all'italiana (metodo del cerchio): il primo
+// giocatore resta fermo e gli altri ruotano di una posizione per turno
+int tournament_pair_round_robin(tournament_t *t, int round, pairing_t *pairs, int *byes, int *n_byes) {
+    int slots = t->n_players + t->n_players % 2;
+    int n_pairs = 0;
+
+    for (int i = 0; i < slots / 2; ++i) {
+        int a = i == 0 ? 0 : (i - 1 + round) % (slots - 1) + 1;
+        int j = slots - 1 - i;
+        int b = (j - 1 + round) % (slots - 1) + 1;
+        if (a >= t->n_players) {
+            a = -1;
+        }
+        if (b >= t->n_players) {
+            b = -1;
+        }
+
+        // Posto vuoto: riposo per l'altro giocatore
+        if (a < 0 || b < 0) {
+            int rest = a < 0 ? b : a;
+            if (rest >= 0 && !t->players[rest].withdrawn) {
+                byes[(*n_byes)++] = rest;
+            }
+            continue;
+        }
+
+        // Avversario ritirato: vittoria a tavolino senza giocare
+        if (t->players[a].withdrawn || t->players[b].withdrawn) {
+            if (t->players[a].withdrawn && t->players[b].withdrawn) {
+                continue;
+            }
+            int x = t->players[a].withdrawn ? b : a;
+            int o = x == a ? b : a;
+            tournament_record(t, x, o, 2);
+            byes[(*n_byes)++] = -1 - x;
+            continue;
+        }
+
+        pairs[n_pairs++] = round % 2 == 0 ? (pairing_t){a, b} : (pairing_t){b, a};
+    }
+    return n_pairs;
+}
+
+// Pubblica la classifica a tutti gli iscritti ancora in gioco
+void tournament_publish_standings(tournament_t *t, int round) {
+    tournament_player_t **ranking = malloc(t->n_players * sizeof(tournament_player_t *));
+    tournament_rank(t, ranking);
+
+    // Le righe comuni vengono codificate una sola volta
+    msg_t table;
+    msg_init(&table);
+    int top = t->n_players < TOURNAMENT_STANDINGS_TOP ? t->n_players : TOURNAMENT_STANDINGS_TOP;
+    for (int i = 0; i < top; ++i) {
+        msg_put_int(&table, i + 1);
+        msg_put_int(&table, ranking[i]->score2);
+        msg_put_int(&table, ranking[i]->buchholz2);
+        msg_put_len(&table, ranking[i]->player->name_len);
+        msg_put(&table, ranking[i]->player->name, ranking[i]->player->name_len);
+    }
+
+    printf("[TORNEO] Classifica del torneo %d dopo il turno %d:\n", t->id, round);
+    for (int i = 0; i < t->n_players; ++i) {
+        tournament_player_t *tp = ranking[i];
+        printf("[TORNEO]   %d. %s %d.%d punti (Buchholz %d.%d)%s\n", i + 1, tp->player->name,
+               tp->score2 / 2, tp->score2 % 2 * 5, tp->buchholz2 / 2, tp->buchholz2 % 2 * 5,
+               tp->withdrawn ? " [ritirato]" : "");
+
+        msg_t msg;
+        msg_init(&msg);
+        msg_put_flag(&msg, TOURNAMENT_STANDINGS);
+        msg_put_int(&msg, round);
+        msg_put_int(&msg, t->rounds);
+        msg_put_int(&msg, i + 1);
+        msg_put_int(&msg, tp->score2);
+        msg_put_int(&msg, top);
+        msg_put(&msg, table.data, table.len);
+        tournament_send(tp, &msg);
+    }
+    free(ranking);
+}
+
+// Numero di iscritti ancora in gioco
+int tournament_active_players(tournament_t *t) {
+    int active = 0;
+    for (int i = 0; i < t->n_players; ++i) {
+        active += !t->players[i].withdrawn;
+    }
+    return active;
+}
+
+// Avvia un turno: abbinamenti, notifiche e consegna delle partite in blocco
+void tournament_start_round(tournament_t *t, int round) {
+    pairing_t *pairs = malloc((t->n_players / 2 + 1) * sizeof(pairing_t));
+    int *byes = malloc(t->n_players * sizeof(int));
+    int n_byes = 0;
+    int n_pairs = t->format == FORMAT_SWISS
+        ? tournament_pair_swiss(t, round, pairs, byes, &n_byes)
+        : tournament_pair_round_robin(t, round - 1, pairs, byes, &n_byes);
+
+    printf("[TORNEO] Torneo %d, turno %d/%d: %d partite, %d riposi\n",
+           t->id, round, t->rounds, n_pairs, n_byes);
+
+    // Riposi: punto pieno (i valori negativi indicano vittorie a tavolino già registrate)
+    for (int i = 0; i < n_byes; ++i) {
+        int idx = byes[i] < 0 ? -1 - byes[i] : byes[i];
+        tournament_player_t *tp = &t->players[idx];
+        if (byes[i] >= 0) {
+            tp->had_bye = 1;
+            tp->score2 += 2;
+        }
+        msg_t msg;
+        msg_init(&msg);
+        msg_put_flag(&msg, TOURNAMENT_BYE);
+        msg_put_int(&msg, round);
+        msg_put_int(&msg, t->rounds);
+        msg_put_int(&msg, 2);
+        tournament_send(tp, &msg);
+    }
+
+    // Annuncio del turno e preparazione delle partite
+    match_t **matches = malloc((n_pairs + 1) * sizeof(match_t *));
+    int n_matches = 0;
+    for (int i = 0; i < n_pairs; ++i) {
+        int sides[2] = {pairs[i].x, pairs[i].o};
+        for (int s = 0; s < 2; ++s) {
+            msg_t msg;
+            msg_init(&msg);
+            msg_put_flag(&msg, TOURNAMENT_ROUND);
+            msg_put_int(&msg, round);
+            msg_put_int(&msg, t->rounds);
+            tournament_send(&t->players[sides[s]], &msg);
+        }
+
+        match_t *match = calloc(1, sizeof(match_t));
+        mem_charge(MEM_GAMES, sizeof(match_t));
+        match->tournament = t;
+        for (int s = 0; s < 2; ++s) {
+            match->side[s] = sides[s];
+            match->players[s] = t->players[sides[s]].player;
+            match->dropped[s] = t->players[sides[s]].withdrawn;
+        }
+        matches[n_matches++] = match;
+    }
+
+    pthread_mutex_lock(&t->lock);
+    t->pending = n_matches;
+    t->phase = TOURNAMENT_ROUND_PLAYING;
+    pthread_mutex_unlock(&t->lock);
+
+    engine_submit_batch(matches, n_matches);
+
+    free(matches);
+    free(pairs);
+    free(byes);
+}
+
+// Attende la fine di tutte le partite del turno
+void tournament_wait_round(tournament_t *t) {
+    pthread_mutex_lock(&t->lock);
+    while (t->pending > 0) {
+        if (upgrade_pending()) {
+            upgrade_park(&t->parked, &t->lock);
+            continue;
+        }
+        pthread_cond_wait(&t->round_done, &t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Conta memoria del torneo, restituita tutta insieme da tournament_destroy
+void tournament_charge(tournament_t *t, long bytes) {
+    t->mem_bytes += bytes;
+    mem_charge(MEM_TOURNAMENTS, bytes);
+}
+
+// Calcola il numero di turni una volta chiuse le iscrizioni
+void tournament_plan_rounds(tournament_t *t) {
+    int round_robin_rounds = t->n_players - 1 + t->n_players % 2;
+    if (tournament_config.rounds > 0) {
+        t->rounds = tournament_config.rounds;
+    } else if (t->format == FORMAT_ROUND_ROBIN) {
+        t->rounds = round_robin_rounds;
+    } else {
+        t->rounds = 0;
+        while ((1 << t->rounds) < t->n_players) {
+            t->rounds++;
+        }
+    }
+    if (t->format == FORMAT_ROUND_ROBIN && t->rounds > round_robin_rounds) {
+        t->rounds = round_robin_rounds;
+    }
+
+    for (int i = 0; i < t->n_players; ++i) {
+        t->players[i].opponents = malloc(t->rounds * sizeof(int));
+        t->players[i].results = malloc(t->rounds * sizeof(int));
+    }
+    tournament_charge(t, (long)t->n_players * 2 * t->rounds * sizeof(int));
+}
+
+// Libera il torneo e chiude le connessioni dei partecipanti
+void tournament_destroy(tournament_t *t) {
+    pthread_mutex_lock(&live_lock);
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        live_tournaments = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    }
+    pthread_cond_broadcast(&live_cond);
+    pthread_mutex_unlock(&live_lock);
+
+    for (int i = 0; i < t->n_players; ++i) {
+        close(t->players[i].player->socket);
+        delete_player(t->players[i].player);
+        free(t->players[i].opponents);
+        free(t->players[i].results);
+    }
+    free(t->players);
+    mem_charge(MEM_TOURNAMENTS, -t->mem_bytes);
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->round_done);
+    free(t);
+}
+
+// Direttore di torneo: un thread per torneo, non per partita. Riparte
+// dalla fase registrata nel torneo, così può riprendere un torneo
+// trasferito da un aggiornamento a caldo.
+void *tournament_director(void *arg) {
+    tournament_t *t = (tournament_t *)arg;
+
+    if (t->phase == TOURNAMENT_REGISTRATION) {
+        // Attende che il torneo sia pieno o che scadano le iscrizioni
+        pthread_mutex_lock(&tournament_registry_lock);
+        struct timespec deadline = {t->registration_deadline, 0};
+        while (t->registration_open && t->n_players < t->capacity) {
+            if (upgrade_pending()) {
+                upgrade_park(&t->parked, &tournament_registry_lock);
+                continue;
+            }
+            if (pthread_cond_timedwait(&tournament_registry_cond, &tournament_registry_lock,
+                                       &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        t->registration_open = 0;
+        if (open_tournament == t) {
+            open_tournament = NULL;
+        }
+        // Le conferme di iscrizione precedono ogni altro messaggio del torneo
+        while (t->confirming > 0) {
+            pthread_cond_wait(&tournament_registry_cond, &tournament_registry_lock);
+        }
+        pthread_mutex_unlock(&tournament_registry_lock);
+
+        if (t->n_players < 2) {
+            // Senza partite non c'è una classifica finale da comunicare
+            printf("[TORNEO] Torneo %d annullato: iscritti insufficienti\n", t->id);
+            for (int i = 0; i < t->n_players; ++i) {
+                msg_t msg;
+                msg_init(&msg);
+                msg_put_flag(&msg, TOURNAMENT_CANCELLED);
+                msg_put_int(&msg, t->id);
+                tournament_send(&t->players[i], &msg);
+            }
+            tournament_destroy(t);
+            return NULL;
+        } else {
+            tournament_plan_rounds(t);
+            printf("[TORNEO] Torneo %d iniziato: %d giocatori, %d turni\n",
+                   t->id, t->n_players, t->rounds);
+        }
+        t->current_round = 1;
+        t->phase = TOURNAMENT_ROUND_START;
+    }
+
+    while (t->current_round <= t->rounds) {
+        if (t->phase == TOURNAMENT_ROUND_START) {
+            if (upgrade_pending()) {
+                upgrade_park(&t->parked, NULL);
+                continue;
+            }
+            tournament_start_round(t, t->current_round);
+        }
+        tournament_wait_round(t);
+        tournament_publish_standings(t, t->current_round);
+
+        t->current_round++;
+        t->phase = TOURNAMENT_ROUND_START;
+        if (tournament_active_players(t) < 2) {
+            printf("[TORNEO] Torneo %d interrotto: giocatori insufficienti\n", t->id);
+            break;
+        }
+    }
+
+    // Comunica a ciascuno la posizione finale
+    tournament_player_t **ranking = malloc(t->n_players * sizeof(tournament_player_t *));
+    tournament_rank(t, ranking);
+    for (int i = 0; i < t->n_players; ++i) {
+        msg_t msg;
+        msg_init(&msg);
+        msg_put_flag(&msg, TOURNAMENT_END);
+        msg_put_int(&msg, i + 1);
+        msg_put_int(&msg, t->n_players);
+        tournament_send(ranking[i], &msg);
+    }
+    free(ranking);
+
+    printf("[TORNEO] Torneo %d concluso\n", t->id);
+    tournament_destroy(t);
+    return NULL;
+}
+
+// Registra il torneo tra quelli attivi e ne avvia il direttore
+void tournament_start_director(tournament_t *t) {
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->round_done, NULL);
+
+    pthread_mutex_lock(&live_lock);
+    t->prev = NULL;
+    t->next = live_tournaments;
+    if (live_tournaments) {
+        live_tournaments->prev = t;
+    }
+    live_tournaments = t;
+    pthread_mutex_unlock(&live_lock);
+
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, tournament_director, t);
+    pthread_detach(thread_id);
+}
+
+// Crea un nuovo torneo e il suo direttore
+tournament_t *tournament_create(void) {
+    tournament_t *t = calloc(1, sizeof(tournament_t));
+    t->id = 1000 + rand() % 9000;
+    t->format = tournament_config.format;
+    t->capacity = tournament_config.capacity;
+    t->players = calloc(t->capacity, sizeof(tournament_player_t));
+    tournament_charge(t, sizeof(tournament_t) + t->capacity * sizeof(tournament_player_t));
+    t->registration_open = 1;
+    t->registration_deadline = time(NULL) + tournament_config.registration_secs;
+    t->phase = TOURNAMENT_REGISTRATION;
+    tournament_start_director(t);
+    printf("[TORNEO] Creato torneo %d\n", t->id);
+    return t;
+}
+
+// Iscrive un giocatore al torneo aperto (creandone uno se necessario)
+void tournament_register(player_t *player) {
+    struct timeval timeout = {TOURNAMENT_SEND_TIMEOUT, 0};
+    setsockopt(player->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    pthread_mutex_lock(&tournament_registry_lock);
+    if (!open_tournament) {
+        open_tournament = tournament_create();
+    }
+    tournament_t *t = open_tournament;
+    tournament_player_t *tp = &t->players[t->n_players];
+    tp->player = player;
+    tp->seed = t->n_players++;
+    t->confirming++;
+    printf("[TORNEO] %s iscritto al torneo %d (%d/%d)\n",
+           player->name, t->id, t->n_players, t->capacity);
+
+    msg_t msg;
+    msg_init(&msg);
+    msg_put_flag(&msg, TOURNAMENT_REGISTERED);
+    msg_put_int(&msg, t->id);
+    msg_put_int(&msg, t->n_players);
+    if (t->n_players == t->capacity) {
+        open_tournament = NULL;
+        pthread_cond_broadcast(&tournament_registry_cond);
+    }
+    pthread_mutex_unlock(&tournament_registry_lock);
+
+    // La conferma parte fuori dal lock, così un client lento non blocca il
+    // direttore; il direttore attende però che confirming torni a 0 prima
+    // di avviare il torneo
+    tournament_send(tp, &msg);
+
+    pthread_mutex_lock(&tournament_registry_lock);
+    t->confirming--;
+    pthread_cond_broadcast(&tournament_registry_cond);
+    pthread_mutex_unlock(&tournament_registry_lock);
+}
+
+// ======================= RIPRESA DOPO UN CRASH =======================
+// All'avvio le partite e le stanze trovate nell'archivio diventano voci
+// in attesa. Un giocatore si ricollega con RESUME_REQUEST indicando l'ID
+// della partita (o della stanza), il proprio nome e il codice di ripresa
+// ricevuto con START_FLAG (o PRIVATE_CREATED): quando entrambi i giocatori
+// sono tornati la partita riparte dalla griglia salvata. Le voci non
+// riprese entro ARENA_RESUME_SECS vengono scartate.
+
+#define ARENA_RESUME_SECS 60 // Tempo concesso ai giocatori per ricollegarsi
+
+// Partita o stanza recuperata dall'archivio
+typedef struct recovered_t {
+    int kind;                         // ARENA_GAME o ARENA_ROOM
+    int slot;                         // Slot dell'archivio
+    int id;                           // ID della partita o della stanza
+    char names[2][MAX_NAME_LEN + 1];  // Giocatori attesi (0 = X o creatore, 1 = O)
+    uint32_t tokens[2];               // Codici di ripresa dei giocatori attesi
+    player_t *players[2];             // Giocatori già ricollegati
+    char table[GRID_SIZE];            // Griglia ricostruita
+    int move_count;                   // Mosse confermate
+    time_t deadline;                  // Scadenza per il ricollegamento
+    struct recovered_t *next;
+} recovered_t;
+
+recovered_t *recovered = NULL; // Voci in attesa (solo thread principale)
+
+// Salva nell'archivio una partita e la griglia corrente
+int arena_save_game(game_t *game) {
+    int slot = arena_alloc(ARENA_GAME, game->game_id, game->player1, game->player2, game->tokens);
+    for (int cell = 0; cell < GRID_SIZE; ++cell) {
+        if (game->table[cell] != ' ') {
+            arena_commit_move(slot, cell, game->table[cell]);
+        }
+    }
+    return slot;
+}
+
+// Aggiunge una voce in attesa e ne salva lo stato nell'archivio
+// (usata dopo un aggiornamento a caldo, che azzera l'archivio)
+void recovered_add(recovered_t *r) {
+    player_t first = {-1, r->names[0], strlen(r->names[0]), NULL, -1};
+    player_t second = {-1, r->names[1], strlen(r->names[1]), NULL, -1};
+    r->slot = arena_alloc(r->kind, r->id, &first, r->kind == ARENA_GAME ? &second : NULL, r->tokens);
+    for (int cell = 0; cell < GRID_SIZE; ++cell) {
+        if (r->table[cell] != ' ') {
+            arena_commit_move(r->slot, cell, r->table[cell]);
+        }
+    }
+    r->next = recovered;
+    recovered = r;
+}
+
+// Ricostruisce le voci in attesa dagli slot occupati dell'archivio
+void arena_recover(void) {
+    if (!arena_slots) {
+        return;
+    }
+    uint64_t start = trace_now();
+    int n_games = 0, n_rooms = 0;
+    for (int slot = 0; slot < ARENA_SLOTS; ++slot) {
+        arena_slot_t *s = &arena_slots[slot];
+        if (s->kind == ARENA_FREE) {
+            continue;
+        }
+        recovered_t *r = calloc(1, sizeof(recovered_t));
+        r->kind = s->kind;
+        r->slot = slot;
+        r->id = s->id;
+        r->move_count = s->seq;
+        r->deadline = time(NULL) + ARENA_RESUME_SECS;
+        memset(r->table, ' ', GRID_SIZE);
+        int valid = (s->kind == ARENA_GAME || s->kind == ARENA_ROOM) && s->seq <= GRID_SIZE;
+        for (int i = 0; i < 2; ++i) {
+            valid = valid && s->name_len[i] <= MAX_NAME_LEN;
+            memcpy(r->names[i], s->names[i], MAX_NAME_LEN);
+            r->names[i][valid ? s->name_len[i] : 0] = '\0';
+            r->tokens[i] = s->tokens[i];
+        }
+        for (uint32_t i = 0; valid && i < s->seq; ++i) {
+            int cell = s->moves[i] >> 8;
+            char symbol = (char)(s->moves[i] & 0xff);
+            valid = cell < GRID_SIZE && r->table[cell] == ' ' && symbol == (i % 2 ? 'O' : 'X');
+            if (valid) {
+                r->table[cell] = symbol;
+            }
+        }
+        // Una partita già conclusa è stata interrotta prima di liberare lo slot
+        if (!valid || (r->kind == ARENA_GAME && check_win(r->table) != GAME_NOT_OVER)) {
+            arena_release(slot);
+            free(r);
+            continue;
+        }
+        r->next = recovered;
+        recovered = r;
+        if (r->kind == ARENA_GAME) {
+            n_games++;
+        } else {
+            n_rooms++;
+        }
+    }
+    printf("[ARENA] Recuperate %d partite e %d stanze in %.2f ms\n",
+           n_games, n_rooms, (trace_now() - start) / 1e6);
+}
+
+// Scarta le voci non riprese in tempo
+void arena_expire(void) {
+    time_t now = time(NULL);
+    recovered_t **link = &recovered;
+    while (*link) {
+        recovered_t *r = *link;
+        if (r->deadline > now) {
+            link = &r->next;
+            continue;
+        }
+        printf("[ARENA] %s %d non ripresa in tempo, scartata\n",
+               r->kind == ARENA_GAME ? "Partita" : "Stanza", r->id);
+        for (int i = 0; i < 2; ++i) {
+            if (r->players[i]) {
+                send(r->players[i]->socket, &RESUME_REJECTED, sizeof(int), MSG_NOSIGNAL);
+                close(r->players[i]->socket);
+                delete_player(r->players[i]);
+            }
+        }
+        arena_release(r->slot);
+        *link = r->next;
+        free(r);
+    }
+}
+
+// Ricollega un giocatore alla partita o alla stanza recuperata con l'ID dato.
+// Nome e codice di ripresa devono coincidere con quelli del posto salvato.
+void arena_resume(player_t *player, int id, uint32_t token) {
+    recovered_t **link = &recovered;
+    int side = -1;
+    for (; *link; link = &(*link)->next) {
+        recovered_t *r = *link;
+        if (r->id != id) {
+            continue;
+        }
+        for (int i = 0; i < (r->kind == ARENA_GAME ? 2 : 1); ++i) {
+            if (!r->players[i] && r->tokens[i] == token && strcmp(r->names[i], player->name) == 0) {
+                side = i;
+                break;
+            }
+        }
+        if (side >= 0) {
+            break;
+        }
+    }
+    if (side < 0) {
+        printf("[ARENA] Nessuna partita o stanza %d da riprendere per %s\n", id, player->name);
+        send(player->socket, &RESUME_REJECTED, sizeof(int), 0);
+        close(player->socket);
+        delete_player(player);
+        return;
+    }
+
+    recovered_t *r = *link;
+    if (r->kind == ARENA_ROOM) {
+        // La stanza torna disponibile con il nuovo socket del creatore
+        private_room_t *room = calloc(1, sizeof(private_room_t));
+        room->id = r->id;
+        room->creator = player;
+        room->arena_slot = r->slot;
+        room->token = r->tokens[0];
+        if (add_private_room(room) < 0) {
+            printf("[ARENA] Stanza %d non ripresa: nessun posto libero\n", r->id);
+            arena_release(r->slot);
+            free(room);
+            send(player->socket, &RESUME_REJECTED, sizeof(int), 0);
+            close(player->socket);
+            delete_player(player);
+            *link = r->next;
+            free(r);
+            return;
+        }
+        int reply[3] = {PRIVATE_CREATED, htonl(r->id), htonl(room->token)};
+        send(player->socket, reply, sizeof(reply), 0);
+        printf("[ARENA] Stanza %d ripresa da %s\n", r->id, player->name);
+    } else {
+        r->players[side] = player;
+        if (!r->players[!side]) {
+            printf("[ARENA] %s ricollegato alla partita %d, in attesa dell'avversario\n",
+                   player->name, r->id);
+            send(player->socket, &WAIT_FLAG, sizeof(int), 0);
+            return;
+        }
+        // Entrambi i giocatori sono tornati: la partita riparte dalla griglia salvata
+        game_t *game = create_game(r->players[0], r->players[1]);
+        game->game_id = r->id;
+        memcpy(game->table, r->table, GRID_SIZE);
+        game->move_count = r->move_count;
+        game->turn = r->move_count % 2;
+        game->arena_slot = r->slot;
+        memcpy(game->tokens, r->tokens, sizeof(game->tokens));
+        printf("[ARENA] Partita %d ripresa dalla mossa %d\n", r->id, r->move_count);
+        start_game_fiber(game);
+    }
+    *link = r->next;
+    free(r);
+}
+
+// ======================= APPROVAZIONE NELLE STANZE =======================
+// Una richiesta di unirsi a una stanza resta in sospeso nella stanza
+// (room->joiner) mentre il ciclo principale continua ad accettare
+// connessioni: accept_client controlla i socket dei creatori e consegna
+// la risposta a room_creator_readable. Una stanza gestisce una richiesta
+// alla volta; senza risposta entro JOIN_APPROVAL_SECS il giocatore viene
+// rifiutato e la stanza resta aperta.
+
+#define JOIN_APPROVAL_SECS 30 // Tempo concesso al creatore per rispondere
+
+// Il creatore di una stanza ha scritto: risposta alla richiesta in corso,
+// risposta arrivata dopo la scadenza (ignorata) o disconnessione
+void room_creator_readable(private_room_t *room) {
+    int response;
+    ssize_t n = capture_recv(room->creator->socket, &response, sizeof(int), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n != sizeof(int)) {
+        // Disconnesso (o messaggio troncato): la stanza si chiude
+        player_t *creator = room->creator;
+        printf("[ROOM] %s ha lasciato la stanza %d\n", creator->name, room->id);
+        remove_room_by_id(room->id);
+        close(creator->socket);
+        delete_player(creator);
+        return;
+    }
+    if (!room->joiner) {
+        return; // Risposta a una richiesta già scaduta
+    }
+
+    player_t *joiner = room->joiner;
+    if (response == JOIN_ACCEPTED) {
+        printf("[SERVER] Join accettato per %s\n", joiner->name);
+        room->joiner = NULL;
+        send(joiner->socket, &JOIN_ACCEPTED, sizeof(int), 0);
+
+        // Crea una fibra per la partita
+        start_game_fiber(create_game(room->creator, joiner));
+
+        // Rimuovi la stanza (ora la partita è iniziata)
+        remove_room_by_id(room->id);
+    } else {
+        printf("[SERVER] Join rifiutato per %s\n", joiner->name);
+        room_reject_joiner(room);
+    }
+}
+
+// Rifiuta le richieste rimaste senza risposta e avvisa i creatori
+void room_expire_joins(void) {
+    time_t now = time(NULL);
+    for (int i = 0; i < MAX_ROOMS; ++i) {
+        private_room_t *room = private_rooms[i];
+        if (room && room->joiner && room->join_deadline <= now) {
+            printf("[ROOM] %s non ha risposto in tempo a %s\n", room->creator->name, room->joiner->name);
+            send(room->creator->socket, &JOIN_EXPIRED, sizeof(int), MSG_NOSIGNAL);
+            room_reject_joiner(room);
+        }
+    }
+}
+
+// ======================= AGGIORNAMENTO A CALDO =======================
+// Un nuovo eseguibile avviato con --takeover si collega al socket Unix del
+// processo in esecuzione. Il vecchio processo ferma partite, direttori di
+// torneo e worker nei rispettivi punti di sosta, serializza lo stato e
+// passa il socket di ascolto e tutti i socket dei client con SCM_RIGHTS.
+// Il nuovo processo ricostruisce lo stato e riprende ogni partita a metà
+// turno: i client restano collegati agli stessi socket e non notano nulla.
+// Se il trasferimento fallisce il vecchio processo riprende da dove era.
+
+#define UPGRADE_MAGIC 0x54524953      // "TRIS"
+#define UPGRADE_VERSION 6             // Versione del formato serializzato
+#define UPGRADE_PARK_TIMEOUT_MS 2000  // Tempo massimo per fermare tutti i thread
+#define UPGRADE_FDS_PER_MSG 250       // Descrittori per messaggio (limite SCM_MAX_FD)
+#define UPGRADE_DEFAULT_PATH "/tmp/tris_upgrade.sock"
+
+const char *upgrade_path = UPGRADE_DEFAULT_PATH; // TRIS_UPGRADE_SOCKET
+int upgrade_listen_fd = -1;                      // Socket Unix per le richieste
+player_t *waiting_player = NULL;                 // Giocatore in attesa di un avversario casuale
+
+// Buffer dello stato serializzato e dei descrittori che lo accompagnano
+typedef struct blob_t {
+    char *data;     // Byte serializzati
+    size_t len;     // Byte scritti
+    size_t cap;     // Capacità del buffer
+    size_t pos;     // Posizione di lettura
+    int *fds;       // Descrittori da trasferire
+    int n_fds;      // Numero di descrittori
+    int cap_fds;    // Capacità dell'array dei descrittori
+    int error;      // 1 se la lettura ha superato la fine del buffer
+} blob_t;
+
+void blob_put(blob_t *b, const void *src, size_t n) {
+    if (b->len + n > b->cap) {
+        b->cap = (b->len + n) * 2;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+}
+
+void blob_put_int(blob_t *b, int32_t value) {
+    blob_put(b, &value, sizeof(value));
+}
+
+// Accoda un descrittore: nel buffer resta solo il suo indice
+void blob_put_fd(blob_t *b, int fd) {
+    if (b->n_fds == b->cap_fds) {
+        b->cap_fds = b->cap_fds ? b->cap_fds * 2 : 64;
+        b->fds = realloc(b->fds, b->cap_fds * sizeof(int));
+    }
+    blob_put_int(b, b->n_fds);
+    b->fds[b->n_fds++] = fd;
+}
+
+void blob_put_player(blob_t *b, const player_t *player) {
+    blob_put_int(b, player->name_len);
+    blob_put(b, player->name, player->name_len);
+    // Il nuovo processo non ha sessioni UDP: passa la connessione TCP
+    blob_put_fd(b, player->udp_control >= 0 ? player->udp_control : player->socket);
+}
+
+void blob_get(blob_t *b, void *dst, size_t n) {
+    if (b->error || b->pos + n > b->len) {
+        b->error = 1;
+        memset(dst, 0, n);
+        return;
+    }
+    memcpy(dst, b->data + b->pos, n);
+    b->pos += n;
+}
+
+int32_t blob_get_int(blob_t *b) {
+    int32_t value;
+    blob_get(b, &value, sizeof(value));
+    return value;
+}
+
+int blob_get_fd(blob_t *b) {
+    int32_t index = blob_get_int(b);
+    if (index < 0 || index >= b->n_fds) {
+        b->error = 1;
+        return -1;
+    }
+    return b->fds[index];
+}
+
+player_t *blob_get_player(blob_t *b) {
+    int name_len = blob_get_int(b);
+    if (name_len < 0 || b->pos + name_len > b->len) {
+        b->error = 1;
+        return NULL;
+    }
+    char *name = malloc(name_len + 1);
+    blob_get(b, name, name_len);
+    name[name_len] = '\0';
+    return create_player(blob_get_fd(b), name, name_len);
+}
+
+void blob_free(blob_t *b) {
+    free(b->data);
+    free(b->fds);
+}
+
+// 1 se tutti i thread con stato da trasferire sono fermi (chiamata con live_lock)
+int upgrade_all_parked(void) {
+    for (int i = 0; i < fiber_n_threads; ++i) {
+        if (!fiber_threads[i].parked) {
+            return 0;
+        }
+    }
+    for (tournament_t *t = live_tournaments; t; t = t->next) {
+        if (!t->parked) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < engine_n_workers; ++i) {
+        if (!engine_workers[i].parked) {
+            return 0;
+        }
+    }
+    return lobby_parked && udp_parked;
+}
+
+// Ferma tutti i thread nei punti di sosta (0 = fermi, -1 = tempo scaduto)
+int upgrade_quiesce(void) {
+    pthread_mutex_lock(&live_lock);
+    __atomic_store_n(&upgrade_state, UPGRADE_IN_PROGRESS, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&live_lock);
+
+    uint64_t one = 1;
+    if (write(upgrade_fd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+
+    // I direttori attendono su condition variable: vanno risvegliati
+    pthread_mutex_lock(&tournament_registry_lock);
+    pthread_cond_broadcast(&tournament_registry_cond);
+    pthread_mutex_unlock(&tournament_registry_lock);
+
+    pthread_mutex_lock(&live_lock);
+    for (tournament_t *t = live_tournaments; t; t = t->next) {
+        pthread_mutex_lock(&t->lock);
+        pthread_cond_broadcast(&t->round_done);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += UPGRADE_PARK_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (UPGRADE_PARK_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    int result = 0;
+    while (!upgrade_all_parked()) {
+        if (pthread_cond_timedwait(&live_cond, &live_lock, &deadline) == ETIMEDOUT) {
+            result = upgrade_all_parked() ? 0 : -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&live_lock);
+    return result;
+}
+
+// Annulla l'aggiornamento: i thread fermi ripartono
+void upgrade_resume(void) {
+    uint64_t value;
+    if (read(upgrade_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        perror("read eventfd");
+    }
+    pthread_mutex_lock(&live_lock);
+    __atomic_store_n(&upgrade_state, UPGRADE_IDLE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&live_cond);
+    pthread_mutex_unlock(&live_lock);
+}
+
+// Serializza una partita del motore
+void upgrade_put_match(blob_t *b, const match_t *match, int started) {
+    blob_put_int(b, started);
+    blob_put_int(b, match->game_id);
+    for (int side = 0; side < 2; ++side) {
+        blob_put_int(b, match->side[side]);
+        blob_put_int(b, match->dropped[side]);
+    }
+    blob_put(b, match->table, GRID_SIZE);
+    blob_put_int(b, match->turn);
+    blob_put_int(b, match->move_count);
+    blob_put_int(b, match->move_len);
+    blob_put(b, match->move_buf, sizeof(match->move_buf));
+}
+
+// Serializza le partite del motore appartenenti a un torneo
+void upgrade_put_matches(blob_t *b, const tournament_t *t) {
+    int count = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            blob_put_int(b, count);
+        }
+        for (int i = 0; i < engine_n_workers; ++i) {
+            for (int started = 0; started < 2; ++started) {
+                match_t *match = started ? engine_workers[i].active : engine_workers[i].incoming;
+                for (; match; match = match->next) {
+                    if (match->tournament != t) {
+                        continue;
+                    }
+                    if (pass == 0) {
+                        count++;
+                    } else {
+                        upgrade_put_match(b, match, started);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Serializza un torneo con iscritti e partite in corso
+void upgrade_put_tournament(blob_t *b, const tournament_t *t) {
+    blob_put_int(b, t->id);
+    blob_put_int(b, t->format);
+    blob_put_int(b, t->capacity);
+    blob_put_int(b, t->n_players);
+    blob_put_int(b, t->registration_open);
+    blob_put_int(b, open_tournament == t);
+    int64_t deadline = t->registration_deadline;
+    blob_put(b, &deadline, sizeof(deadline));
+    blob_put_int(b, t->rounds);
+    blob_put_int(b, t->phase);
+    blob_put_int(b, t->current_round);
+    blob_put_int(b, t->pending);
+
+    for (int i = 0; i < t->n_players; ++i) {
+        const tournament_player_t *tp = &t->players[i];
+        blob_put_player(b, tp->player);
+        blob_put_int(b, tp->seed);
+        blob_put_int(b, tp->score2);
+        blob_put_int(b, tp->wins);
+        blob_put_int(b, tp->games_as_x);
+        blob_put_int(b, tp->had_bye);
+        blob_put_int(b, tp->withdrawn);
+        blob_put_int(b, tp->n_opponents);
+        for (int k = 0; k < tp->n_opponents; ++k) {
+            blob_put_int(b, tp->opponents[k]);
+            blob_put_int(b, tp->results[k]);
+        }
+    }
+    upgrade_put_matches(b, t);
+}
+
+// Serializza l'intero stato del server (con tutti i thread fermi)
+void upgrade_serialize(blob_t *b, int server_socket) {
+    blob_put_int(b, UPGRADE_MAGIC);
+    blob_put_int(b, UPGRADE_VERSION);
+    blob_put_fd(b, server_socket);
+
+    int n_rooms = 0;
+    for (int i = 0; i < MAX_ROOMS; ++i) {
+        n_rooms += private_rooms[i] != NULL;
+    }
+    blob_put_int(b, n_rooms);
+    for (int i = 0; i < MAX_ROOMS; ++i) {
+        if (private_rooms[i]) {
+            blob_put_int(b, private_rooms[i]->id);
+            blob_put_int(b, (int)private_rooms[i]->token);
+            blob_put_player(b, private_rooms[i]->creator);
+            // Richiesta di unirsi ancora senza risposta
+            blob_put_int(b, private_rooms[i]->joiner != NULL);
+            if (private_rooms[i]->joiner) {
+                int64_t deadline = private_rooms[i]->join_deadline;
+                blob_put_player(b, private_rooms[i]->joiner);
+                blob_put(b, &deadline, sizeof(deadline));
+            }
+        }
+    }
+
+    blob_put_int(b, waiting_player != NULL);
+    if (waiting_player) {
+        blob_put_player(b, waiting_player);
+    }
+
+    // Iscritti alla lobby (anche quelli in attesa dello stato completo):
+    // il nuovo processo invia a tutti l'elenco aggiornato
+    int n_subscribers = 0;
+    for (lobby_subscriber_t *sub = lobby_subscribers; sub; sub = sub->next) {
+        n_subscribers++;
+    }
+    for (lobby_subscriber_t *sub = lobby_incoming; sub; sub = sub->next) {
+        n_subscribers++;
+    }
+    blob_put_int(b, n_subscribers);
+    for (lobby_subscriber_t *sub = lobby_subscribers; sub; sub = sub->next) {
+        blob_put_player(b, sub->player);
+    }
+    for (lobby_subscriber_t *sub = lobby_incoming; sub; sub = sub->next) {
+        blob_put_player(b, sub->player);
+    }
+
+    // Partite e stanze recuperate da un crash e non ancora riprese
+    int n_recovered = 0;
+    for (recovered_t *r = recovered; r; r = r->next) {
+        n_recovered++;
+    }
+    blob_put_int(b, n_recovered);
+    for (recovered_t *r = recovered; r; r = r->next) {
+        blob_put_int(b, r->kind);
+        blob_put_int(b, r->id);
+        blob_put(b, r->names, sizeof(r->names));
+        blob_put(b, r->tokens, sizeof(r->tokens));
+        blob_put(b, r->table, GRID_SIZE);
+        blob_put_int(b, r->move_count);
+        int64_t deadline = r->deadline;
+        blob_put(b, &deadline, sizeof(deadline));
+        for (int i = 0; i < 2; ++i) {
+            blob_put_int(b, r->players[i] != NULL);
+            if (r->players[i]) {
+                blob_put_player(b, r->players[i]);
+            }
+        }
+    }
+
+    int n_games = 0;
+    for (game_t *game = live_games; game; game = game->next) {
+        n_games++;
+    }
+    blob_put_int(b, n_games);
+    for (game_t *game = live_games; game; game = game->next) {
+        blob_put_int(b, game->game_id);
+        blob_put_player(b, game->player1);
+        blob_put_player(b, game->player2);
+        blob_put(b, game->tokens, sizeof(game->tokens));
+        blob_put(b, game->table, GRID_SIZE);
+        blob_put_int(b, game->turn);
+        blob_put_int(b, game->move_count);
+        blob_put_int(b, (game->player1->udp_control >= 0) | (game->player2->udp_control >= 0) << 1);
+    }
+
+    int n_tournaments = 0;
+    for (tournament_t *t = live_tournaments; t; t = t->next) {
+        n_tournaments++;
+    }
+    blob_put_int(b, n_tournaments);
+    for (tournament_t *t = live_tournaments; t; t = t->next) {
+        upgrade_put_tournament(b, t);
+    }
+}
+
+// Ricostruisce un torneo e ne riavvia direttore e partite
+void upgrade_restore_tournament(blob_t *b) {
+    tournament_t *t = calloc(1, sizeof(tournament_t));
+    t->id = blob_get_int(b);
+    t->format = blob_get_int(b);
+    t->capacity = blob_get_int(b);
+    t->n_players = blob_get_int(b);
+    t->registration_open = blob_get_int(b);
+    int is_open = blob_get_int(b);
+    int64_t deadline;
+    blob_get(b, &deadline, sizeof(deadline));
+    t->registration_deadline = (time_t)deadline;
+    t->rounds = blob_get_int(b);
+    t->phase = blob_get_int(b);
+    t->current_round = blob_get_int(b);
+    int pending = blob_get_int(b);
+    if (b->error || t->capacity < t->n_players || t->n_players < 0) {
+        b->error = 1;
+        free(t);
+        return;
+    }
+
+    t->players = calloc(t->capacity, sizeof(tournament_player_t));
+    tournament_charge(t, sizeof(tournament_t) + t->capacity * sizeof(tournament_player_t));
+    if (t->phase != TOURNAMENT_REGISTRATION) {
+        tournament_charge(t, (long)t->n_players * 2 * t->rounds * sizeof(int));
+    }
+    for (int i = 0; i < t->n_players; ++i) {
+        tournament_player_t *tp = &t->players[i];
+        tp->player = blob_get_player(b);
+        tp->seed = blob_get_int(b);
+        tp->score2 = blob_get_int(b);
+        tp->wins = blob_get_int(b);
+        tp->games_as_x = blob_get_int(b);
+        tp->had_bye = blob_get_int(b);
+        tp->withdrawn = blob_get_int(b);
+        tp->n_opponents = blob_get_int(b);
+        if (t->phase != TOURNAMENT_REGISTRATION) {
+            tp->opponents = malloc(t->rounds * sizeof(int));
+            tp->results = malloc(t->rounds * sizeof(int));
+        }
+        if (tp->n_opponents < 0 || tp->n_opponents > t->rounds) {
+            b->error = 1;
+            return;
+        }
+        for (int k = 0; k < tp->n_opponents; ++k) {
+            tp->opponents[k] = blob_get_int(b);
+            tp->results[k] = blob_get_int(b);
+        }
+    }
+
+    int n_matches = blob_get_int(b);
+    match_t **matches = malloc((n_matches + 1) * sizeof(match_t *));
+    for (int i = 0; i < n_matches && !b->error; ++i) {
+        match_t *match = calloc(1, sizeof(match_t));
+        mem_charge(MEM_GAMES, sizeof(match_t));
+        match->tournament = t;
+        match->resumed = blob_get_int(b);
+        match->game_id = blob_get_int(b);
+        for (int side = 0; side < 2; ++side) {
+            match->side[side] = blob_get_int(b);
+            match->dropped[side] = blob_get_int(b);
+            if (match->side[side] < 0 || match->side[side] >= t->n_players) {
+                b->error = 1;
+                match->side[side] = 0;
+            }
+            match->players[side] = t->players[match->side[side]].player;
+        }
+        blob_get(b, match->table, GRID_SIZE);
+        match->turn = blob_get_int(b) != 0;
+        match->move_count = blob_get_int(b);
+        match->move_len = blob_get_int(b);
+        blob_get(b, match->move_buf, sizeof(match->move_buf));
+        matches[i] = match;
+    }
+    printf("[UPGRADE] Torneo %d ripreso: %d iscritti, turno %d, %d partite\n",
+           t->id, t->n_players, t->current_round, n_matches);
+
+    t->pending = pending;
+    if (t->phase == TOURNAMENT_REGISTRATION && is_open) {
+        pthread_mutex_lock(&tournament_registry_lock);
+        open_tournament = t;
+        pthread_mutex_unlock(&tournament_registry_lock);
+    }
+    tournament_start_director(t);
+    if (n_matches > 0) {
+        engine_submit_batch(matches, n_matches);
+    }
+    free(matches);
+}
+
+// Ricostruisce lo stato ricevuto e riavvia partite e tornei
+// (restituisce il socket di ascolto, -1 se lo stato non è valido)
+int upgrade_restore(blob_t *b) {
+    if (blob_get_int(b) != UPGRADE_MAGIC || blob_get_int(b) != UPGRADE_VERSION) {
+        return -1;
+    }
+    int server_socket = blob_get_fd(b);
+
+    int n_rooms = blob_get_int(b);
+    for (int i = 0; i < n_rooms && !b->error; ++i) {
+        private_room_t *room = calloc(1, sizeof(private_room_t));
+        room->id = blob_get_int(b);
+        room->token = (uint32_t)blob_get_int(b);
+        room->creator = blob_get_player(b);
+        if (blob_get_int(b)) {
+            int64_t deadline;
+            room->joiner = blob_get_player(b);
+            blob_get(b, &deadline, sizeof(deadline));
+            room->join_deadline = (time_t)deadline;
+        }
+        room->arena_slot = room->creator
+            ? arena_alloc(ARENA_ROOM, room->id, room->creator, NULL, &room->token) : -1;
+        if (add_private_room(room) < 0) {
+            arena_release(room->arena_slot);
+            if (room->joiner) {
+                room_reject_joiner(room);
+            }
+            if (room->creator) {
+                close(room->creator->socket);
+                delete_player(room->creator);
+            }
+            free(room);
+        }
+    }
+
+    if (blob_get_int(b)) {
+        waiting_player = blob_get_player(b);
+    }
+
+    int n_subscribers = blob_get_int(b);
+    for (int i = 0; i < n_subscribers && !b->error; ++i) {
+        player_t *player = blob_get_player(b);
+        if (player) {
+            lobby_subscribe(player);
+        }
+    }
+
+    int n_recovered = blob_get_int(b);
+    for (int i = 0; i < n_recovered && !b->error; ++i) {
+        recovered_t *r = calloc(1, sizeof(recovered_t));
+        r->kind = blob_get_int(b);
+        r->id = blob_get_int(b);
+        blob_get(b, r->names, sizeof(r->names));
+        r->names[0][MAX_NAME_LEN] = r->names[1][MAX_NAME_LEN] = '\0';
+        blob_get(b, r->tokens, sizeof(r->tokens));
+        blob_get(b, r->table, GRID_SIZE);
+        r->move_count = blob_get_int(b);
+        int64_t deadline;
+        blob_get(b, &deadline, sizeof(deadline));
+        r->deadline = (time_t)deadline;
+        for (int side = 0; side < 2; ++side) {
+            if (blob_get_int(b)) {
+                r->players[side] = blob_get_player(b);
+            }
+        }
+        recovered_add(r);
+    }
+
+    int n_games = blob_get_int(b);
+    for (int i = 0; i < n_games && !b->error; ++i) {
+        int game_id = blob_get_int(b);
+        player_t *player1 = blob_get_player(b);
+        player_t *player2 = blob_get_player(b);
+        if (!player1 || !player2) {
+            break;
+        }
+        game_t *game = create_game(player1, player2);
+        game->game_id = game_id;
+        blob_get(b, game->tokens, sizeof(game->tokens));
+        blob_get(b, game->table, GRID_SIZE);
+        game->turn = blob_get_int(b) != 0;
+        game->move_count = blob_get_int(b);
+        game->resync = blob_get_int(b);
+        game->resumed = 1;
+        start_game_fiber(game);
+    }
+
+    int n_tournaments = blob_get_int(b);
+    for (int i = 0; i < n_tournaments && !b->error; ++i) {
+        upgrade_restore_tournament(b);
+    }
+
+    printf("[UPGRADE] Ripristinate %d stanze, %d partite, %d tornei%s\n", n_rooms, n_games,
+           n_tournaments, waiting_player ? ", 1 giocatore in attesa" : "");
+    return b->error ? -1 : server_socket;
+}
+
+// Invia stato e descrittori al nuovo processo
+int upgrade_send(int conn, const blob_t *b) {
+    int32_t header[4] = {UPGRADE_MAGIC, UPGRADE_VERSION, (int32_t)b->len, b->n_fds};
+    if (send_all(conn, header, sizeof(header)) < 0 || send_all(conn, b->data, b->len) < 0) {
+        return -1;
+    }
+
+    for (int first = 0; first < b->n_fds; first += UPGRADE_FDS_PER_MSG) {
+        int count = b->n_fds - first < UPGRADE_FDS_PER_MSG ? b->n_fds - first : UPGRADE_FDS_PER_MSG;
+        char control[CMSG_SPACE(UPGRADE_FDS_PER_MSG * sizeof(int))];
+        memset(control, 0, sizeof(control));
+        char byte = 0;
+        struct iovec iov = {&byte, 1};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(c), b->fds + first, count * sizeof(int));
+        if (sendmsg(conn, &msg, MSG_NOSIGNAL) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Riceve stato e descrittori dal vecchio processo
+int upgrade_receive(int conn, blob_t *b) {
+    int32_t header[4];
+    if (recv(conn, header, sizeof(header), MSG_WAITALL) != sizeof(header) ||
+        header[0] != UPGRADE_MAGIC || header[1] != UPGRADE_VERSION || header[2] < 0 || header[3] < 0) {
+        return -1;
+    }
+    b->len = b->cap = header[2];
+    b->data = malloc(b->len + 1);
+    if (b->len > 0 && recv(conn, b->data, b->len, MSG_WAITALL) != (ssize_t)b->len) {
+        return -1;
+    }
+
+    b->cap_fds = header[3];
+    b->fds = malloc((b->cap_fds + 1) * sizeof(int));
+    while (b->n_fds < header[3]) {
+        char control[CMSG_SPACE(UPGRADE_FDS_PER_MSG * sizeof(int))];
+        char byte;
+        struct iovec iov = {&byte, 1};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn, &msg, MSG_WAITALL) != 1) {
+            return -1;
+        }
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (b->n_fds + count > header[3]) {
+                return -1;
+            }
+            memcpy(b->fds + b->n_fds, CMSG_DATA(c), count * sizeof(int));
+            b->n_fds += count;
+        }
+    }
+    return 0;
+}
+
+// Apre il socket Unix su cui arrivano le richieste di aggiornamento
+void upgrade_listen(void) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, upgrade_path, sizeof(addr.sun_path) - 1);
+
+    // Il file rimasto da un server terminato non risponde più (vedi upgrade_server_running)
+    upgrade_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(upgrade_path);
+    if (upgrade_listen_fd < 0 ||
+        bind(upgrade_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(upgrade_path, 0600) < 0 ||
+        listen(upgrade_listen_fd, 1) < 0) {
+        perror("[UPGRADE] socket di aggiornamento");
+        if (upgrade_listen_fd >= 0) {
+            close(upgrade_listen_fd);
+        }
+        upgrade_listen_fd = -1;
+        return;
+    }
+    printf("[UPGRADE] Aggiornamento a caldo disponibile su %s\n", upgrade_path);
+}
+
+// 1 se un server in esecuzione risponde sul socket di aggiornamento
+int upgrade_server_running(void) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, upgrade_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int running = fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return running;
+}
+
+// Vecchio processo: gestisce una richiesta di aggiornamento. Se il
+// trasferimento riesce il processo termina, altrimenti riprende a servire.
+void upgrade_handle_request(int server_socket) {
+    int conn = accept(upgrade_listen_fd, NULL, NULL);
+    if (conn < 0) {
+        return;
+    }
+    // Il subentro consegna tutti i socket dei client: solo lo stesso utente può chiederlo
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 || cred.uid != geteuid()) {
+        printf("[UPGRADE] Richiesta rifiutata: utente diverso da quello del server\n");
+        close(conn);
+        return;
+    }
+    int32_t request;
+    if (recv(conn, &request, sizeof(request), MSG_WAITALL) != sizeof(request) ||
+        request != UPGRADE_MAGIC) {
+        close(conn);
+        return;
+    }
+
+    uint64_t start = trace_now();
+    printf("[UPGRADE] Richiesta di aggiornamento a caldo ricevuta\n");
+    if (upgrade_quiesce() < 0) {
+        printf("[UPGRADE] Impossibile fermare tutti i thread, aggiornamento annullato\n");
+        upgrade_resume();
+        close(conn);
+        return;
+    }
+
+    // Con le partite ferme le statistiche non cambiano: il nuovo processo le ricarica
+    stats_save();
+    blob_t b = {0};
+    upgrade_serialize(&b, server_socket);
+    int32_t ack = 0;
+    if (upgrade_send(conn, &b) < 0 ||
+        recv(conn, &ack, sizeof(ack), MSG_WAITALL) != sizeof(ack) || ack != UPGRADE_MAGIC) {
+        printf("[UPGRADE] Trasferimento fallito, il server continua\n");
+        blob_free(&b);
+        upgrade_resume();
+        close(conn);
+        return;
+    }
+
+    printf("[UPGRADE] Stato trasferito (%zu byte, %d socket) in %.2f ms, uscita\n",
+           b.len, b.n_fds, (trace_now() - start) / 1e6);
+    trace_flush(&trace_file);
+    capture_flush();
+    _exit(EXIT_SUCCESS);
+}
+
+// Nuovo processo: riceve lo stato dal processo in esecuzione e lo riprende
+// (restituisce il socket di ascolto ereditato)
+int upgrade_takeover(void) {
+    uint64_t start = trace_now();
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, upgrade_path, sizeof(addr.sun_path) - 1);
+
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("[UPGRADE] connessione al server in esecuzione");
+        exit(EXIT_FAILURE);
+    }
+    int32_t request = UPGRADE_MAGIC;
+    blob_t b = {0};
+    if (send_all(conn, &request, sizeof(request)) < 0 || upgrade_receive(conn, &b) < 0) {
+        printf("[UPGRADE] Ricezione dello stato fallita\n");
+        exit(EXIT_FAILURE);
+    }
+    stats_load();
+
+    // Conferma prima di ripartire: da qui il vecchio processo termina
+    // e i socket sono serviti soltanto da questo processo
+    int32_t ack = UPGRADE_MAGIC;
+    if (send_all(conn, &ack, sizeof(ack)) < 0) {
+        printf("[UPGRADE] Conferma non inviata, il vecchio server continua\n");
+        exit(EXIT_FAILURE);
+    }
+    close(conn);
+
+    // L'archivio del vecchio processo si azzera solo ora: se il passaggio
+    // fallisce prima della conferma, le sue partite restano intatte
+    arena_open(0);
+    int server_socket = upgrade_restore(&b);
+    if (server_socket < 0) {
+        printf("[UPGRADE] Stato ricevuto non valido\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("[UPGRADE] Subentro completato in %.2f ms (%zu byte, %d socket)\n",
+           (trace_now() - start) / 1e6, b.len, b.n_fds);
+    blob_free(&b);
+    return server_socket;
+}
+
+// Il giocatore in attesa di una partita casuale non deve inviare nulla:
+// un socket leggibile significa che si è disconnesso
+void drop_waiting_player(void) {
+    player_t *player = waiting_player;
+    waiting_player = NULL;
+    printf("[SERVER] %s ha lasciato l'attesa di un avversario\n", player->name);
+    capture_data(player->socket, NULL, 0);
+    close(player->socket);
+    delete_player(player);
+}
+
+// Accetta una connessione servendo nel frattempo le richieste di aggiornamento,
+// il giocatore in attesa di una partita casuale e i creatori delle stanze
+int accept_client(int server_socket) {
+    while (1) {
+        struct pollfd fds[3 + MAX_ROOMS] = {{server_socket, POLLIN, 0}, {upgrade_listen_fd, POLLIN, 0},
+                                            {waiting_player ? waiting_player->socket : -1, POLLIN, 0}};
+        int pending_joins = 0;
+        for (int i = 0; i < MAX_ROOMS; ++i) {
+            fds[3 + i].fd = private_rooms[i] ? private_rooms[i]->creator->socket : -1;
+            fds[3 + i].events = POLLIN;
+            pending_joins += private_rooms[i] && private_rooms[i]->joiner;
+        }
+        // Con partite recuperate o richieste in sospeso si controllano le scadenze ogni secondo
+        if (poll(fds, 3 + MAX_ROOMS, recovered || pending_joins ? 1000 : -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (recovered) {
+            arena_expire();
+        }
+        if (pending_joins) {
+            room_expire_joins();
+        }
+        if (fds[1].revents & POLLIN) {
+            upgrade_handle_request(server_socket);
+        }
+        if (fds[2].revents && waiting_player && waiting_player->socket == fds[2].fd) {
+            drop_waiting_player();
+        }
+        for (int i = 0; i < MAX_ROOMS; ++i) {
+            if (fds[3 + i].revents && private_rooms[i] && private_rooms[i]->creator->socket == fds[3 + i].fd) {
+                room_creator_readable(private_rooms[i]);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            struct sockaddr_in client;
+            socklen_t len = sizeof(client);
+            int client_socket = accept(server_socket, (struct sockaddr *)&client, &len);
+            // I messaggi sono composti da più send piccole: con l'algoritmo di Nagle
+            // le successive aspetterebbero l'ACK ritardato del client (fino a 40 ms)
+            int nodelay = 1;
+            if (client_socket >= 0) {
+                setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+                mem_limit_socket(client_socket);
+                capture_open(client_socket);
+            }
+            return client_socket;
+        }
+    }
+}
+
+// Modalità gioco normale: il primo giocatore resta in waiting_player mentre
+// il ciclo principale continua a servire connessioni di ogni tipo; il
+// giocatore casuale successivo viene abbinato a lui
+void match_random_player(player_t *player) {
+    if (!waiting_player) {
+        printf("[SERVER] Giocatore 1 connesso: %s, in attesa del secondo giocatore...\n", player->name);
+        send(player->socket, &WAIT_FLAG, sizeof(int), 0);
+        waiting_player = player;
+        return;
+    }
+    player_t *player1 = waiting_player;
+    player_t *player2 = player;
+    waiting_player = NULL;
+    printf("[SERVER] Giocatore 2 connesso: %s\n", player2->name);
+
+    // Crea una fibra per la partita (i giocatori appartengono poi alla fibra,
+    // che li libera a fine partita: il log va scritto prima)
+    printf("[SERVER] Partita avviata tra %s e %s\n", player1->name, player2->name);
+    start_game_fiber(create_game(player1, player2));
+}
+
+// ======================= SEGNALI =======================
+// I segnali asincroni sono bloccati in tutti i thread e gestiti qui con
+// sigwait, così i gestori possono usare lock e I/O senza restrizioni.
+
+// Thread che riceve i segnali del server
+void *signal_thread_main(void *arg) {
+    sigset_t *signals = (sigset_t *)arg;
+    while (RUNNING) {
+        int sig;
+        if (sigwait(signals, &sig) != 0) {
+            continue;
+        }
+        if (sig == SIGUSR2) {
+            trace_toggle();
+        } else if (sig == SIGUSR1) {
+            mem_report();
+        } else if (sig == SIGINT || sig == SIGTERM) {
+            printf("[SERVER] Ricevuto segnale %d, arresto\n", sig);
+            trace_flush(&trace_file);
+            capture_flush();
+            stats_save();
+            exit(EXIT_SUCCESS);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    // Log riga per riga: con stdout senza buffer printf formatta in un buffer
+    // di 8 KB sullo stack, che peserebbe su ogni fibra (vedi FIBRE)
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("[SERVER] Avvio server...\n");
+    srand(time(NULL));
+    signal(SIGPIPE, SIG_IGN); // Le disconnessioni vengono gestite dai valori di ritorno di send
+
+    // Blocca i segnali prima di creare qualsiasi thread
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_t signal_thread;
+    pthread_create(&signal_thread, NULL, signal_thread_main, &signals);
+    pthread_detach(signal_thread);
+
+    mem_init();
+    tournament_load_config();
+    trace_init();
+
+    // Aggiornamento a caldo: eventfd per fermare i thread e socket Unix per le richieste
+    upgrade_fd = eventfd(0, EFD_NONBLOCK);
+    lobby_init();
+    const char *path = getenv("TRIS_UPGRADE_SOCKET");
+    if (path && *path) {
+        upgrade_path = path;
+    }
+    int takeover = argc > 1 && strcmp(argv[1], "--takeover") == 0;
+    // Un secondo server avviato per errore sottrarrebbe a quello in esecuzione
+    // il socket di aggiornamento, l'archivio e le statistiche
+    if (!takeover && upgrade_server_running()) {
+        printf("[UPGRADE] Un server è già in esecuzione su %s (usa --takeover per sostituirlo)\n",
+               upgrade_path);
+        exit(EXIT_FAILURE);
+    }
+    capture_init(takeover);
+
+    // Archivio su disco: dopo un crash recupera partite e stanze, durante
+    // un aggiornamento a caldo viene azzerato e riscritto dallo stato ricevuto
+    // (in upgrade_takeover, dopo la conferma al vecchio processo)
+    if (!takeover) {
+        arena_open(1);
+        arena_recover();
+    }
+    // In un subentro le statistiche si caricano dopo che il vecchio processo le ha salvate
+    stats_init(!takeover);
+
+    int server_socket;
+    if (takeover) {
+        // Subentra al server in esecuzione ereditandone socket e partite
+        printf("[UPGRADE] Subentro al server in esecuzione tramite %s\n", upgrade_path);
+        server_socket = upgrade_takeover();
+    } else {
+        // Creazione socket server
+        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_socket < 0) {
+            perror("socket");
+            exit(EXIT_FAILURE);
+        }
+        printf("[SERVER] Socket creato\n");
+
+        // Dopo un crash le connessioni restano in TIME_WAIT: senza SO_REUSEADDR
+        // il server riavviato non potrebbe riprendere subito le partite
+        int reuse = 1;
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        // Configurazione indirizzo server
+        struct sockaddr_in server = {0};
+        server.sin_family = AF_INET;
+        int port = env_int("TRIS_PORT", 8080);
+        server.sin_port = htons(port);
+        server.sin_addr.s_addr = INADDR_ANY;
+
+        // Binding del socket
+        if (bind(server_socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
+            perror("bind");
+            close(server_socket);
+            exit(EXIT_FAILURE);
+        }
+        printf("[SERVER] Bind effettuato sulla porta %d\n", port);
+
+        // Inizio ascolto connessioni
+        if (listen(server_socket, CLIENTS_LIMIT) < 0) {
+            perror("listen");
+            close(server_socket);
+            exit(EXIT_FAILURE);
+        }
+        printf("[SERVER] In ascolto per connessioni...\n");
+    }
+    udp_init(server_socket);
+    upgrade_listen();
+
+    // Loop principale del server
+    while (1) {
+        printf("[SERVER] In attesa di connessioni...\n");
+        
+        // Accetta connessione da un client
+        int client_socket = accept_client(server_socket);
+        if (client_socket < 0) {
+            printf("[SERVER] Errore nell'accettare la connessione\n");
+            continue;
+        }
+        printf("[SERVER] Nuova connessione accettata\n");
+        mem_evict_rooms();
+
+        // Ricevi il flag iniziale dal client
+        int initial_flag = receive_flag(client_socket);
+        if (initial_flag < 0) {
+            printf("[SERVER] Errore nella ricezione del flag iniziale\n");
+            close(client_socket);
+            continue;
+        }
+        printf("[SERVER] Flag iniziale ricevuto: %d\n", initial_flag);
+
+        // Gestione stanze private
+        if (initial_flag == CREATE_PRIVATE) {
+            printf("[SERVER] Richiesta creazione stanza privata\n");
+            player_t *creator = receive_player(client_socket);
+            if (!creator) {
+                printf("[SERVER] Errore nella ricezione del creatore\n");
+                close(client_socket);
+                continue;
+            }
+            if (mem_refuse(creator)) {
+                continue;
+            }
+
+            // Crea una nuova stanza privata
+            int room_id = generate_unique_room_id();
+            private_room_t *room = calloc(1, sizeof(private_room_t));
+            room->id = room_id;
+            room->creator = creator;
+            room->token = arena_token();
+            room->arena_slot = arena_alloc(ARENA_ROOM, room_id, creator, NULL, &room->token);
+            if (add_private_room(room) < 0) {
+                arena_release(room->arena_slot);
+                free(room);
+                send(client_socket, &SERVER_BUSY, sizeof(int), 0);
+                close(client_socket);
+                delete_player(creator);
+                continue;
+            }
+            capture_room(client_socket, room_id);
+
+            // Comunica al creatore l'ID della stanza e il codice per riprenderla
+            int reply[3] = {PRIVATE_CREATED, htonl(room_id), htonl(room->token)};
+            send(creator->socket, reply, sizeof(reply), 0);
+            printf("[SERVER] Stanza privata %d creata da %s\n", room_id, creator->name);
+            continue;
+        } 
+        else if (initial_flag == JOIN_PRIVATE) {
+            printf("[SERVER] Richiesta di unione a stanza privata\n");
+            int net_room_id;
+            capture_recv(client_socket, &net_room_id, sizeof(int), 0);
+            int room_id = ntohl(net_room_id);
+            printf("[SERVER] Tentativo di unione a stanza %d\n", room_id);
+
+            player_t *joiner = receive_player(client_socket);
+            if (!joiner) {
+                printf("[SERVER] Errore nella ricezione del giocatore\n");
+                close(client_socket);
+                continue;
+            }
+            if (mem_refuse(joiner)) {
+                continue;
+            }
+
+            private_room_t *room = find_room_by_id(room_id);
+            if (!room || room->joiner) {
+                printf("[SERVER] Stanza %d %s\n", room_id, room ? "occupata da un'altra richiesta" : "non trovata");
+                send(joiner->socket, &JOIN_REJECTED, sizeof(int), 0);
+                close(joiner->socket);
+                delete_player(joiner);
+                continue;
+            }
+
+            // Invia richiesta di join al creatore della stanza
+            printf("[SERVER] Invio richiesta di join a %s\n", room->creator->name);
+            int req = JOIN_REQUEST;
+            int name_len = htons(joiner->name_len);
+            send(room->creator->socket, &req, sizeof(int), 0);
+            send(room->creator->socket, &name_len, sizeof(int), 0);
+            send(room->creator->socket, joiner->name, joiner->name_len, 0);
+
+            // La risposta del creatore arriva in accept_client (vedi APPROVAZIONE NELLE STANZE)
+            room->joiner = joiner;
+            room->join_deadline = time(NULL) + JOIN_APPROVAL_SECS;
+            continue;
+        } 
+        else if (initial_flag == TOURNAMENT_JOIN) {
+            printf("[SERVER] Richiesta di iscrizione al torneo\n");
+            player_t *player = receive_player(client_socket);
+            if (!player) {
+                printf("[SERVER] Errore nella ricezione del giocatore\n");
+                close(client_socket);
+                continue;
+            }
+            if (mem_refuse(player)) {
+                continue;
+            }
+            tournament_register(player);
+            continue;
+        }
+        else if (initial_flag == LEADERBOARD_REQUEST) {
+            printf("[SERVER] Richiesta di classifica\n");
+            player_t *player = receive_player(client_socket);
+            int net_k;
+            if (!player || capture_recv(client_socket, &net_k, sizeof(int), MSG_WAITALL) != sizeof(int)) {
+                printf("[SERVER] Errore nella ricezione della richiesta\n");
+                close(client_socket);
+                if (player) {
+                    delete_player(player);
+                }
+                continue;
+            }
+            // Anche la classifica costa un messaggio fino a STATS_TOP_K righe
+            if (mem_refuse(player)) {
+                continue;
+            }
+            stats_send_leaderboard(player, ntohl(net_k));
+            close(client_socket);
+            delete_player(player);
+            continue;
+        }
+        else if (initial_flag == LOBBY_SUBSCRIBE) {
+            printf("[SERVER] Richiesta di iscrizione alla lobby\n");
+            player_t *player = receive_player(client_socket);
+            if (!player) {
+                printf("[SERVER] Errore nella ricezione del giocatore\n");
+                close(client_socket);
+                continue;
+            }
+            // Un iscritto resta collegato e riceve ogni aggiornamento della lobby
+            if (mem_refuse(player)) {
+                continue;
+            }
+            lobby_subscribe(player);
+            continue;
+        }
+        else if (initial_flag == RESUME_REQUEST) {
+            printf("[SERVER] Richiesta di ripresa di una partita interrotta\n");
+            int net_id[2]; // ID e codice di ripresa
+            if (capture_recv(client_socket, net_id, sizeof(net_id), MSG_WAITALL) != sizeof(net_id)) {
+                printf("[SERVER] Errore nella ricezione dell'ID\n");
+                close(client_socket);
+                continue;
+            }
+            player_t *player = receive_player(client_socket);
+            if (!player) {
+                printf("[SERVER] Errore nella ricezione del giocatore\n");
+                close(client_socket);
+                continue;
+            }
+            // La partita ripresa conta come una nuova: oltre il limite si rifiuta
+            if (mem_refuse(player)) {
+                continue;
+            }
+            arena_resume(player, ntohl(net_id[0]), ntohl(net_id[1]));
+            continue;
+        }
+        else {
+            // Modalità gioco normale (non privata)
+            printf("[SERVER] Modalità gioco normale\n");
+            player_t *player = receive_player(client_socket);
+            if (!player) {
+                printf("[SERVER] Errore nella ricezione del giocatore\n");
+                close(client_socket);
+                continue;
+            }
+            // Chi trova un avversario già in attesa completa una partita e non si rifiuta
+            if (!waiting_player && mem_refuse(player)) {
+                continue;
+            }
+            match_random_player(player);
         }
     }
 
@@ -0,0 +1,399 @@
+// Simulatore di partite in batch per validare regole e IA.
+//
+// Ogni partita è rappresentata da due maschere a 9 bit (celle di X e di O).
+// Le partite avanzano in parallelo (lockstep): a ogni passo ogni partita
+// esegue una mossa e poi lo stato di tutte viene valutato con AVX2, 16
+// griglie per vettore da 16 bit e due vettori per iterazione (32 griglie).
+// Se la CPU non supporta AVX2 si usa il percorso scalare.
+//
+// La valutazione riproduce la semantica di check_win del server (incluso
+// l'ordine di controllo delle linee) ed è verificata contro di essa.
+//
+// Compilazione: gcc -O2 simulator.c -o simulator -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <immintrin.h>
+
+#define RULES_LOG(...)  // Niente log: vengono valutati milioni di griglie
+#include "../server/rules.h"
+
+#define BATCH_SIZE 1024      // Partite in lockstep per thread (multiplo di 32)
+#define MAX_THREADS 256      // Numero massimo di thread
+#define FULL_BOARD 0x1FF     // Tutte le 9 celle occupate
+#define N_LINES 8            // Linee vincenti
+
+// Linee vincenti nell'ordine in cui le controlla check_win:
+// diagonali, poi per ogni i la colonna i e la riga i
+const uint16_t lines[N_LINES] = {
+    (1 << 0) | (1 << 4) | (1 << 8), // Diagonale 1
+    (1 << 6) | (1 << 4) | (1 << 2), // Diagonale 2
+    (1 << 0) | (1 << 3) | (1 << 6), // Colonna 0
+    (1 << 0) | (1 << 1) | (1 << 2), // Riga 0
+    (1 << 1) | (1 << 4) | (1 << 7), // Colonna 1
+    (1 << 3) | (1 << 4) | (1 << 5), // Riga 1
+    (1 << 2) | (1 << 5) | (1 << 8), // Colonna 2
+    (1 << 6) | (1 << 7) | (1 << 8)  // Riga 2
+};
+
+// Politiche di scelta della mossa
+enum {
+    POLICY_RANDOM,    // Cella libera casuale
+    POLICY_HEURISTIC  // Vinci, blocca, centro, angolo, casuale
+};
+
+// Opzioni della simulazione
+typedef struct sim_config_t {
+    long long games;     // Partite totali da giocare
+    int threads;         // Thread di simulazione
+    int policy_x;        // Politica del giocatore X
+    int policy_o;        // Politica del giocatore O
+    int force_scalar;    // 1 per disattivare AVX2
+    int verify_every;    // Una partita ogni N viene verificata con check_win
+    unsigned long seed;  // Seme del generatore casuale
+} sim_config_t;
+
+// Stato e risultati di un thread
+typedef struct sim_worker_t {
+    pthread_t thread;
+    const sim_config_t *config;
+    long long quota;             // Partite da giocare
+    uint64_t rng;                // Stato del generatore xorshift
+    long long results[4];        // Conteggio per esito (indice = stato di rules.h)
+    long long verified;          // Partite verificate con check_win
+    long long mismatches;        // Discrepanze trovate
+    uint16_t x[BATCH_SIZE] __attribute__((aligned(32)));
+    uint16_t o[BATCH_SIZE] __attribute__((aligned(32)));
+    uint16_t state[BATCH_SIZE] __attribute__((aligned(32)));
+    uint8_t turn[BATCH_SIZE];    // 0 = tocca a X, 1 = tocca a O
+    uint8_t active[BATCH_SIZE];  // 0 se la corsia ha esaurito la quota
+} sim_worker_t;
+
+// Percorso di valutazione scelto all'avvio
+void (*evaluate)(const uint16_t *x, const uint16_t *o, uint16_t *state, size_t n);
+
+// Generatore xorshift64*
+static inline uint32_t next_random(uint64_t *rng) {
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return (uint32_t)((*rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Valuta una griglia con la stessa semantica di check_win
+static inline uint16_t evaluate_one(uint16_t x, uint16_t o) {
+    for (int l = 0; l < N_LINES; ++l) {
+        if ((x & lines[l]) == lines[l]) {
+            return PLAYER1_WIN;
+        }
+        if ((o & lines[l]) == lines[l]) {
+            return PLAYER2_WIN;
+        }
+    }
+    return (x | o) == FULL_BOARD ? GAME_DRAW : GAME_NOT_OVER;
+}
+
+// Valutazione scalare di un batch
+void evaluate_scalar(const uint16_t *x, const uint16_t *o, uint16_t *state, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        state[i] = evaluate_one(x[i], o[i]);
+    }
+}
+
+// Valuta 16 griglie: le linee sono scorse dalla meno prioritaria alla più
+// prioritaria, così l'ultima fusione corrisponde al primo controllo di check_win
+__attribute__((target("avx2")))
+static inline __m256i evaluate_vector(__m256i vx, __m256i vo) {
+    const __m256i full = _mm256_set1_epi16(FULL_BOARD);
+    const __m256i p1 = _mm256_set1_epi16(PLAYER1_WIN);
+    const __m256i p2 = _mm256_set1_epi16(PLAYER2_WIN);
+
+    __m256i occupied = _mm256_or_si256(vx, vo);
+    __m256i result = _mm256_and_si256(_mm256_cmpeq_epi16(occupied, full),
+                                      _mm256_set1_epi16(GAME_DRAW));
+    for (int l = N_LINES - 1; l >= 0; --l) {
+        __m256i line = _mm256_set1_epi16(lines[l]);
+        __m256i o_wins = _mm256_cmpeq_epi16(_mm256_and_si256(vo, line), line);
+        __m256i x_wins = _mm256_cmpeq_epi16(_mm256_and_si256(vx, line), line);
+        result = _mm256_blendv_epi8(result, p2, o_wins);
+        result = _mm256_blendv_epi8(result, p1, x_wins);
+    }
+    return result;
+}
+
+// Valutazione AVX2 di un batch (n multiplo di 32)
+__attribute__((target("avx2")))
+void evaluate_avx2(const uint16_t *x, const uint16_t *o, uint16_t *state, size_t n) {
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i x0 = _mm256_load_si256((const __m256i *)(x + i));
+        __m256i o0 = _mm256_load_si256((const __m256i *)(o + i));
+        __m256i x1 = _mm256_load_si256((const __m256i *)(x + i + 16));
+        __m256i o1 = _mm256_load_si256((const __m256i *)(o + i + 16));
+        _mm256_store_si256((__m256i *)(state + i), evaluate_vector(x0, o0));
+        _mm256_store_si256((__m256i *)(state + i + 16), evaluate_vector(x1, o1));
+    }
+}
+
+// Converte le maschere nella griglia usata dal server
+void masks_to_table(uint16_t x, uint16_t o, char *table) {
+    for (int c = 0; c < GRID_SIZE; ++c) {
+        table[c] = (x >> c) & 1 ? 'X' : (o >> c) & 1 ? 'O' : ' ';
+    }
+}
+
+// Sceglie una cella libera a caso
+static inline int random_cell(uint16_t empty, uint64_t *rng) {
+    int k = next_random(rng) % __builtin_popcount(empty);
+    while (k-- > 0) {
+        empty &= empty - 1;
+    }
+    return __builtin_ctz(empty);
+}
+
+// Cerca una cella che completa una linea per chi possiede mine
+static inline int winning_cell(uint16_t mine, uint16_t empty) {
+    for (int l = 0; l < N_LINES; ++l) {
+        uint16_t missing = lines[l] & ~mine;
+        if (__builtin_popcount(missing) == 1 && (missing & empty)) {
+            return __builtin_ctz(missing);
+        }
+    }
+    return -1;
+}
+
+// Sceglie la mossa secondo la politica
+static inline int choose_move(int policy, uint16_t mine, uint16_t theirs, uint64_t *rng) {
+    uint16_t empty = ~(mine | theirs) & FULL_BOARD;
+    if (policy == POLICY_HEURISTIC) {
+        int cell = winning_cell(mine, empty);
+        if (cell < 0) {
+            cell = winning_cell(theirs, empty);
+        }
+        if (cell >= 0) {
+            return cell;
+        }
+        if (empty & (1 << 4)) {
+            return 4;
+        }
+        uint16_t corners = empty & ((1 << 0) | (1 << 2) | (1 << 6) | (1 << 8));
+        if (corners) {
+            return random_cell(corners, rng);
+        }
+    }
+    return random_cell(empty, rng);
+}
+
+// Verifica una partita conclusa con check_win del server
+void verify_game(sim_worker_t *w, int lane) {
+    char table[GRID_SIZE];
+    masks_to_table(w->x[lane], w->o[lane], table);
+    uint8_t expected = check_win(table);
+    w->verified++;
+    if (expected != w->state[lane]) {
+        w->mismatches++;
+        fprintf(stderr, "[SIM] Discrepanza: x=%03x o=%03x simulatore=%d check_win=%d\n",
+                w->x[lane], w->o[lane], w->state[lane], expected);
+    }
+}
+
+// Loop di un thread: tutte le partite del batch avanzano insieme
+void *sim_worker_main(void *arg) {
+    sim_worker_t *w = (sim_worker_t *)arg;
+    const sim_config_t *config = w->config;
+    long long started = 0, finished = 0;
+
+    for (int lane = 0; lane < BATCH_SIZE; ++lane) {
+        w->x[lane] = w->o[lane] = 0;
+        w->turn[lane] = 0;
+        w->state[lane] = GAME_NOT_OVER;
+        w->active[lane] = started < w->quota;
+        started += w->active[lane];
+    }
+
+    while (finished < w->quota) {
+        // Una mossa per ogni partita ancora in corso
+        for (int lane = 0; lane < BATCH_SIZE; ++lane) {
+            if (!w->active[lane]) {
+                continue;
+            }
+            if (w->turn[lane] == 0) {
+                w->x[lane] |= 1 << choose_move(config->policy_x, w->x[lane], w->o[lane], &w->rng);
+            } else {
+                w->o[lane] |= 1 << choose_move(config->policy_o, w->o[lane], w->x[lane], &w->rng);
+            }
+            w->turn[lane] ^= 1;
+        }
+
+        evaluate(w->x, w->o, w->state, BATCH_SIZE);
+
+        // Partite concluse: conteggio, verifica a campione e nuova partita
+        for (int lane = 0; lane < BATCH_SIZE; ++lane) {
+            uint16_t state = w->state[lane];
+            if (!w->active[lane] || state == GAME_NOT_OVER) {
+                continue;
+            }
+            w->results[state]++;
+            if (config->verify_every > 0 && finished % config->verify_every == 0) {
+                verify_game(w, lane);
+            }
+            finished++;
+
+            w->x[lane] = w->o[lane] = 0;
+            w->turn[lane] = 0;
+            w->active[lane] = started < w->quota;
+            started += w->active[lane];
+        }
+    }
+    return NULL;
+}
+
+// Confronta il valutatore scelto con check_win su tutte le 3^9 griglie
+int verify_all_boards(void) {
+    static uint16_t x[19712] __attribute__((aligned(32)));
+    static uint16_t o[19712] __attribute__((aligned(32)));
+    static uint16_t state[19712] __attribute__((aligned(32)));
+    int n = 0;
+
+    for (int code = 0; code < 19683; ++code) {
+        int value = code;
+        x[n] = o[n] = 0;
+        for (int c = 0; c < GRID_SIZE; ++c, value /= 3) {
+            if (value % 3 == 1) {
+                x[n] |= 1 << c;
+            } else if (value % 3 == 2) {
+                o[n] |= 1 << c;
+            }
+        }
+        n++;
+    }
+    while (n % 32 != 0) {
+        x[n] = o[n] = 0;
+        n++;
+    }
+
+    evaluate(x, o, state, n);
+
+    int mismatches = 0;
+    for (int i = 0; i < 19683; ++i) {
+        char table[GRID_SIZE];
+        masks_to_table(x[i], o[i], table);
+        if (check_win(table) != state[i]) {
+            if (mismatches++ < 10) {
+                fprintf(stderr, "[SIM] Discrepanza: x=%03x o=%03x simulatore=%d check_win=%d\n",
+                        x[i], o[i], state[i], check_win(table));
+            }
+        }
+    }
+    return mismatches;
+}
+
+// Converte il nome di una politica
+int parse_policy(const char *name) {
+    if (strcmp(name, "heuristic") == 0) {
+        return POLICY_HEURISTIC;
+    }
+    if (strcmp(name, "random") != 0) {
+        fprintf(stderr, "Politica sconosciuta: %s (random|heuristic)\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return POLICY_RANDOM;
+}
+
+void usage(const char *program) {
+    fprintf(stderr,
+            "Uso: %s [-g partite] [-t thread] [-x politica] [-o politica] [-v N] [-s seme] [-S]\n"
+            "  -g  partite da simulare (default 10000000)\n"
+            "  -t  thread (default: uno per core)\n"
+            "  -x  politica di X: random|heuristic (default random)\n"
+            "  -o  politica di O: random|heuristic (default random)\n"
+            "  -v  verifica con check_win una partita ogni N (0 = mai, default 1000)\n"
+            "  -s  seme del generatore casuale\n"
+            "  -S  forza il percorso scalare\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    sim_config_t config = {10000000LL, 0, POLICY_RANDOM, POLICY_RANDOM, 0, 1000, 0};
+    config.seed = (unsigned long)time(NULL);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:t:x:o:v:s:Sh")) != -1) {
+        switch (opt) {
+        case 'g': config.games = atoll(optarg); break;
+        case 't': config.threads = atoi(optarg); break;
+        case 'x': config.policy_x = parse_policy(optarg); break;
+        case 'o': config.policy_o = parse_policy(optarg); break;
+        case 'v': config.verify_every = atoi(optarg); break;
+        case 's': config.seed = strtoul(optarg, NULL, 10); break;
+        case 'S': config.force_scalar = 1; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    // Senza partite le percentuali finali sarebbero divisioni per zero
+    if (config.games <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (config.threads <= 0) {
+        config.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (config.threads > MAX_THREADS) {
+        config.threads = MAX_THREADS;
+    }
+
+    __builtin_cpu_init();
+    int use_avx2 = !config.force_scalar && __builtin_cpu_supports("avx2");
+    evaluate = use_avx2 ? evaluate_avx2 : evaluate_scalar;
+    printf("[SIM] Valutazione %s, %d thread, %lld partite\n",
+           use_avx2 ? "AVX2 (32 griglie per iterazione)" : "scalare", config.threads, config.games);
+
+    // Verifica esaustiva prima di iniziare
+    int mismatches = verify_all_boards();
+    if (mismatches > 0) {
+        fprintf(stderr, "[SIM] %d griglie valutate diversamente da check_win\n", mismatches);
+        return EXIT_FAILURE;
+    }
+    printf("[SIM] Tutte le 19683 griglie concordano con check_win\n");
+
+    sim_worker_t *workers = aligned_alloc(32, config.threads * sizeof(sim_worker_t));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < config.threads; ++i) {
+        sim_worker_t *w = &workers[i];
+        memset(w->results, 0, sizeof(w->results));
+        w->config = &config;
+        w->quota = config.games / config.threads + (i < config.games % config.threads);
+        w->rng = (config.seed + 1) * 0x9E3779B97F4A7C15ULL + (uint64_t)i * 0xBF58476D1CE4E5B9ULL;
+        w->verified = w->mismatches = 0;
+        pthread_create(&w->thread, NULL, sim_worker_main, w);
+    }
+
+    long long results[4] = {0}, verified = 0;
+    mismatches = 0;
+    for (int i = 0; i < config.threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        for (int r = 0; r < 4; ++r) {
+            results[r] += workers[i].results[r];
+        }
+        verified += workers[i].verified;
+        mismatches += workers[i].mismatches;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(workers);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long long total = results[PLAYER1_WIN] + results[PLAYER2_WIN] + results[GAME_DRAW];
+    printf("[SIM] Vittorie X: %.2f%%  Vittorie O: %.2f%%  Pareggi: %.2f%%\n",
+           100.0 * results[PLAYER1_WIN] / total, 100.0 * results[PLAYER2_WIN] / total,
+           100.0 * results[GAME_DRAW] / total);
+    printf("[SIM] Verificate con check_win: %lld partite, %d discrepanze\n", verified, mismatches);
+    printf("[SIM] %lld partite in %.3f s: %.0f partite/s\n", total, seconds, total / seconds);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}